@@ -0,0 +1,89 @@
+#ifndef _SQLDB_AGGREGATION_H_
+#define _SQLDB_AGGREGATION_H_
+
+#include "Table.h"
+#include "Cursor.h"
+#include "MemoryTable.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "robin_hood.h"
+
+namespace sqldb {
+  // Group by aggregation over cursors. Rows are grouped by the keys of the
+  // group columns, and the aggregates are computed over the values of a
+  // column, ignoring nulls. Integer columns are accumulated as integers and
+  // other columns as doubles. Partial aggregations of separate scans can be
+  // merged.
+  class Aggregation {
+  public:
+    enum class Function { COUNT = 1, SUM, MIN, MAX, AVG };
+
+    Aggregation(std::vector<int> group_columns) : group_columns_(std::move(group_columns)) { }
+
+    // Adds an aggregate column to the result. COUNT with column -1 counts
+    // all the rows of the group.
+    void addAggregate(Function function, int column, std::string name);
+
+    void addCount(std::string name = "count") { addAggregate(Function::COUNT, -1, std::move(name)); }
+    void addSum(int column, std::string name) { addAggregate(Function::SUM, column, std::move(name)); }
+    void addMin(int column, std::string name) { addAggregate(Function::MIN, column, std::move(name)); }
+    void addMax(int column, std::string name) { addAggregate(Function::MAX, column, std::move(name)); }
+    void addAvg(int column, std::string name) { addAggregate(Function::AVG, column, std::move(name)); }
+
+    // Adds the rows from the current position of the cursor to the end
+    void consume(Cursor & cursor);
+
+    // Adds the groups of another aggregation with the same aggregates
+    void merge(const Aggregation & other);
+
+    // Aggregates a scan of the table in partitions on num_threads threads,
+    // and adds the result to this aggregation
+    void consume(Table & table, int num_threads = 0, int sheet = 0);
+
+    // Returns a table with a row for each group. The row key is the group
+    // key, and the columns are the group columns and the aggregates.
+    std::unique_ptr<MemoryTable> getResult() const;
+
+    size_t getNumGroups() const { return groups_.size(); }
+
+  private:
+    struct Aggregate {
+      Function function;
+      int column;
+      std::string name;
+      bool is_integer;
+    };
+
+    union Value {
+      long long i;
+      double d;
+    };
+
+    // count is the number of values, except in COUNT of all rows
+    struct Accumulator {
+      long long count;
+      Value value;
+    };
+
+    template<typename GetColumn>
+    void describe(GetColumn get_column);
+    Aggregation createPartial() const;
+    size_t findGroup(const Key & key);
+
+    std::vector<int> group_columns_;
+    std::vector<std::string> group_names_;
+    std::vector<ColumnType> group_types_;
+    std::vector<Aggregate> aggregates_;
+    bool is_described_ = false;
+
+    // maps the group keys to group numbers
+    robin_hood::unordered_flat_map<Key, size_t> groups_;
+    // accumulators of the aggregates for each group, group by group
+    std::vector<Accumulator> accumulators_;
+  };
+};
+
+#endif
@@ -52,9 +52,12 @@ namespace sqldb {
       throw std::runtime_error("CSV is read-only");
     }
 
-    std::unique_ptr<Cursor> seekBegin(int sheet) override { return seek(0, sheet); }
+    std::unique_ptr<Cursor> seekBegin(int sheet) override;
     std::unique_ptr<Cursor> seek(const Key & key) override;
     std::unique_ptr<Cursor> seek(int row, int sheet) override;
+    std::unique_ptr<Cursor> seekBegin(int sheet, const std::vector<int> & columns) override { return seek(0, sheet, columns); }
+    std::unique_ptr<Cursor> seek(int row, int sheet, const std::vector<int> & columns) override;
+    std::vector<std::unique_ptr<Cursor>> seekPartitions(int num_partitions, int sheet = 0) override;
     
   private:
     // csv_ is shared with cursors
@@ -51,16 +51,34 @@ namespace sqldb {
       throw std::runtime_error("dBase4 is read-only");
     }
 
-    std::unique_ptr<Cursor> seekBegin(int sheet) override { return seek(0); }
+    std::unique_ptr<Cursor> seekBegin(int sheet) override;
     std::unique_ptr<Cursor> seek(const Key & key) override;
     std::unique_ptr<Cursor> seek(int row, int sheet = 0) override;
+    std::vector<std::unique_ptr<Cursor>> seekPartitions(int num_partitions, int sheet = 0) override;
 
     void setPrimaryKeyMapping(std::unordered_map<sqldb::Key, int> m) { primary_key_mapping_ = std::move(m); }
 
+    // Builds the hash index from the primary key column to the record
+    // number. seek(Key) builds the index on first use. Large files are
+    // indexed in parallel with up to num_threads threads (0 = one per core).
+    void buildPrimaryKeyIndex(int num_threads = 0);
+
+    // Stores the primary key index in a sidecar file, which is reused as long
+    // as the size and the modification time of the DBF file are unchanged
+    void setIndexFile(std::string filename) { index_file_ = std::move(filename); }
+
+    using PrimaryKeyIndex = robin_hood::unordered_flat_map<std::string, int>;
+
   private:    
+    bool loadIndex();
+    void saveIndex() const;
+    
     // dbf_ is shared with cursors
     std::shared_ptr<DBase4File> dbf_;
     std::unordered_map<sqldb::Key, int> primary_key_mapping_;
+    // the index doesn't change, so it's shared with copies
+    std::shared_ptr<const PrimaryKeyIndex> primary_key_index_;
+    std::string index_file_;
   };
 };
 
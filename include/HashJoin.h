@@ -0,0 +1,27 @@
+#ifndef _SQLDB_HASHJOIN_H_
+#define _SQLDB_HASHJOIN_H_
+
+#include "Table.h"
+#include "Cursor.h"
+
+#include <memory>
+#include <string>
+
+namespace sqldb {
+  // Returns a read-only cursor over the inner join of two tables on the
+  // equality of build_column and probe_column. The rows of the build table,
+  // which should be the smaller one, are read into a hash table on the join
+  // key, and the probe table is streamed against it. The joined rows have
+  // the columns of the probe table followed by the columns of the build
+  // table, and the row key of the probe row. If either column is numeric,
+  // the keys are compared as integers and text values are parsed. Null
+  // keys don't match.
+  //
+  // If the build table doesn't fit in memory_budget bytes, both tables are
+  // partitioned by the hash of the join key into temporary files in
+  // temp_dir (the system default if empty), and the partitions are joined
+  // one at a time. Returns null if no rows match.
+  std::unique_ptr<Cursor> hashJoin(Table & build, int build_column, Table & probe, int probe_column, size_t memory_budget = 256 * 1024 * 1024, std::string temp_dir = "", int build_sheet = 0, int probe_sheet = 0);
+};
+
+#endif
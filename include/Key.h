@@ -6,6 +6,7 @@
 #include <string>
 #include <vector>
 #include <variant>
+#include <limits>
 
 #include "robin_hood.h"
 
@@ -218,6 +219,24 @@ namespace sqldb {
       }      
     }
 
+    // Returns the smallest key that is greater than all the keys that start
+    // with this key, or an empty key if this is empty
+    Key getPrefixEnd() const noexcept {
+      sqldb::Key key = *this;
+      if (!key.empty()) {
+	auto & c = key.components_.back();
+	if (std::holds_alternative<std::string>(c)) {
+	  std::get<std::string>(c).push_back('\0');
+	} else if (std::get<long long>(c) < std::numeric_limits<long long>::max()) {
+	  c = std::get<long long>(c) + 1;
+	} else {
+	  // strings come after all numbers
+	  c = std::string();
+	}
+      }
+      return key;
+    }
+
     Key getParentKey() const noexcept {
       if (size() >= 2) {
 	sqldb::Key key = *this;
@@ -0,0 +1,80 @@
+#ifndef _SQLDB_MEMORYSNAPSHOT_H_
+#define _SQLDB_MEMORYSNAPSHOT_H_
+
+#include "Table.h"
+#include "Cursor.h"
+
+#include <stdexcept>
+#include <memory>
+#include <string>
+
+namespace sqldb {
+  class SnapshotFile;
+
+  // Read-only table over a binary snapshot file, e.g. of a MemoryTable. The
+  // file is mapped to memory and opening it only reads the schema and the
+  // chunk directory at the end of the file. The rows are stored in chunks
+  // where the values of each column are stored together, so the pages of a
+  // column are only read when the column is.
+  class MemorySnapshot : public Table {
+  public:
+    MemorySnapshot(std::string filename);
+
+    // Writes the rows of a scan of the table to a snapshot file in one
+    // pass. The file is written under a temporary name and renamed when it
+    // is complete, so readers never see a partial file. If the rows are in
+    // key order, seek(Key) and seekRange() use binary search, and otherwise
+    // seek(Key) builds a hash index on first use.
+    static void write(Table & table, const std::string & filename, int sheet = 0);
+
+    std::unique_ptr<Table> copy() const override { return std::make_unique<MemorySnapshot>(*this); }
+
+    int getNumFields(int sheet = 0) const override;
+    const std::string & getColumnName(int column_index, int sheet = 0) const override;
+    ColumnType getColumnType(int column_index, int sheet = 0) const override;
+    bool isColumnUnique(int column_index, int sheet = 0) const override;
+    int getColumnDecimals(int column_index) const override;
+
+    void clear() override {
+      throw std::runtime_error("Snapshot is read-only");
+    }
+
+    void addColumn(std::string_view name, sqldb::ColumnType type, bool unique, int decimals) override {
+      throw std::runtime_error("Snapshot is read-only");
+    }
+
+    std::unique_ptr<Cursor> insert(const Key & key) override {
+      throw std::runtime_error("Snapshot is read-only");
+    }
+
+    std::unique_ptr<Cursor> insert(int sheet) override {
+      throw std::runtime_error("Snapshot is read-only");
+    }
+
+    std::unique_ptr<Cursor> increment(const Key & key) override {
+      throw std::runtime_error("Snapshot is read-only");
+    }
+
+    std::unique_ptr<Cursor> assign(std::vector<int> columns) override {
+      throw std::runtime_error("Snapshot is read-only");
+    }
+
+    void remove(const Key & key) override {
+      throw std::runtime_error("Snapshot is read-only");
+    }
+
+    std::unique_ptr<Cursor> seekBegin(int sheet = 0) override;
+    std::unique_ptr<Cursor> seek(const Key & key) override;
+    std::unique_ptr<Cursor> seek(int row, int sheet = 0) override;
+    std::unique_ptr<Cursor> seekRange(const Key & lo, const Key & hi, int sheet = 0) override;
+    std::vector<std::unique_ptr<Cursor>> seekPartitions(int num_partitions, int sheet = 0) override;
+
+    size_t getNumRows() const;
+
+  private:
+    // the file is immutable, so it's shared with copies and cursors
+    std::shared_ptr<const SnapshotFile> file_;
+  };
+};
+
+#endif
@@ -4,18 +4,33 @@
 #include <Table.h>
 
 #include <memory>
+#include <string>
 
 namespace sqldb {
   class MemoryStorage;
   
   class MemoryTable : public Table {
   public:
+    enum class IndexType { HASH = 1, ORDERED };
+    
     MemoryTable();
     MemoryTable(std::vector<ColumnType> key_type);
+    // Copies share the rows in pages that are copied when either table
+    // changes them, so copying is cheap and a copy is a consistent snapshot
+    MemoryTable(const MemoryTable & other);
+    MemoryTable & operator=(const MemoryTable & other);
 
     std::unique_ptr<Table> copy() const override { return std::make_unique<MemoryTable>(*this); }
 
     void addColumn(std::string_view name, sqldb::ColumnType type, bool unique, int decimals) override;
+
+    // Adds an index on the values of the column as returned by getKey().
+    // The index is maintained as rows change, and changes that would
+    // duplicate a value in a unique index throw std::runtime_error. Nulls
+    // are not indexed. Columns added as unique get a unique hash index.
+    // A column has one index, so a new index replaces the old one, and the
+    // index of a unique column is always unique.
+    void addIndex(int column, IndexType type = IndexType::HASH, bool unique = false);
     
     std::unique_ptr<Cursor> insert(const Key & key) override;
     std::unique_ptr<Cursor> insert(int sheet = 0) override;
@@ -25,6 +40,35 @@ namespace sqldb {
     
     std::unique_ptr<Cursor> seekBegin(int sheet = 0) override;    
     std::unique_ptr<Cursor> seek(const Key & key) override;
+    std::unique_ptr<Cursor> seekRange(const Key & lo, const Key & hi, int sheet = 0) override;
+    std::vector<std::unique_ptr<Cursor>> seekPartitions(int num_partitions, int sheet = 0) override;
+
+    // Index lookups return the rows where the column has the value, in row
+    // key order, or within [min, max] in value order, where an empty bound
+    // is open. Range lookups need an ordered index. Like seek(Key), they
+    // ignore the filters. Returns null if there are no rows, and throws if
+    // the column has no suitable index.
+    std::unique_ptr<Cursor> seekIndex(int column, const Key & value);
+    std::unique_ptr<Cursor> seekIndexRange(int column, const Key & min, const Key & max);
+
+    // Makes the changes durable with a write-ahead log in dir, which is
+    // created if necessary. If dir already has a log, the table must be
+    // empty and it's first restored from the log. Each change is on disk
+    // when it returns, and concurrent changes share the syncs (group
+    // commit). The changes that a thread makes between begin() and commit()
+    // are synced once by commit(). The changes can't be undone, so
+    // rollback() ends the batch like commit() and then throws. Whenever the
+    // log grows by checkpoint_size bytes, a snapshot is written in the
+    // background and the log before it is removed. Copies of the table are
+    // not logged.
+    void openLog(const std::string & dir, size_t checkpoint_size = 64 * 1024 * 1024);
+
+    // Writes a snapshot of the table and removes the log before it
+    void checkpoint();
+
+    void begin() override;
+    void commit() override;
+    void rollback() override;
     
     int getNumFields(int sheet = 0) const override;
     
@@ -34,8 +78,15 @@ namespace sqldb {
     int getColumnDecimals(int column_index) const override;
         
     void clear() override;
+
+    uint64_t getVersion() const override;
+    bool getChangedRows(uint64_t version, std::vector<Key> & keys) const override;
     
   private:
+    friend class MemoryStorage;
+
+    MemoryTable(std::vector<ColumnType> key_type, std::shared_ptr<MemoryStorage> storage);
+
     std::shared_ptr<MemoryStorage> storage_;
   };
 };
@@ -2,10 +2,19 @@
 #define _SQLDB_MYSQL_H_
 
 #include "Connection.h"
+#include "Table.h"
 
 #include <mysql.h>
 
+#include <chrono>
+#include <unordered_map>
+#include <variant>
+#include <vector>
+#include <exception>
+
 namespace sqldb {
+  class MySQLBulkInsert;
+  
   class MySQL : public Connection {
   public:
     MySQL() { }
@@ -14,7 +23,43 @@ namespace sqldb {
     void connect(std::string host_name, int port, std::string user_name, std::string password, std::string db_name);
     void connect();
     
-    std::unique_ptr<SQLStatement> prepare(std::string_view query) override;
+    // Result sets are buffered in the client by default. In UNBUFFERED mode
+    // rows are read from the connection as they are fetched, and in CURSOR
+    // mode a server-side read-only cursor returns prefetch_rows rows at a
+    // time. In both streaming modes the connection can't run other queries
+    // until the result has been read or the statement is reset.
+    enum class ResultMode { BUFFERED = 0, UNBUFFERED, CURSOR };
+
+    std::unique_ptr<SQLStatement> prepare(std::string_view query) override {
+      return prepare(query, ResultMode::BUFFERED);
+    }
+    std::unique_ptr<SQLStatement> prepare(std::string_view query, ResultMode mode, unsigned long prefetch_rows = 0);
+
+    // Returns a statement from the statement cache of the connection. The
+    // cache is kept over reconnects and the queries are prepared again when
+    // they are next requested. A reconnect invalidates the returned references.
+    SQLStatement & prepareCached(std::string_view query);
+    size_t getStatementCacheSize() const { return statement_cache_.size(); }
+
+    // Streams all rows of source into table with LOAD DATA LOCAL INFILE. The
+    // rows are converted to tab-separated text while the server reads them.
+    // Target columns default to the column names of the source. Requires
+    // setLocalInfile(true) before connecting.
+    size_t load(std::string_view table, Table & source, std::vector<std::string> columns = std::vector<std::string>());
+
+    // Returns a statement that inserts the executed rows into table in batches
+    std::unique_ptr<MySQLBulkInsert> prepareBulkInsert(std::string table, std::vector<std::string> columns, size_t batch_size = 1000);
+
+    // Reconnects with the stored parameters. Failed attempts are retried
+    // max_attempts times in total, doubling the delay after each one.
+    // prepare() reconnects when the connection has been lost, except in a
+    // transaction, where it throws since the transaction is lost as well.
+    bool reconnect();
+    void setReconnectPolicy(int max_attempts, std::chrono::milliseconds initial_backoff) {
+      max_reconnect_attempts_ = max_attempts;
+      reconnect_backoff_ = initial_backoff;
+    }
+    
     bool ping() override;
     void begin() override;
     void commit() override;
@@ -22,12 +67,136 @@ namespace sqldb {
 
     std::pair<size_t, size_t> execute(std::string_view query) override;
 
+    // Sends all queries in one round trip and returns a result for each of
+    // them with the affected rows, warnings and rows. Execution stops at the
+    // first failing query. Multi-statements are enabled for the duration of
+    // the call unless they were enabled with setMultiStatements().
+    std::vector<std::unique_ptr<SQLStatement>> executeBatch(const std::vector<std::string> & queries);
+
+    // Non-blocking execution using the MariaDB Connector/C non-blocking API.
+    // startQuery() sends the query and returns the MYSQL_WAIT_* events to wait
+    // for on getSocket(), or zero when the query has completed. While the
+    // status is non-zero, wait for the events (or getTimeout() milliseconds)
+    // and call continueQuery() with the events that occurred. Once complete,
+    // takeResult() returns the result, or throws if the query failed.
+    int startQuery(std::string_view query);
+    int continueQuery(int ready_status);
+    std::unique_ptr<SQLStatement> takeResult();
+    bool isQueryPending() const { return async_status_ != 0; }
+    int getSocket() const;
+    unsigned int getTimeout() const;
+
+    // Waits with poll() until at least one of the pending queries of the
+    // connections can continue, and continues it. Returns the number of
+    // queries that are still pending.
+    static size_t poll(const std::vector<MySQL *> & connections, int timeout_ms = -1);
+
     bool isConnected() const { return conn_ != 0; }
 
+    // Rolls back an open transaction and discards a completed non-blocking
+    // result so that the connection can be reused by someone else. Returns
+    // false if it can't be reused, i.e. if a non-blocking query is still
+    // running or a streaming result hasn't been read.
+    bool resetState();
+
+    // Allows LOAD DATA LOCAL INFILE. Takes effect on the next connect().
+    void setLocalInfile(bool t) { local_infile_ = t; }
+    // Allows multiple statements per query. Takes effect on the next connect().
+    void setMultiStatements(bool t) { multi_statements_ = t; }
+
   private:
+    friend class MySQLBulkInsert;
+
+    enum class AsyncState { NONE = 0, QUERY, STORE_RESULT, DONE };
+    int advanceQuery(int status, int error);
+    
     MYSQL * conn_ = 0;
     std::string host_name_, user_name_, password_, db_name_;
     int port_ = 0;
+    bool local_infile_ = false, multi_statements_ = false;
+    bool in_transaction_ = false; // between begin() and commit() or rollback()
+    uint64_t connection_number_ = 0; // incremented by connect()
+    int max_reconnect_attempts_ = 3;
+    std::chrono::milliseconds reconnect_backoff_ = std::chrono::milliseconds(100);
+    std::unordered_map<std::string, std::unique_ptr<SQLStatement>> statement_cache_;
+
+    // state of the non-blocking query
+    bool is_nonblocking_ = false;
+    AsyncState async_state_ = AsyncState::NONE;
+    int async_status_ = 0;
+    std::chrono::steady_clock::time_point async_deadline_; // end of a MYSQL_WAIT_TIMEOUT wait
+    std::string async_query_;
+    MYSQL_RES * async_result_ = 0;
+    std::exception_ptr async_error_;
+  };
+
+  // Buffers the rows that are bound and executed, and inserts them batch_size
+  // rows at a time. With MariaDB Connector/C a batch is sent as a single
+  // array bound execution (STMT_ATTR_ARRAY_SIZE), otherwise as multi-row
+  // INSERT statements. flush() sends the remaining rows and must be called
+  // to see errors from the last batch, since the destructor ignores them.
+  // Each statement removes its rows from the buffer when it has been sent,
+  // even if it fails, so flushing again after an error never inserts the
+  // rows of a statement twice.
+  class MySQLBulkInsert : public SQLStatement {
+  public:
+    MySQLBulkInsert(MySQL & conn, std::string table, std::vector<std::string> columns, size_t batch_size);
+    ~MySQLBulkInsert();
+
+    size_t execute() override;
+    void flush();
+
+    void set(int column_idx, std::string_view value, bool is_defined = true) override;
+    void set(int column_idx, int value, bool is_defined = true) override;
+    void set(int column_idx, long long value, bool is_defined = true) override;
+    void set(int column_idx, double value, bool is_defined = true) override;
+    void set(int column_idx, const void * data, size_t len, bool is_defined = true) override;
+
+    bool next() override { return false; }
+    std::vector<uint8_t> getBlob(int column_index) override { return std::vector<uint8_t>(); }
+    std::string_view getText(int column_index) override { return std::string_view(); }
+    bool isNull(int column_index) const override { return true; }
+    int getNumFields() const override { return static_cast<int>(columns_.size()); }
+    const std::string & getColumnName(int column_index) override {
+      auto idx = static_cast<size_t>(column_index);
+      return idx < columns_.size() ? columns_[idx] : empty_string;
+    }
+    double getDouble(int column_index, double default_value = 0.0) override { return default_value; }
+    float getFloat(int column_index, float default_value = 0.0f) override { return default_value; }
+    int getInt(int column_index, int default_value = 0) override { return default_value; }
+    long long getLongLong(int column_index, long long default_value = 0) override { return default_value; }
+    Key getKey(int column_index) override { return Key(); }
+
+    long long getLastInsertId() const override { return last_insert_id_; }
+    size_t getAffectedRows() const override { return rows_affected_; }
+    size_t getNumPendingRows() const { return num_rows_; }
+
+  private:
+    using Value = std::variant<std::monostate, long long, double, std::string>;
+
+    std::string makeQuery(size_t num_rows) const;
+    void setValue(int column_idx, Value value);
+    bool flushArray();
+    void flushMultiRow();
+    // removes the first n rows from the buffer
+    void dropRows(size_t n);
+
+    MySQL & conn_;
+    std::string table_;
+    std::vector<std::string> columns_;
+    size_t batch_size_;
+    std::vector<Value> pending_row_;
+    std::vector<Value> rows_; // buffered rows in row-major order
+    size_t num_rows_ = 0;
+    MYSQL_STMT * array_stmt_ = 0;
+    bool has_array_binding_ = true;
+    std::unique_ptr<SQLStatement> batch_stmt_;
+    size_t batch_stmt_rows_ = 0;
+    uint64_t connection_number_; // the connection of the prepared statements
+    long long last_insert_id_ = 0;
+    size_t rows_affected_ = 0;
+
+    static inline std::string empty_string;
   };
 };
 
@@ -0,0 +1,107 @@
+#ifndef _SQLDB_MYSQLPOOL_H_
+#define _SQLDB_MYSQLPOOL_H_
+
+#include "MySQL.h"
+
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <chrono>
+
+namespace sqldb {
+  class MySQLPool;
+
+  // Connection checked out from a MySQLPool. The connection is returned to
+  // the pool when the handle is destroyed.
+  class MySQLConnectionHandle {
+  public:
+    MySQLConnectionHandle(MySQLPool * pool, std::unique_ptr<MySQL> conn) : pool_(pool), conn_(std::move(conn)) { }
+    MySQLConnectionHandle(const MySQLConnectionHandle & other) = delete;
+    MySQLConnectionHandle(MySQLConnectionHandle && other) : pool_(other.pool_), conn_(std::move(other.conn_)) { }
+    ~MySQLConnectionHandle() { release(); }
+
+    MySQLConnectionHandle & operator=(const MySQLConnectionHandle & other) = delete;
+    MySQLConnectionHandle & operator=(MySQLConnectionHandle && other) {
+      if (this != &other) {
+	release();
+	pool_ = other.pool_;
+	conn_ = std::move(other.conn_);
+      }
+      return *this;
+    }
+
+    MySQL * operator->() { return conn_.get(); }
+    MySQL & operator*() { return *conn_; }
+    MySQL * get() { return conn_.get(); }
+
+    void release();
+
+  private:
+    MySQLPool * pool_;
+    std::unique_ptr<MySQL> conn_;
+  };
+
+  class MySQLPool {
+  public:
+    struct Stats {
+      size_t num_checkouts = 0, num_timeouts = 0, num_reconnects = 0;
+      std::chrono::nanoseconds total_wait = std::chrono::nanoseconds(0);
+      std::chrono::nanoseconds max_wait = std::chrono::nanoseconds(0);
+    };
+
+    MySQLPool(std::string host_name, int port, std::string user_name, std::string password, std::string db_name, size_t min_size = 1, size_t max_size = 8);
+    MySQLPool(const MySQLPool & other) = delete;
+    ~MySQLPool();
+
+    MySQLPool & operator=(const MySQLPool & other) = delete;
+
+    // Checks out a connection, waiting at most timeout for one to become
+    // available. Connections that have been idle longer than the ping
+    // interval are pinged first and reconnected if they have gone away.
+    MySQLConnectionHandle acquire(std::chrono::milliseconds timeout = std::chrono::milliseconds(30000));
+
+    // Pings the idle connections, closes the broken ones and opens new
+    // connections up to the minimum size. Should be called periodically.
+    void maintain();
+
+    void setPingInterval(std::chrono::milliseconds interval) { ping_interval_ = interval; }
+    void setReconnectPolicy(int max_attempts, std::chrono::milliseconds initial_backoff) {
+      max_reconnect_attempts_ = max_attempts;
+      reconnect_backoff_ = initial_backoff;
+    }
+
+    size_t size() const;
+    size_t getNumIdle() const;
+    Stats getStats() const;
+
+  protected:
+    friend class MySQLConnectionHandle;
+
+    void release(std::unique_ptr<MySQL> conn);
+
+  private:
+    struct IdleConnection {
+      std::unique_ptr<MySQL> conn;
+      std::chrono::steady_clock::time_point idle_since;
+    };
+
+    std::unique_ptr<MySQL> create();
+    bool check(MySQL & conn);
+
+    std::string host_name_, user_name_, password_, db_name_;
+    int port_;
+    size_t min_size_, max_size_;
+    std::chrono::milliseconds ping_interval_ = std::chrono::milliseconds(30000);
+    int max_reconnect_attempts_ = 3;
+    std::chrono::milliseconds reconnect_backoff_ = std::chrono::milliseconds(100);
+
+    std::deque<IdleConnection> idle_;
+    size_t num_open_ = 0;
+    Stats stats_;
+    mutable std::mutex mutex_;
+    std::condition_variable cv_;
+  };
+};
+
+#endif
@@ -2,61 +2,144 @@
 #define _SQLDB_ODBC_H_
 
 #include "Connection.h"
+#include "SQLStatement.h"
 
-#include <windows.h>
 #include <sql.h>
+#include <sqlext.h>
+
+#include <variant>
 #include <vector>
 
 namespace sqldb {
+  class ODBCStatement;
+
   class ODBC : public Connection {
   public:
-    ODBCInterface(const std::string & _dsn, const std::string & _username, const std::string & _password);
-    ~ODBCInterface();
+    // dsn is either a data source name or a full connection string such as
+    // "Driver=SQLite3;Database=test.db"
+    ODBC(std::string dsn, std::string user_name = "", std::string password = "");
+    ~ODBC();
+
+    void connect();
+    void disconnect();
+
+    std::unique_ptr<SQLStatement> prepare(std::string_view query) override;
+
+    // Returns a statement that buffers the executed rows and sends them
+    // batch_size rows at a time as a parameter array (SQL_ATTR_PARAMSET_SIZE).
+    // flush() sends the remaining rows and must be called to see errors from
+    // the last batch, since the destructor ignores them.
+    std::unique_ptr<ODBCStatement> prepareBatch(std::string_view query, size_t batch_size = 1000);
 
-    bool connect();
-	
-    std::unique_ptr<SQLStatement> prepare(const string & query);
-      
+    void begin() override;
     void commit() override;
     void rollback() override;
+    bool ping() override;
+    bool isConnected() const override { return dbc_ != SQL_NULL_HDBC; }
+
+    // Number of rows fetched per call in result sets (SQL_ATTR_ROW_ARRAY_SIZE).
+    // Takes effect on statements prepared after the call.
+    void setRowArraySize(size_t n) { row_array_size_ = n ? n : 1; }
+    size_t getRowArraySize() const { return row_array_size_; }
 
-    bool disconnect();
-    
   private:
-    struct query_data {
-      SQLINTEGER size;
-      unsigned char * ptr;
-    };
-  
-    string createErrorString(SQLSMALLINT handle_type, SQLHANDLE handle);
-        
-    string dsn, username, password;
-    string error_string;
-    
-    HENV env = 0; // environment handle
-    HDBC dbc = 0; // connection handle
-
-    SQLINTEGER nts;
+    void endTransaction(SQLSMALLINT completion_type);
+
+    std::string dsn_, user_name_, password_;
+    SQLHENV env_ = SQL_NULL_HENV;
+    SQLHDBC dbc_ = SQL_NULL_HDBC;
+    size_t row_array_size_ = 1000;
   };
 
+  // Result sets are fetched into column-wise bound arrays, a block of rows at
+  // a time. Parameters are bound column-wise as well, so that a batch of rows
+  // is executed with a single call.
   class ODBCStatement : public SQLStatement {
   public:
-    ODBCStatement() { }
+    ODBCStatement(SQLHSTMT stmt, std::string query, size_t batch_size, size_t row_array_size);
+    ~ODBCStatement();
+
+    size_t execute() override;
+    void flush();
+    bool next() override;
+    void reset() override;
+
+    void set(int column_idx, std::string_view value, bool is_defined = true) override;
+    void set(int column_idx, int value, bool is_defined = true) override;
+    void set(int column_idx, long long value, bool is_defined = true) override;
+    void set(int column_idx, double value, bool is_defined = true) override;
+    void set(int column_idx, const void * data, size_t len, bool is_defined = true) override;
 
-    bool bind(double value);
-    bool bind(unsigned int value);
-    bool bind(int value);
-    bool bind(time_t value);
-    bool bind(const string & str);
-    bool bind(const char * str);
-    unsigned int getAffectedRows() override;
+    std::vector<uint8_t> getBlob(int column_index) override;
+    std::string_view getText(int column_index) override;
+    bool isNull(int column_index) const override;
+    int getNumFields() const override { return static_cast<int>(columns_.size()); }
+    const std::string & getColumnName(int column_index) override;
+    ColumnType getColumnType(int column_index) const override;
+    double getDouble(int column_index, double default_value = 0.0) override;
+    float getFloat(int column_index, float default_value = 0.0f) override;
+    int getInt(int column_index, int default_value = 0) override;
+    long long getLongLong(int column_index, long long default_value = 0) override;
+    Key getKey(int column_index) override;
+
+    long long getLastInsertId() const override { return 0; }
+    size_t getAffectedRows() const override { return rows_affected_; }
+    size_t getMemoryUsage() const override;
+    size_t getNumPendingRows() const { return num_rows_; }
 
   private:
-    void clearBoundData();
-    query_data & bindData(const void * ptr, size_t size);
-    vector<query_data> bound_data;
+    using Value = std::variant<std::monostate, long long, double, std::string, std::vector<uint8_t>>;
+
+    struct Param {
+      SQLSMALLINT c_type, sql_type;
+      SQLLEN width;
+      std::vector<char> data;
+      std::vector<SQLLEN> indicators;
+    };
+
+    struct Column {
+      std::string name;
+      ColumnType type;
+      SQLSMALLINT c_type;
+      SQLLEN width;
+      std::vector<char> data;
+      std::vector<SQLLEN> indicators;
+      // value that didn't fit the bound buffer, or numeric value as text
+      std::string text;
+      size_t text_row = 0;
+    };
+
+    void setValue(int column_idx, Value value);
+    void bindParams();
+    void bindParamRow(size_t row);
+    void executeOnce();
+    void bindResults(size_t num_columns);
+    bool fetch();
+    void closeCursor();
+    const char * getData(int column_index, size_t & len);
+
+    SQLHSTMT stmt_;
+    std::string query_;
+    size_t batch_size_, row_array_size_;
+
+    size_t num_params_ = 0;
+    std::vector<Value> pending_row_;
+    std::vector<Value> rows_; // buffered rows in row-major order
+    size_t num_rows_ = 0;
+    std::vector<Param> params_;
+    std::vector<SQLUSMALLINT> param_status_;
+    SQLULEN params_processed_ = 0, paramset_size_ = 1;
+    bool has_param_arrays_ = true;
+
+    std::vector<Column> columns_;
+    std::vector<SQLUSMALLINT> row_status_;
+    SQLULEN rows_fetched_ = 0;
+    size_t current_row_ = 0;
+    size_t row_number_ = 0; // running number of the current row
+    bool has_cursor_ = false, is_executed_ = false;
+    size_t rows_affected_ = 0;
 
-    HSTMT stmt = 0; // statement handle
+    static inline std::string empty_string;
   };
 };
 
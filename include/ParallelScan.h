@@ -0,0 +1,60 @@
+#ifndef _SQLDB_PARALLELSCAN_H_
+#define _SQLDB_PARALLELSCAN_H_
+
+#include "Table.h"
+
+#include <atomic>
+#include <exception>
+#include <optional>
+#include <thread>
+#include <vector>
+
+namespace sqldb {
+  // Scans the table in partitions on num_threads threads (hardware
+  // concurrency if zero). scan(Cursor &) is called once for each partition
+  // and returns a partial result, and the partial results are combined with
+  // merge(T &, T &&) in row order, so scan and merge don't need to be
+  // commutative. The first exception thrown by a scan is rethrown.
+  template<typename T, typename Scan, typename Merge>
+  T parallel_scan(Table & table, T init, Scan scan, Merge merge, int num_threads = 0, int sheet = 0) {
+    if (num_threads <= 0) {
+      num_threads = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+    }
+    // use more partitions than threads to even out the load
+    auto partitions = table.seekPartitions(num_threads * 4, sheet);
+    std::vector<std::optional<T>> results(partitions.size());
+    std::vector<std::exception_ptr> errors(partitions.size());
+    std::atomic<size_t> next_partition(0);
+
+    auto worker = [&]() {
+      while ( 1 ) {
+	auto i = next_partition++;
+	if (i >= partitions.size()) break;
+	try {
+	  results[i] = scan(*partitions[i]);
+	} catch (...) {
+	  errors[i] = std::current_exception();
+	}
+	partitions[i].reset();
+      }
+    };
+
+    std::vector<std::thread> threads;
+    auto n = std::min(partitions.size(), static_cast<size_t>(num_threads));
+    for (size_t i = 1; i < n; i++) {
+      threads.emplace_back(worker);
+    }
+    worker();
+    for (auto & t : threads) t.join();
+
+    for (auto & e : errors) {
+      if (e) std::rethrow_exception(e);
+    }
+    for (auto & r : results) {
+      merge(init, std::move(*r));
+    }
+    return init;
+  }
+};
+
+#endif
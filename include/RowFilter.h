@@ -0,0 +1,90 @@
+#ifndef _SQLDB_ROWFILTER_H_
+#define _SQLDB_ROWFILTER_H_
+
+#include "DataStream.h"
+#include "Key.h"
+
+#include <unordered_map>
+#include <utility>
+#include <charconv>
+
+#include "robin_hood.h"
+
+namespace sqldb {
+  // Column filters that scans evaluate before returning a row. A row matches
+  // if the value of each filtered column, as returned by getKey(), is one of
+  // the keys and lies within the range.
+  class RowFilter {
+  public:
+    RowFilter() { }
+
+    bool empty() const { return keys_.empty() && ranges_.empty(); }
+    bool hasColumn(int col) const { return keys_.count(col) || ranges_.count(col); }
+
+    const std::unordered_map<int, robin_hood::unordered_flat_set<Key>> & getKeys() const { return keys_; }
+    const std::unordered_map<int, std::pair<Key, Key>> & getRanges() const { return ranges_; }
+
+    void setKeys(int col, robin_hood::unordered_flat_set<Key> keys) {
+      keys_.emplace(col, std::move(keys));
+    }
+
+    // Bounds are inclusive, and an empty bound is open. Numeric bounds are
+    // compared numerically with text values.
+    void setRange(int col, Key min, Key max) {
+      ranges_[col] = std::pair(std::move(min), std::move(max));
+    }
+
+    void clear(int col) {
+      keys_.erase(col);
+      ranges_.erase(col);
+    }
+
+    std::vector<int> getColumns() const {
+      std::vector<int> r;
+      for (auto & [ col, keys ] : keys_) r.push_back(col);
+      for (auto & [ col, range ] : ranges_) {
+	if (!keys_.count(col)) r.push_back(col);
+      }
+      return r;
+    }
+
+    // get_key(col) returns the value of the column as a Key
+    template<typename GetKey>
+    bool matchesKeys(GetKey get_key) const {
+      for (auto & [ col, keys ] : keys_) {
+	if (!keys.count(get_key(col))) return false;
+      }
+      for (auto & [ col, range ] : ranges_) {
+	if (!isInRange(get_key(col), range.first, range.second)) return false;
+      }
+      return true;
+    }
+
+    bool matches(DataStream & row) const {
+      return matchesKeys([&](int col) { return row.getKey(col); });
+    }
+
+  private:
+    static bool isInRange(const Key & value, const Key & min, const Key & max) {
+      if (value.empty()) return false;
+      if ((!min.empty() && is_numeric(min.getType(0))) || (!max.empty() && is_numeric(max.getType(0)))) {
+	long long v = 0;
+	if (is_numeric(value.getType(0))) {
+	  v = value.getLongLong(0);
+	} else {
+	  auto & s = value.getText(0);
+	  auto [ ptr, ec ] = std::from_chars(s.data(), s.data() + s.size(), v);
+	  if (ec != std::errc() || ptr != s.data() + s.size()) return false;
+	}
+	return (min.empty() || v >= min.getLongLong(0)) && (max.empty() || v <= max.getLongLong(0));
+      } else {
+	return (min.empty() || !(value < min)) && (max.empty() || !(max < value));
+      }
+    }
+
+    std::unordered_map<int, robin_hood::unordered_flat_set<Key>> keys_;
+    std::unordered_map<int, std::pair<Key, Key>> ranges_;
+  };
+};
+
+#endif
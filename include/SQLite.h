@@ -6,6 +6,10 @@
 
 #include <sqlite3.h>
 
+#include <functional>
+#include <vector>
+#include <cstdint>
+
 namespace sqldb {
   class SQLite : public Connection {
   public:
@@ -16,6 +20,22 @@ namespace sqldb {
   
     std::unique_ptr<sqldb::SQLStatement> prepare(std::string_view query) override;
     bool isConnected() const override { return true; }
+
+    // Copies the whole database to or from a file using the online backup API.
+    // The copy is done pages_per_step pages at a time (-1 copies everything in
+    // one step), and the optional progress callback is called after each step
+    // with the number of remaining and total pages. Returning false from the
+    // callback aborts the copy, which then throws like a copy that is
+    // blocked by locks of other connections for too long.
+    void save(const std::string & db_file, int pages_per_step = -1, std::function<bool(int, int)> progress = nullptr);
+    void load(const std::string & db_file, int pages_per_step = -1, std::function<bool(int, int)> progress = nullptr);
+
+    // Serializes the main database into a memory buffer or replaces it with one
+    std::vector<uint8_t> serialize() const;
+    void deserialize(const void * data, size_t len, bool read_only = false);
+    void deserialize(const std::vector<uint8_t> & data, bool read_only = false) {
+      deserialize(data.data(), data.size(), read_only);
+    }
     
   private:
     bool open();
@@ -0,0 +1,72 @@
+#ifndef _SQLDB_SORTEDCURSOR_H_
+#define _SQLDB_SORTEDCURSOR_H_
+
+#include "Table.h"
+#include "Cursor.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace sqldb {
+  // Returns a read-only cursor over the rows of the table in the order set
+  // with setSortCol(), or in row key order if no sort column is set.
+  // Numeric columns are compared as numbers, and other columns by their key,
+  // or by its component sort_subcol if that is non-negative. Nulls come
+  // first in both directions, and rows with equal sort keys keep their scan
+  // order.
+  //
+  // The rows are sorted in memory while they fit in memory_budget bytes.
+  // Larger inputs are written to temporary files in temp_dir (the system
+  // default if empty) as sorted runs, which are merged as the cursor is
+  // read. Returns null if the scan is empty.
+  std::unique_ptr<Cursor> seekSorted(Table & table, size_t memory_budget = 256 * 1024 * 1024, std::string temp_dir = "", int sheet = 0);
+
+  // Pages of a table in the same order as seekSorted(), except that rows
+  // with equal sort keys are ordered by row key, so that the pages stay
+  // consistent as rows change. This is for reading the first rows without
+  // sorting the whole table. The first page is selected
+  // with a bounded heap during a scan. Later pages use a permutation of the
+  // row keys that is sorted only as far as needed and cached. The rows
+  // that the table reports as changed (see Table::getChangedRows()) and the
+  // rows added or removed in the table Log are updated in the permutation.
+  // It's rebuilt if the sorting or the filters change, if there are too
+  // many changes, or if the table has a version but can't report the
+  // changes since the last update. Tables without a version don't report
+  // their changes, so the caller must add the changed rows to the Log.
+  class SortedView {
+  public:
+    SortedView(Table & table, int sheet = 0) : table_(table), sheet_(sheet) { }
+
+    // Returns a cursor over the rows [offset, offset + limit) in sorted
+    // order, or null if the range is empty
+    std::unique_ptr<Cursor> seek(size_t offset, size_t limit);
+
+    // Drops the cached permutation
+    void clear();
+
+  private:
+    struct Entry {
+      Key sort_key, row_key;
+    };
+
+    bool isValid() const;
+    bool isBefore(const Entry & a, const Entry & b) const;
+    void build();
+    void update();
+    void sortUntil(size_t end);
+    std::unique_ptr<Cursor> seekTop(size_t limit);
+
+    Table & table_;
+    int sheet_;
+    std::vector<Entry> entries_;
+    size_t sorted_count_ = 0, log_position_ = 0;
+    uint64_t version_ = 0;
+    bool has_entries_ = false;
+    int sort_col_ = -1, sort_subcol_ = -1;
+    bool desc_ = false;
+    std::shared_ptr<const RowFilter> filter_;
+  };
+};
+
+#endif
@@ -4,6 +4,7 @@
 #include "ColumnType.h"
 #include "Cursor.h"
 #include "Log.h"
+#include "RowFilter.h"
 
 #include <unordered_map>
 #include <unordered_set>
@@ -12,6 +13,7 @@
 #include <string_view>
 #include <string>
 #include <numeric>
+#include <cstdint>
 
 #include "robin_hood.h"
 
@@ -28,6 +30,30 @@ namespace sqldb {
     virtual std::unique_ptr<Cursor> seek(const Key & key) = 0;
     virtual std::unique_ptr<Cursor> seek(int row, int sheet = 0) { return std::unique_ptr<Cursor>(nullptr); }
 
+    // Scans the rows with keys in [lo, hi), where an empty hi is open. The
+    // default implementation skips the other rows of a full scan, so the
+    // rows are in key order only if the backend scans in key order.
+    virtual std::unique_ptr<Cursor> seekRange(const Key & lo, const Key & hi, int sheet = 0);
+    std::unique_ptr<Cursor> seekLowerBound(const Key & key, int sheet = 0) { return seekRange(key, Key(), sheet); }
+    // Scans the rows whose keys start with the prefix, e.g. the children of
+    // a parent key
+    std::unique_ptr<Cursor> seekPrefix(const Key & prefix, int sheet = 0) { return seekRange(prefix, prefix.getPrefixEnd(), sheet); }
+
+    // Variants for reading only the given columns (all columns if empty).
+    // Backends may skip parsing the other columns, which then read as null.
+    virtual std::unique_ptr<Cursor> seekBegin(int sheet, const std::vector<int> & columns) { return seekBegin(sheet); }
+    virtual std::unique_ptr<Cursor> seek(int row, int sheet, const std::vector<int> & columns) { return seek(row, sheet); }
+
+    // Splits the rows into at most num_partitions disjoint ranges that can
+    // be scanned from separate threads. Each cursor is positioned on the
+    // first row of its range, and next() returns false at the end of the
+    // range. Backends that can't be split return a single cursor.
+    virtual std::vector<std::unique_ptr<Cursor>> seekPartitions(int num_partitions, int sheet = 0) {
+      std::vector<std::unique_ptr<Cursor>> r;
+      if (auto cursor = seekBegin(sheet)) r.push_back(std::move(cursor));
+      return r;
+    }
+
     virtual std::unique_ptr<Cursor> insert(const Key & key) = 0;
     virtual std::unique_ptr<Cursor> insert(int sheet = 0) = 0;
     virtual std::unique_ptr<Cursor> increment(const Key & key) = 0;
@@ -56,6 +82,16 @@ namespace sqldb {
     virtual void commit() { }
     virtual void rollback() { }
 
+    // Returns a number that changes whenever the rows change, for caches of
+    // the rows, or 0 if the backend doesn't track changes. The changes of
+    // such backends must be added to the Log by the caller.
+    virtual uint64_t getVersion() const { return 0; }
+
+    // Adds the keys of the rows that have changed since the version to keys,
+    // or returns false if they are not known, e.g. if the version is too
+    // old. A key may be added more than once.
+    virtual bool getChangedRows(uint64_t version, std::vector<Key> & keys) const { return false; }
+
     void append(Table & other) {
       if (!getNumFields()) { // FIXME 
 	setKeyType(other.getKeyType());
@@ -204,30 +240,50 @@ namespace sqldb {
     bool isDescSort() const { return desc_sort_; }
 
     bool hasFilter(int col) const {
-      return filter_.count(col) != 0;
+      return filter_ && filter_->hasColumn(col);
     }
 
     void clearFilter(int col) {
-      filter_.erase(col);
+      if (filter_) getMutableFilter().clear(col);
     }
     void setFilter(int col, robin_hood::unordered_flat_set<sqldb::Key> keys) {
-      filter_.emplace(col, std::move(keys));
+      getMutableFilter().setKeys(col, std::move(keys));
+    }
+    void setRangeFilter(int col, sqldb::Key min, sqldb::Key max) {
+      getMutableFilter().setRange(col, std::move(min), std::move(max));
     }
     
-    const std::unordered_map<int, robin_hood::unordered_flat_set<sqldb::Key>> & getFilter() const { return filter_; }
+    const std::unordered_map<int, robin_hood::unordered_flat_set<sqldb::Key>> & getFilter() const {
+      return filter_ ? filter_->getKeys() : empty_filter;
+    }
+
+    // Returns the filters for the cursors of a scan, or null if there are
+    // none. Rows that don't match are skipped by seekBegin() and next(), but
+    // seek(Key) finds any row.
+    std::shared_ptr<const RowFilter> getRowFilter() const {
+      return filter_ && !filter_->empty() ? filter_ : nullptr;
+    }
     
     const Log & getLog() const { return *log_; }
     Log & getLog() { return *log_; }
 
     static inline std::string empty_string;
+    static inline std::unordered_map<int, robin_hood::unordered_flat_set<sqldb::Key>> empty_filter;
     
   private:
+    RowFilter & getMutableFilter() {
+      // cursors may hold the current filters, so they are copied on write
+      if (!filter_) filter_ = std::make_shared<RowFilter>();
+      else if (filter_.use_count() > 1) filter_ = std::make_shared<RowFilter>(*filter_);
+      return *filter_;
+    }
+    
     std::vector<ColumnType> key_type_;
     bool has_human_readable_key_ = false;
     int sort_col_ = -1, sort_subcol_ = -1;
     bool desc_sort_ = false;
 
-    std::unordered_map<int, robin_hood::unordered_flat_set<sqldb::Key> > filter_;
+    std::shared_ptr<RowFilter> filter_;
     
     std::shared_ptr<Log> log_;
   };
@@ -0,0 +1,189 @@
+#include "Aggregation.h"
+
+#include "ParallelScan.h"
+
+#include <utility>
+
+using namespace std;
+using namespace sqldb;
+
+static inline bool is_integer(ColumnType type) {
+  return is_numeric(type) && type != ColumnType::FLOAT && type != ColumnType::DOUBLE;
+}
+
+void
+Aggregation::addAggregate(Function function, int column, std::string name) {
+  aggregates_.push_back(Aggregate{ function, column, std::move(name), function == Function::COUNT });
+}
+
+template<typename GetColumn>
+void
+Aggregation::describe(GetColumn get_column) {
+  if (is_described_) return;
+  for (auto col : group_columns_) {
+    auto [ name, type ] = get_column(col);
+    group_names_.push_back(std::move(name));
+    group_types_.push_back(type);
+  }
+  for (auto & a : aggregates_) {
+    if (a.function != Function::COUNT) a.is_integer = is_integer(get_column(a.column).second);
+  }
+  is_described_ = true;
+}
+
+Aggregation
+Aggregation::createPartial() const {
+  Aggregation r(group_columns_);
+  r.group_names_ = group_names_;
+  r.group_types_ = group_types_;
+  r.aggregates_ = aggregates_;
+  r.is_described_ = is_described_;
+  return r;
+}
+
+size_t
+Aggregation::findGroup(const Key & key) {
+  auto [ it, is_new ] = groups_.try_emplace(key, groups_.size());
+  if (is_new) {
+    accumulators_.resize(accumulators_.size() + aggregates_.size(), Accumulator{ 0, { 0 } });
+  }
+  return it->second;
+}
+
+void
+Aggregation::consume(Cursor & cursor) {
+  describe([&](int col) { return std::pair(std::string(cursor.getColumnName(col)), cursor.getColumnType(col)); });
+
+  size_t n = aggregates_.size();
+  Key key;
+  do {
+    key.clear();
+    for (auto col : group_columns_) key.addComponent(cursor.getKey(col));
+    auto group = findGroup(key); // may reallocate the accumulators
+    auto acc = accumulators_.data() + group * n;
+
+    for (size_t i = 0; i < n; i++, acc++) {
+      auto & a = aggregates_[i];
+      if (a.column < 0) {
+	acc->count++;
+	continue;
+      }
+      if (cursor.isNull(a.column)) continue;
+      if (a.is_integer) {
+	auto v = cursor.getLongLong(a.column);
+	switch (a.function) {
+	case Function::COUNT: break;
+	case Function::SUM:
+	case Function::AVG: acc->value.i += v; break;
+	case Function::MIN: if (!acc->count || v < acc->value.i) acc->value.i = v; break;
+	case Function::MAX: if (!acc->count || v > acc->value.i) acc->value.i = v; break;
+	}
+      } else {
+	auto v = cursor.getDouble(a.column);
+	switch (a.function) {
+	case Function::COUNT: break;
+	case Function::SUM:
+	case Function::AVG: acc->value.d += v; break;
+	case Function::MIN: if (!acc->count || v < acc->value.d) acc->value.d = v; break;
+	case Function::MAX: if (!acc->count || v > acc->value.d) acc->value.d = v; break;
+	}
+      }
+      acc->count++;
+    }
+  } while (cursor.next());
+}
+
+void
+Aggregation::merge(const Aggregation & other) {
+  if (!is_described_ && other.is_described_) {
+    group_names_ = other.group_names_;
+    group_types_ = other.group_types_;
+    aggregates_ = other.aggregates_;
+    is_described_ = true;
+  }
+
+  size_t n = aggregates_.size();
+  for (auto & [ key, other_group ] : other.groups_) {
+    auto group = findGroup(key);
+    auto acc = accumulators_.data() + group * n;
+    auto other_acc = other.accumulators_.data() + other_group * n;
+
+    for (size_t i = 0; i < n; i++, acc++, other_acc++) {
+      if (!other_acc->count) continue;
+      auto & a = aggregates_[i];
+      auto & v = other_acc->value;
+      switch (a.function) {
+      case Function::COUNT:
+	break;
+      case Function::SUM:
+      case Function::AVG:
+	if (a.is_integer) acc->value.i += v.i;
+	else acc->value.d += v.d;
+	break;
+      case Function::MIN:
+	if (!acc->count || (a.is_integer ? v.i < acc->value.i : v.d < acc->value.d)) acc->value = v;
+	break;
+      case Function::MAX:
+	if (!acc->count || (a.is_integer ? v.i > acc->value.i : v.d > acc->value.d)) acc->value = v;
+	break;
+      }
+      acc->count += other_acc->count;
+    }
+  }
+}
+
+void
+Aggregation::consume(Table & table, int num_threads, int sheet) {
+  describe([&](int col) { return std::pair(std::string(table.getColumnName(col, sheet)), table.getColumnType(col, sheet)); });
+
+  // each partition is aggregated separately and the partial results are merged
+  auto r = parallel_scan(table, createPartial(), [this](Cursor & cursor) {
+    auto partial = createPartial();
+    partial.consume(cursor);
+    return partial;
+  }, [](Aggregation & a, Aggregation && b) {
+    a.merge(b);
+  }, num_threads, sheet);
+  merge(r);
+}
+
+std::unique_ptr<MemoryTable>
+Aggregation::getResult() const {
+  auto r = std::make_unique<MemoryTable>(group_types_);
+  for (size_t i = 0; i < group_columns_.size(); i++) {
+    if (i < group_names_.size()) r->addColumn(group_names_[i], group_types_[i], false, -1);
+    else r->addColumn("", ColumnType::ANY, false, -1);
+  }
+  for (auto & a : aggregates_) {
+    bool is_integer = a.function == Function::COUNT || (a.is_integer && a.function != Function::AVG);
+    r->addColumn(a.name, is_integer ? ColumnType::INT64 : ColumnType::DOUBLE, false, -1);
+  }
+
+  size_t n = aggregates_.size();
+  int first_aggregate = static_cast<int>(group_columns_.size());
+  for (auto & [ key, group ] : groups_) {
+    auto cursor = r->insert(key);
+    for (int i = 0; i < first_aggregate; i++) {
+      cursor->set(i, key.getSubKey(i, 1));
+    }
+    auto acc = accumulators_.data() + group * n;
+    for (size_t i = 0; i < n; i++, acc++) {
+      auto & a = aggregates_[i];
+      int col = first_aggregate + static_cast<int>(i);
+      if (a.function == Function::COUNT) {
+	cursor->set(col, acc->count);
+      } else if (!acc->count) {
+	cursor->set(col, 0, false);
+      } else if (a.function == Function::AVG) {
+	auto sum = a.is_integer ? static_cast<double>(acc->value.i) : acc->value.d;
+	cursor->set(col, sum / static_cast<double>(acc->count));
+      } else if (a.is_integer) {
+	cursor->set(col, acc->value.i);
+      } else {
+	cursor->set(col, acc->value.d);
+      }
+    }
+    cursor->execute();
+  }
+  return r;
+}
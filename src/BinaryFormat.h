@@ -0,0 +1,96 @@
+#ifndef _BINARYFORMAT_H_
+#define _BINARYFORMAT_H_
+
+#include "Key.h"
+
+#include <string>
+#include <string_view>
+#include <stdexcept>
+#include <cstring>
+#include <cstdint>
+
+// Encoding of keys and values in snapshot files, log records and spill
+// files, in native byte order. Strings are prefixed by their length, and key components by
+// 'i' for integers and 's' for strings.
+namespace sqldb {
+  static inline void append_bytes(std::string & s, const void * data, size_t len) {
+    s.append(reinterpret_cast<const char *>(data), len);
+  }
+
+  static inline void append_u32(std::string & s, uint32_t v) {
+    append_bytes(s, &v, sizeof(v));
+  }
+
+  static inline void append_u64(std::string & s, uint64_t v) {
+    append_bytes(s, &v, sizeof(v));
+  }
+
+  static inline void append_string(std::string & s, std::string_view v) {
+    append_u32(s, static_cast<uint32_t>(v.size()));
+    s += v;
+  }
+
+  static inline void append_key(std::string & s, const Key & key) {
+    append_u32(s, static_cast<uint32_t>(key.size()));
+    for (size_t i = 0; i < key.size(); i++) {
+      if (is_numeric(key.getType(i))) {
+	int64_t v = key.getLongLong(i);
+	s += 'i';
+	append_bytes(s, &v, sizeof(v));
+      } else {
+	s += 's';
+	append_string(s, key.getText(i));
+      }
+    }
+  }
+
+  // Bounds checked reader, which throws std::runtime_error with the message
+  // if the data ends early
+  class BinaryReader {
+  public:
+    BinaryReader(const char * ptr, const char * end, const char * error) : ptr_(ptr), end_(end), error_(error) { }
+
+    void read(void * data, size_t len) {
+      if (static_cast<size_t>(end_ - ptr_) < len) {
+	throw std::runtime_error(error_);
+      }
+      memcpy(data, ptr_, len);
+      ptr_ += len;
+    }
+
+    uint8_t readU8() { uint8_t v; read(&v, sizeof(v)); return v; }
+    uint32_t readU32() { uint32_t v; read(&v, sizeof(v)); return v; }
+    uint64_t readU64() { uint64_t v; read(&v, sizeof(v)); return v; }
+
+    std::string_view readString() {
+      size_t len = readU32();
+      if (static_cast<size_t>(end_ - ptr_) < len) {
+	throw std::runtime_error(error_);
+      }
+      std::string_view s(ptr_, len);
+      ptr_ += len;
+      return s;
+    }
+
+    Key readKey() {
+      Key key;
+      for (uint32_t i = 0, n = readU32(); i < n; i++) {
+	if (readU8() == 'i') {
+	  int64_t v;
+	  read(&v, sizeof(v));
+	  key.addComponent(static_cast<long long>(v));
+	} else {
+	  key.addComponent(readString());
+	}
+      }
+      return key;
+    }
+
+  private:
+    const char * ptr_;
+    const char * end_;
+    const char * error_;
+  };
+};
+
+#endif
@@ -12,12 +12,15 @@
 using namespace sqldb;
 using namespace std;
 
-static inline vector<string> split(string_view line, char delimiter) {
+// Splits the record into fields. If selected is not empty, only the fields
+// that are selected are copied, and the others are left empty.
+static inline vector<string> split(string_view line, char delimiter, const vector<bool> & selected = vector<bool>()) {
   vector<string> r;
   
   if (!line.empty()) {
     size_t i = 0;
     bool in_quote = false;
+    bool is_selected = selected.empty() || selected[0];
     string current;
     size_t n = line.size();
     for ( ; i < n; i++) {
@@ -27,13 +30,23 @@ static inline vector<string> split(string_view line, char delimiter) {
       } else if (!in_quote && c == '"') {
 	in_quote = true;
       } else if (in_quote) {
-	if (c == '\\') current += line[++i];
-	else if (c == '"') in_quote = false;
-	else current += c;
+	if (c == '\\') {
+	  i++;
+	  if (is_selected && i < n) current += line[i];
+	} else if (c == '"') {
+	  in_quote = false;
+	} else if (is_selected) {
+	  current += c;
+	}
       } else if (c == delimiter) {
 	r.push_back(std::move(current));
 	current.clear();
-      } else {
+	if (!selected.empty()) {
+	  // the rest of the fields are not needed
+	  if (r.size() >= selected.size()) return r;
+	  is_selected = selected[r.size()];
+	}
+      } else if (is_selected) {
 	current += c;
       }     
     }
@@ -42,6 +55,19 @@ static inline vector<string> split(string_view line, char delimiter) {
   return r;
 }
 
+// Normalizes the field in place. ASCII is already normalized, since the
+// carriage returns have been removed by split().
+static inline void normalize_field(string & s) {
+  for (auto c : s) {
+    if (static_cast<unsigned char>(c) >= 0x80) {
+      auto [ r, ec ] = normalize_nfc(s);
+      if (ec) throw std::runtime_error("Invalid UTF8 in CSV");
+      s = std::move(r);
+      return;
+    }
+  }
+}
+
 class sqldb::CSVFile : public sqldb::TextFile {
 public:
   CSVFile(std::string filename, bool has_records) : TextFile(move(filename)) {
@@ -77,6 +103,8 @@ public:
 	  }	
 	}
 	header_row_ = split(s, delimiter_);
+	for (auto & name : header_row_) normalize_field(name);
+	data_offset_ = ftell(in_) - input_buffer_.size();
       } else {
 	header_row_.push_back("Content");
       }
@@ -92,11 +120,47 @@ public:
     header_row_(other.header_row_),
     current_row_(other.current_row_),
     // input_buffer_(other.input_buffer_),
-    row_offsets_(other.row_offsets_)
+    row_offsets_(other.row_offsets_),
+    data_offset_(other.data_offset_),
+    selected_columns_(other.selected_columns_),
+    filter_(other.filter_),
+    filter_columns_(other.filter_columns_),
+    end_row_(other.end_row_)
   {
     in_ = fopen(filename_.c_str(), "rb");
-    if (in_) fseek(in_, ftell(other.in_), SEEK_SET);
+    // continue from the first byte that other hasn't consumed from its buffer
+    if (in_ && other.in_) fseek(in_, ftell(other.in_) - other.input_buffer_.size(), SEEK_SET);
+  }
+
+  // Only the selected columns are parsed and normalized, and the others are
+  // read as null. All columns are parsed if columns is empty.
+  void selectColumns(const std::vector<int> & columns) {
+    selected_columns_.clear();
+    for (auto col : columns) {
+      if (col < 0) continue;
+      auto idx = static_cast<size_t>(col);
+      if (idx >= selected_columns_.size()) selected_columns_.resize(idx + 1);
+      selected_columns_[idx] = true;
+    }
   }
+
+  // Records that don't match the filter are skipped by next(). Only the
+  // filtered columns are parsed to test a record.
+  void setFilter(std::shared_ptr<const RowFilter> filter) {
+    filter_ = std::move(filter);
+    filter_columns_.clear();
+    if (filter_) {
+      for (auto col : filter_->getColumns()) {
+	if (col < 0) continue;
+	auto idx = static_cast<size_t>(col);
+	if (idx >= filter_columns_.size()) filter_columns_.resize(idx + 1);
+	filter_columns_[idx] = true;
+      }
+    }
+  }
+
+  // next() stops before end_row, or at the end of file if end_row is negative
+  void setEndRow(int end_row) { end_row_ = end_row; }
   
   std::string_view getText(int column_index) const {
     auto idx = static_cast<size_t>(column_index);
@@ -121,7 +185,7 @@ public:
     if (!in_) {
       return false;
     }
-    if (row + 1 == next_row_idx_) {
+    if (row + 1 == next_row_idx_ && !filter_) {
       return true;
     }
     if (row < static_cast<int>(row_offsets_.size())) {
@@ -137,16 +201,99 @@ public:
       row -= static_cast<int>(row_offsets_.size()) - 1;
     }
     while (row > 0) {
-      auto r = next();
+      auto r = skip();
       if (!r) return false;
       row--;
     }
     return next();
   }
 
+  // Positions the file on a record whose offset is already known
+  bool seek(int row, size_t offset) {
+    if (!in_) {
+      return false;
+    }
+    input_buffer_.clear();
+    next_row_idx_ = row;
+    fseek(in_, offset, SEEK_SET);
+    return next();
+  }
+
+  // Splits the records into num_partitions byte ranges of roughly equal
+  // size, and returns the offset and the row number of the first record of
+  // each range. The scan follows the quoting rules of get_record() so that
+  // the ranges start at record boundaries.
+  std::vector<std::pair<size_t, int>> findPartitions(int num_partitions) const {
+    std::vector<std::pair<size_t, int>> r;
+    auto in = fopen(filename_.c_str(), "rb");
+    if (!in) {
+      throw std::runtime_error("Failed to open CSV");
+    }
+    fseek(in, 0, SEEK_END);
+    size_t file_size = ftell(in);
+    if (file_size > data_offset_) {
+      size_t n = static_cast<size_t>(std::max(num_partitions, 1));
+      size_t data_size = file_size - data_offset_;
+      size_t target = data_offset_ + data_size / n;
+      r.emplace_back(data_offset_, 0);
+      
+      fseek(in, data_offset_, SEEK_SET);
+      bool quoted = false, escaped = false;
+      int row = 0;
+      size_t offset = data_offset_;
+      char buffer[65536];
+      while (r.size() < n) {
+	auto len = fread(buffer, 1, sizeof(buffer), in);
+	if (!len) break;
+	for (size_t i = 0; i < len && r.size() < n; i++) {
+	  auto c = buffer[i];
+	  if (escaped) {
+	    escaped = false;
+	  } else if (!quoted && c == '"') {
+	    quoted = true;
+	  } else if (c == '\\') {
+	    escaped = true;
+	  } else if (quoted && c == '"') {
+	    quoted = false;
+	  } else if (!quoted && c == '\n') {
+	    row++;
+	    size_t record_offset = offset + i + 1;
+	    if (record_offset >= target && record_offset < file_size) {
+	      r.emplace_back(record_offset, row);
+	      target = data_offset_ + data_size * r.size() / n;
+	    }
+	  }
+	}
+	offset += len;
+      }
+    }
+    fclose(in);
+    return r;
+  }
+
   bool next() {
+    std::string s;
+    while (read(s)) {
+      if (filter_) {
+	current_row_ = split(s, delimiter_, filter_columns_);
+	for (auto & field : current_row_) normalize_field(field);
+	if (!filter_->matchesKeys([&](int col) { return Key(getText(col)); })) continue;
+      }
+      current_row_ = split(s, delimiter_, selected_columns_);
+      for (auto & field : current_row_) normalize_field(field);
+      return true;
+    }
+    return false;
+  }
+  
+private:
+  // Reads the next record without parsing it
+  bool read(std::string & s) {
+    if (end_row_ >= 0 && next_row_idx_ >= end_row_) {
+      return false;
+    }
     size_t row_offset = ftell(in_) - input_buffer_.size();
-    auto [ s, ec ] = get_record();
+    auto [ r, ec ] = get_record();
 
     switch (ec) {
     case Error::OK:
@@ -159,16 +306,20 @@ public:
       throw std::runtime_error("Invalid UTF8 in CSV");
     }
     
-    current_row_ = split(s, delimiter_);
     if (next_row_idx_ == static_cast<int>(row_offsets_.size())) {
       row_offsets_.push_back(row_offset);
     }
     next_row_idx_++;
+    s = std::move(r);
     
     return true;
   }
-  
-private:
+
+  bool skip() {
+    std::string s;
+    return read(s);
+  }
+
   std::pair<std::string, Error> get_record() {
     while ( 1 ) {
       bool quoted = false;
@@ -180,14 +331,10 @@ private:
 	} else if (quoted && input_buffer_[i] == '"') {
 	  quoted = false;
 	} else if (!quoted && input_buffer_[i] == '\n') {
-	  auto record0 = string_view(input_buffer_).substr(0, i);
-	  if (record0.back() == '\r') record0.remove_suffix(1);
-	  auto [ r, ec ] = normalize_nfc(record0);
-
+	  auto r = input_buffer_.substr(0, i);
+	  if (!r.empty() && r.back() == '\r') r.pop_back();
 	  input_buffer_ = input_buffer_.substr(i + 1);
-	  
-	  if (ec) return std::pair(std::move(r), Error::InvalidUtf8);
-	  else return std::pair(std::move(r), Error::OK);
+	  return std::pair(std::move(r), Error::OK);
 	}
       }
             
@@ -202,10 +349,9 @@ private:
 
       // If the last row is not \n terminated, return it anyway
       if (!input_buffer_.empty()) {
-	auto [ r, ec ] = normalize_nfc(input_buffer_);
+	auto r = std::move(input_buffer_);
 	input_buffer_.clear();
-	if (ec) return std::pair(r, Error::InvalidUtf8);
-	else return std::pair(r, Error::OK);
+	return std::pair(std::move(r), Error::OK);
       } else {
 	return std::pair(std::string(), Error::Eof);
       }
@@ -217,6 +363,11 @@ private:
   std::vector<std::string> header_row_;
   std::vector<std::string> current_row_;
   std::vector<size_t> row_offsets_;
+  size_t data_offset_ = 0; // offset of the first record after the header
+  std::vector<bool> selected_columns_;
+  std::shared_ptr<const RowFilter> filter_;
+  std::vector<bool> filter_columns_;
+  int end_row_ = -1;
   
   static inline std::string null_string;
 };
@@ -224,9 +375,17 @@ private:
 class CSVCursor : public Cursor {
 public:
   CSVCursor(const std::shared_ptr<sqldb::CSVFile> & csv, int row, int sheet) : csv_(csv), sheet_(sheet) {
-    csv_->seek(row);
+    is_valid_ = csv_->seek(row);
+    updateRowKey();
+  }
+  // Cursor that starts from a record at a known offset
+  CSVCursor(const std::shared_ptr<sqldb::CSVFile> & csv, int row, size_t offset, int sheet) : csv_(csv), sheet_(sheet) {
+    is_valid_ = csv_->seek(row, offset);
     updateRowKey();
   }
+
+  // false if there was no row to position on
+  bool isValid() const { return is_valid_; }
   
   bool next() override {
     if (csv_->next()) {
@@ -337,6 +496,7 @@ protected:
 private:
   std::shared_ptr<CSVFile> csv_;
   int sheet_;
+  bool is_valid_;
 };
 
 CSV::CSV(std::string csv_file, bool has_records) {
@@ -383,3 +543,42 @@ unique_ptr<Cursor>
 CSV::seek(int row, int sheet) {
   return make_unique<CSVCursor>(csv_[sheet], row, sheet);
 }
+
+unique_ptr<Cursor>
+CSV::seekBegin(int sheet) {
+  // filtered scans need a file of their own
+  if (getRowFilter()) return seek(0, sheet, std::vector<int>());
+  else return seek(0, sheet);
+}
+
+unique_ptr<Cursor>
+CSV::seek(int row, int sheet, const std::vector<int> & columns) {
+  // the selection and the filter are properties of the file, so the cursor
+  // gets its own copy
+  auto csv = make_shared<CSVFile>(*csv_[sheet]);
+  auto filter = getRowFilter();
+  bool has_filter = filter != nullptr;
+  csv->selectColumns(columns);
+  csv->setFilter(std::move(filter));
+  auto cursor = make_unique<CSVCursor>(csv, row, sheet);
+  if (has_filter && !cursor->isValid()) return unique_ptr<Cursor>(nullptr);
+  return cursor;
+}
+
+std::vector<std::unique_ptr<Cursor>>
+CSV::seekPartitions(int num_partitions, int sheet) {
+  std::vector<std::unique_ptr<Cursor>> r;
+  if (sheet < 0 || sheet >= static_cast<int>(csv_.size())) return r;
+
+  auto starts = csv_[sheet]->findPartitions(num_partitions);
+  for (size_t i = 0; i < starts.size(); i++) {
+    // each partition reads the file through its own handle
+    auto csv = make_shared<CSVFile>(*csv_[sheet]);
+    auto [ offset, row ] = starts[i];
+    csv->setEndRow(i + 1 < starts.size() ? starts[i + 1].second : -1);
+    csv->setFilter(getRowFilter());
+    auto cursor = make_unique<CSVCursor>(csv, row, offset, sheet);
+    if (cursor->isValid()) r.push_back(std::move(cursor));
+  }
+  return r;
+}
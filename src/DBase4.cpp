@@ -4,157 +4,343 @@
 
 #include <vector>
 #include <cassert>
-#include <shapefil.h>
+#include <charconv>
+#include <cstring>
+#include <cstdio>
+#include <thread>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "utils.h"
 
 using namespace std;
 using namespace sqldb;
 
+// Reads the records directly from a memory mapped DBF file. The header and
+// the field layout are decoded once, and the fields are parsed in place.
 class sqldb::DBase4File {
 public:
   DBase4File(std::string fn, int primary_key) : fn_(std::move(fn)), primary_key_(primary_key) {
-    h_ = DBFOpen(fn_.c_str(), "rb");
-    if (h_) {
-      initialize();
-    } else {
-      throw std::runtime_error("failed to open DBase4 file");
-    }
+    open();
   }
 
   DBase4File(const DBase4File & other) : fn_(other.fn_), primary_key_(other.primary_key_) {
-    h_ = DBFOpen(fn_.c_str(), "rb");
-    if (h_) {
-      initialize();
-    } else {
-      throw std::runtime_error("failed to open DBase4 file");
-    }
+    open();
   }
 
   ~DBase4File() {
-    if (h_) {
-      DBFClose(h_);
+    if (data_) {
+      munmap(const_cast<char *>(data_), size_);
     }
   }
 
-  std::string getText(int row_index, int column_index) const {
-    if (!isNull(row_index, column_index)) {
-      auto r0 = DBFReadStringAttribute(h_, row_index, column_index);
-      if (r0) {
-	auto [ r, ec ] = normalize_nfc(r0);
-	if (ec) throw std::runtime_error("Invalid UTF8 in DBase4");
-	return r;
+  // Returns the text, which points either to the mapped file or to buffer
+  std::string_view getText(int row_index, int column_index, std::string & buffer) const {
+    std::string_view v;
+    if (!getValue(row_index, column_index, v)) return std::string_view();
+
+    // ASCII without carriage returns is already normalized
+    bool is_normalized = true;
+    for (auto c : v) {
+      if (static_cast<unsigned char>(c) >= 0x80 || c == '\r') {
+	is_normalized = false;
+	break;
       }
     }
-    return "";
+    if (is_normalized) return v;
+
+    auto [ r, ec ] = normalize_nfc(v);
+    if (ec) throw std::runtime_error("Invalid UTF8 in DBase4");
+    buffer = std::move(r);
+    return buffer;
   }
 
   bool getBool(int row_index, int column_index, bool default_value) const {
-    if (!isNull(row_index, column_index)) {
-      return DBFReadLogicalAttribute(h_, row_index, column_index);
+    std::string_view v;
+    if (getValue(row_index, column_index, v)) {
+      return v[0] == 'T' || v[0] == 't' || v[0] == 'Y' || v[0] == 'y';
     } else {
       return default_value;
     }
   }
-  
-  int getInt(int row_index, int column_index, int default_value) const {
-    if (!isNull(row_index, column_index)) {
-      return DBFReadIntegerAttribute(h_, row_index, column_index);
+
+  long long getLongLong(int row_index, int column_index, long long default_value) const {
+    std::string_view v;
+    if (getValue(row_index, column_index, v)) {
+      return parseLongLong(v);
     } else {
       return default_value;
     }
   }
-  
+
   double getDouble(int row_index, int column_index, double default_value) const {
-    if (!isNull(row_index, column_index)) {
-      return DBFReadDoubleAttribute(h_, row_index, column_index);
+    std::string_view v;
+    if (getValue(row_index, column_index, v)) {
+      return parseDouble(v);
     } else {
       return default_value;
     }
   }
-  
+
   bool isNull(int row_index, int column_index) const {
-    return row_index < 0 || row_index >= record_count_ || DBFIsAttributeNULL(h_, row_index, column_index);
+    std::string_view v;
+    return !getValue(row_index, column_index, v);
   }
 
   int getRecordCount() { return record_count_; }
-  int getNumFields() const { return static_cast<int>(column_types_.size()); }
+  int getNumFields() const { return static_cast<int>(fields_.size()); }
   
   const std::string & getColumnName(int column_index) const {
     auto idx = static_cast<size_t>(column_index);
-    return idx < column_names_.size() ? column_names_[idx] : null_string;
+    return idx < fields_.size() ? fields_[idx].name : null_string;
   }
 
   ColumnType getColumnType(int column_index) const {
     auto idx = static_cast<size_t>(column_index);
-    return idx < column_types_.size() ? column_types_[idx] : ColumnType::ANY;
+    return idx < fields_.size() ? fields_[idx].type : ColumnType::ANY;
   }
 
   int getPrimaryKey() const { return primary_key_; }
+  size_t getFileSize() const { return size_; }
+  const struct timespec & getModificationTime() const { return mtime_; }
+
+  // Maps the primary key of each record in [begin, end) to the record number.
+  // The first record wins if the key is duplicated. Numeric keys are
+  // indexed by their integer value like getKey() returns it, so that e.g.
+  // "00012" and "12.00" are both found as 12. Records whose numeric key
+  // is null or not a number are not indexed.
+  void indexRecords(int begin, int end, DBase4::PrimaryKeyIndex & index) const {
+    std::string buffer;
+    bool is_numeric_key = hasNumericPrimaryKey();
+    for (int row = begin; row < end; row++) {
+      std::string_view v;
+      long long n;
+      if (!is_numeric_key) {
+	index.emplace(std::string(getText(row, primary_key_, buffer)), row);
+      } else if (getValue(row, primary_key_, v) && parseKey(v, n)) {
+	index.emplace(std::to_string(n), row);
+      }
+    }
+  }
+
+  // Returns the key of the index for a primary key value, or false if the
+  // value can't be in the index
+  bool getIndexKey(const Key & key, std::string & r) const {
+    if (is_numeric(key.getType(0))) {
+      r = std::to_string(key.getLongLong(0));
+      return true;
+    }
+    auto & v = key.getText(0);
+    if (!hasNumericPrimaryKey()) {
+      r = v;
+      return true;
+    }
+    long long n;
+    if (!parseKey(v, n)) return false;
+    r = std::to_string(n);
+    return true;
+  }
 
 private:
+  struct Field {
+    std::string name;
+    char dbf_type;
+    ColumnType type;
+    size_t offset, width;
+  };
+
+  // Fetches the field with surrounding spaces removed, and returns false if
+  // the value is null
+  bool getValue(int row_index, int column_index, std::string_view & v) const {
+    if (row_index < 0 || row_index >= record_count_) return false;
+    auto idx = static_cast<size_t>(column_index);
+    if (idx >= fields_.size()) return false;
+    auto & field = fields_[idx];
+    
+    auto ptr = data_ + header_length_ + static_cast<size_t>(row_index) * record_length_ + field.offset;
+    size_t begin = 0, end = field.width;
+    if (auto nul = reinterpret_cast<const char *>(memchr(ptr, 0, end))) end = nul - ptr;
+    while (begin < end && ptr[begin] == ' ') begin++;
+    while (end > begin && ptr[end - 1] == ' ') end--;
+    v = std::string_view(ptr + begin, end - begin);
+
+    if (v.empty()) return false;
+    switch (field.dbf_type) {
+    case 'N':
+    case 'F':
+      return v[0] != '*';
+    case 'D':
+      return v != "00000000" && v != "0";
+    case 'L':
+      return v[0] != '?';
+    default:
+      return true;
+    }
+  }
+
+  bool hasNumericPrimaryKey() const {
+    auto type = getColumnType(primary_key_);
+    return is_numeric(type) && type != ColumnType::BOOL;
+  }
+
+  static long long parseLongLong(std::string_view v) {
+    if (!v.empty() && v[0] == '+') v.remove_prefix(1);
+    long long r = 0;
+    auto [ ptr, ec ] = std::from_chars(v.data(), v.data() + v.size(), r);
+    if (ec == std::errc() && ptr == v.data() + v.size()) return r;
+    // not a plain integer, so truncate the decimal value
+    return static_cast<long long>(parseDouble(v));
+  }
+
+  // Parses a numeric key, which is truncated to an integer like
+  // parseLongLong() does, but returns false if v isn't a number
+  static bool parseKey(std::string_view v, long long & r) {
+    if (!v.empty() && v[0] == '+') v.remove_prefix(1);
+    auto [ ptr, ec ] = std::from_chars(v.data(), v.data() + v.size(), r);
+    if (ec == std::errc() && ptr == v.data() + v.size()) return true;
+    double d;
+    auto [ ptr2, ec2 ] = std::from_chars(v.data(), v.data() + v.size(), d);
+    if (ec2 != std::errc() || ptr2 != v.data() + v.size()) return false;
+    r = static_cast<long long>(d);
+    return true;
+  }
+
+  static double parseDouble(std::string_view v) {
+    if (!v.empty() && v[0] == '+') v.remove_prefix(1);
+    double r = 0.0;
+    auto [ ptr, ec ] = std::from_chars(v.data(), v.data() + v.size(), r);
+    return ec == std::errc() ? r : 0.0;
+  }
+
+  void open() {
+    int fd = ::open(fn_.c_str(), O_RDONLY);
+    if (fd < 0) {
+      throw std::runtime_error("failed to open DBase4 file");
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < 32) {
+      ::close(fd);
+      throw std::runtime_error("invalid DBase4 file");
+    }
+    size_ = static_cast<size_t>(st.st_size);
+    mtime_ = st.st_mtim;
+    auto ptr = mmap(0, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (ptr == MAP_FAILED) {
+      throw std::runtime_error("failed to map DBase4 file");
+    }
+    data_ = reinterpret_cast<const char *>(ptr);
+
+    try {
+      initialize();
+    } catch (...) {
+      munmap(ptr, size_);
+      data_ = 0;
+      throw;
+    }
+  }
+
   void initialize() {
-    record_count_ = DBFGetRecordCount(h_);
-  
-    auto n = DBFGetFieldCount(h_);
-    for (int i = 0; i < n; i++) {
-      char name[255];
-      auto type = DBFGetFieldInfo(h_, i, name, 0, 0);
-      column_names_.push_back(name);
-      
-      switch (type) {
-      case FTString:
-	column_types_.push_back(ColumnType::VARCHAR);
-	break;
-      case FTInteger:
-	column_types_.push_back(ColumnType::INT);
+    auto header = reinterpret_cast<const unsigned char *>(data_);
+    size_t num_records = header[4] | (header[5] << 8) | (header[6] << 16) | (static_cast<size_t>(header[7]) << 24);
+    header_length_ = header[8] | (header[9] << 8);
+    record_length_ = header[10] | (header[11] << 8);
+    if (header_length_ < 32 || header_length_ > size_ || record_length_ == 0) {
+      throw std::runtime_error("invalid DBase4 file");
+    }
+
+    // the field descriptors are terminated by 0x0d
+    size_t offset = 1; // deletion flag
+    for (size_t pos = 32; pos + 32 <= header_length_ && header[pos] != 0x0d; pos += 32) {
+      auto d = header + pos;
+      Field field;
+      field.name.assign(reinterpret_cast<const char *>(d), strnlen(reinterpret_cast<const char *>(d), 11));
+      while (!field.name.empty() && field.name.back() == ' ') field.name.pop_back();
+      field.dbf_type = static_cast<char>(d[11]);
+      field.offset = offset;
+      int decimals = 0;
+      if (field.dbf_type == 'C') {
+	// long character fields use the decimal count as the high byte
+	field.width = d[16] | (d[17] << 8);
+      } else {
+	field.width = d[16];
+	decimals = d[17];
+      }
+      offset += field.width;
+
+      switch (field.dbf_type) {
+      case 'N':
+      case 'F':
+	field.type = decimals > 0 || field.width >= 10 ? ColumnType::DOUBLE : ColumnType::INT;
 	break;
-      case FTDouble:
-	column_types_.push_back(ColumnType::DOUBLE);
+      case 'L':
+	field.type = ColumnType::BOOL;
 	break;
-      case FTLogical:
-	column_types_.push_back(ColumnType::BOOL);
+      case 'D':
+	field.type = ColumnType::ANY;
 	break;
-      case FTInvalid:
       default:
-	column_types_.push_back(ColumnType::ANY);
+	field.type = ColumnType::VARCHAR;
 	break;
       }
+      fields_.push_back(std::move(field));
+    }
+    if (offset > record_length_) {
+      throw std::runtime_error("invalid DBase4 file");
     }
+
+    // ignore the records that are missing from a truncated file
+    size_t max_records = (size_ - header_length_) / record_length_;
+    record_count_ = static_cast<int>(std::min(num_records, max_records));
   }
 
   std::string fn_;
   int primary_key_;
   
-  DBFHandle h_;
-  std::vector<std::string> column_names_;
-  std::vector<ColumnType> column_types_;
-  int record_count_;
+  const char * data_ = 0;
+  size_t size_ = 0, header_length_ = 0, record_length_ = 0;
+  struct timespec mtime_;
+  std::vector<Field> fields_;
+  int record_count_ = 0;
 
   static inline std::string null_string;
 };
 
 class DBase4Cursor : public Cursor {
 public:
-  DBase4Cursor(std::shared_ptr<sqldb::DBase4File> dbf, int row) : dbf_(std::move(dbf)), current_row_(row) {
-    updateRowKey();
+  DBase4Cursor(std::shared_ptr<sqldb::DBase4File> dbf, int row, int end_row = -1, std::shared_ptr<const RowFilter> filter = nullptr)
+    : dbf_(std::move(dbf)), current_row_(row), end_row_(end_row >= 0 ? end_row : dbf_->getRecordCount()), filter_(std::move(filter)) {
+    text_buffer_.resize(dbf_->getNumFields());
+    is_valid_ = current_row_ >= 0 && current_row_ < end_row_;
+    if (is_valid_ && filter_ && !filter_->matches(*this)) {
+      is_valid_ = next();
+    } else {
+      updateRowKey();
+    }
   }
+
+  // false if no row in the range matches the filter
+  bool isValid() const { return is_valid_; }
   
   bool next() override {
-    if (current_row_ + 1 < dbf_->getRecordCount()) {
+    while (current_row_ + 1 < end_row_) {
       current_row_++;
-      text_cache_.clear();
-      updateRowKey();
-      return true;
-    } else {
-      return false;
+      // the filter only parses the filtered columns of the record
+      if (!filter_ || filter_->matches(*this)) {
+	updateRowKey();
+	return true;
+      }
     }
+    return false;
   }
   
   std::string_view getText(int column_index) override {
-    auto [ it, is_new ] = text_cache_.emplace(column_index, std::string());
-    if (is_new) it->second = dbf_->getText(current_row_, column_index);
-    return it->second;
+    auto idx = static_cast<size_t>(column_index);
+    if (idx >= text_buffer_.size()) return std::string_view();
+    return dbf_->getText(current_row_, column_index, text_buffer_[idx]);
   }
 
   bool getBool(int column_index, bool default_value = false) override {
@@ -170,15 +356,18 @@ public:
   }
   
   int getInt(int column_index, int default_value = 0) override {
-    return dbf_->getInt(current_row_, column_index, default_value);
+    return static_cast<int>(dbf_->getLongLong(current_row_, column_index, default_value));
   }
 
   long long getLongLong(int column_index, long long default_value = 0) override {
-    return dbf_->getInt(current_row_, column_index, default_value);
+    return dbf_->getLongLong(current_row_, column_index, default_value);
   }
 
   Key getKey(int column_index) override {
-    if (is_numeric(getColumnType(column_index))) {
+    auto type = getColumnType(column_index);
+    if (type == ColumnType::BOOL) {
+      return Key(getBool(column_index) ? 1 : 0);
+    } else if (is_numeric(type)) {
       return Key(getLongLong(column_index));
     } else {
       return Key(getText(column_index));
@@ -188,10 +377,8 @@ public:
   int getNumFields() const override { return dbf_->getNumFields(); }
 
   vector<uint8_t> getBlob(int column_index) override {
-    auto v = dbf_->getText(current_row_, column_index);
-    std::vector<uint8_t> r;
-    for (size_t i = 0; i < v.size(); i++) r.push_back(static_cast<uint8_t>(v[i]));
-    return r;
+    auto v = getText(column_index);
+    return std::vector<uint8_t>(v.begin(), v.end());
   }
   
   bool isNull(int column_index) const override {
@@ -202,6 +389,10 @@ public:
     return dbf_->getColumnName(column_index);
   }
 
+  ColumnType getColumnType(int column_index) const override {
+    return dbf_->getColumnType(column_index);
+  }
+
   void set(int column_idx, std::string_view value, bool is_defined = true) override {
     throw std::runtime_error("dBase4 file is read-only");
   }
@@ -232,7 +423,8 @@ protected:
     if (current_row_ >= 0) {
       int primary_key = dbf_->getPrimaryKey();
       if (primary_key >= 0) {
-	key.addComponent(dbf_->getText(current_row_, primary_key));
+	std::string buffer;
+	key.addComponent(std::string(dbf_->getText(current_row_, primary_key, buffer)));
       } else {
 	key.addComponent(0);
 	key.addComponent(current_row_);
@@ -243,8 +435,11 @@ protected:
 
 private:
   std::shared_ptr<DBase4File> dbf_;
-  int current_row_;
-  std::unordered_map<int, std::string> text_cache_;
+  int current_row_, end_row_;
+  std::shared_ptr<const RowFilter> filter_;
+  bool is_valid_;
+  // normalized text of the current row for each column
+  std::vector<std::string> text_buffer_;
 };
 
 DBase4::DBase4(std::string filename, int primary_key)
@@ -263,12 +458,16 @@ DBase4::DBase4(std::string filename, int primary_key)
 DBase4::DBase4(const DBase4 & other)
   : Table(other),
     dbf_(make_shared<DBase4File>(*other.dbf_)),
-    primary_key_mapping_(other.primary_key_mapping_) { }
+    primary_key_mapping_(other.primary_key_mapping_),
+    primary_key_index_(other.primary_key_index_),
+    index_file_(other.index_file_) { }
 
 DBase4::DBase4(DBase4 && other)
   : Table(other),
     dbf_(move(other.dbf_)),
-    primary_key_mapping_(move(other.primary_key_mapping_)) { }
+    primary_key_mapping_(move(other.primary_key_mapping_)),
+    primary_key_index_(move(other.primary_key_index_)),
+    index_file_(move(other.index_file_)) { }
 
 int
 DBase4::getNumFields(int sheet) const {
@@ -287,7 +486,6 @@ DBase4::getColumnType(int column_index, int sheet) const {
 
 unique_ptr<Cursor>
 DBase4::seek(const Key & key) {
-  assert(key.size() == 2);
   if (!primary_key_mapping_.empty()) {
     auto it = primary_key_mapping_.find(key);
     if (it != primary_key_mapping_.end()) {
@@ -295,12 +493,189 @@ DBase4::seek(const Key & key) {
     } else {
       return unique_ptr<DBase4Cursor>(nullptr);
     }
+  } else if (dbf_->getPrimaryKey() >= 0) {
+    if (!primary_key_index_) buildPrimaryKeyIndex();
+    std::string index_key;
+    if (!dbf_->getIndexKey(key, index_key)) return unique_ptr<DBase4Cursor>(nullptr);
+    auto it = primary_key_index_->find(index_key);
+    if (it != primary_key_index_->end()) {
+      return seek(it->second);
+    } else {
+      return unique_ptr<DBase4Cursor>(nullptr);
+    }
   } else {
+    assert(key.size() == 2);
     return seek(key.getInt(1));
   }
 }
 
+unique_ptr<Cursor>
+DBase4::seekBegin(int sheet) {
+  if (auto filter = getRowFilter()) {
+    auto cursor = make_unique<DBase4Cursor>(dbf_, 0, -1, std::move(filter));
+    if (cursor->isValid()) return cursor;
+    else return unique_ptr<DBase4Cursor>(nullptr);
+  } else {
+    return seek(0);
+  }
+}
+
 unique_ptr<Cursor>
 DBase4::seek(int row, int sheet) {
   return make_unique<DBase4Cursor>(dbf_, row);
 }
+
+std::vector<std::unique_ptr<Cursor>>
+DBase4::seekPartitions(int num_partitions, int sheet) {
+  // the file is read-only and mapped, so cursors can share it between threads
+  std::vector<std::unique_ptr<Cursor>> r;
+  long long record_count = dbf_->getRecordCount();
+  int n = static_cast<int>(std::min<long long>(record_count, std::max(num_partitions, 1)));
+  for (int i = 0; i < n; i++) {
+    int begin = static_cast<int>(record_count * i / n);
+    int end = static_cast<int>(record_count * (i + 1) / n);
+    auto cursor = make_unique<DBase4Cursor>(dbf_, begin, end, getRowFilter());
+    if (cursor->isValid()) r.push_back(std::move(cursor));
+  }
+  return r;
+}
+
+// Records per thread below which the index is built in a single thread
+#define DBASE4_MIN_RECORDS_PER_THREAD 100000
+
+void
+DBase4::buildPrimaryKeyIndex(int num_threads) {
+  if (dbf_->getPrimaryKey() < 0) {
+    throw std::runtime_error("DBase4 table has no primary key");
+  }
+  if (!index_file_.empty() && loadIndex()) {
+    return;
+  }
+  
+  int record_count = dbf_->getRecordCount();
+  if (num_threads <= 0) num_threads = static_cast<int>(std::thread::hardware_concurrency());
+  num_threads = std::max(1, std::min(num_threads, record_count / DBASE4_MIN_RECORDS_PER_THREAD));
+
+  auto index = std::make_shared<PrimaryKeyIndex>();
+  if (num_threads == 1) {
+    index->reserve(record_count);
+    dbf_->indexRecords(0, record_count, *index);
+  } else {
+    // index each range of records separately, and merge in record order so
+    // that the first record still wins for duplicated keys
+    std::vector<PrimaryKeyIndex> partial(num_threads);
+    std::vector<std::exception_ptr> errors(num_threads);
+    std::vector<std::thread> threads;
+    for (int i = 0; i < num_threads; i++) {
+      int begin = static_cast<int>(static_cast<long long>(record_count) * i / num_threads);
+      int end = static_cast<int>(static_cast<long long>(record_count) * (i + 1) / num_threads);
+      threads.emplace_back([this, begin, end, &partial, &errors, i]() {
+	try {
+	  partial[i].reserve(end - begin);
+	  dbf_->indexRecords(begin, end, partial[i]);
+	} catch (...) {
+	  errors[i] = std::current_exception();
+	}
+      });
+    }
+    for (auto & t : threads) t.join();
+    for (auto & e : errors) {
+      if (e) std::rethrow_exception(e);
+    }
+    
+    index->reserve(record_count);
+    for (auto & p : partial) {
+      for (auto & [ key, row ] : p) {
+	index->emplace(key, row);
+      }
+      p = PrimaryKeyIndex();
+    }
+  }
+  primary_key_index_ = std::move(index);
+
+  if (!index_file_.empty()) {
+    saveIndex();
+  }
+}
+
+// Sidecar file layout: magic, DBF file size and modification time, primary
+// key column, number of entries, and for each entry the key length, the key
+// and the record number.
+static const char dbase4_index_magic[8] = { 'S', 'Q', 'D', 'B', 'P', 'K', 'I', '3' };
+
+bool
+DBase4::loadIndex() {
+  auto in = fopen(index_file_.c_str(), "rb");
+  if (!in) return false;
+
+  char magic[8];
+  unsigned long long file_size, num_entries;
+  long long mtime_sec, mtime_nsec;
+  int primary_key;
+  bool is_valid = fread(magic, sizeof(magic), 1, in) == 1 &&
+    memcmp(magic, dbase4_index_magic, sizeof(magic)) == 0 &&
+    fread(&file_size, sizeof(file_size), 1, in) == 1 &&
+    fread(&mtime_sec, sizeof(mtime_sec), 1, in) == 1 &&
+    fread(&mtime_nsec, sizeof(mtime_nsec), 1, in) == 1 &&
+    fread(&primary_key, sizeof(primary_key), 1, in) == 1 &&
+    fread(&num_entries, sizeof(num_entries), 1, in) == 1 &&
+    file_size == dbf_->getFileSize() &&
+    mtime_sec == static_cast<long long>(dbf_->getModificationTime().tv_sec) &&
+    mtime_nsec == static_cast<long long>(dbf_->getModificationTime().tv_nsec) &&
+    primary_key == dbf_->getPrimaryKey() &&
+    num_entries <= static_cast<unsigned long long>(dbf_->getRecordCount());
+
+  auto index = std::make_shared<PrimaryKeyIndex>();
+  if (is_valid) {
+    index->reserve(num_entries);
+    std::string key;
+    for (unsigned long long i = 0; i < num_entries; i++) {
+      unsigned int len;
+      int row;
+      if (fread(&len, sizeof(len), 1, in) != 1 || len > dbf_->getFileSize()) {
+	is_valid = false;
+	break;
+      }
+      key.resize(len);
+      if ((len && fread(key.data(), len, 1, in) != 1) || fread(&row, sizeof(row), 1, in) != 1) {
+	is_valid = false;
+	break;
+      }
+      index->emplace(key, row);
+    }
+  }
+  fclose(in);
+
+  if (is_valid) primary_key_index_ = std::move(index);
+  return is_valid;
+}
+
+void
+DBase4::saveIndex() const {
+  // the index is written to a temporary file first so that readers never see
+  // a partial file. The index is only a cache, so failures are ignored.
+  auto tmp_file = index_file_ + ".tmp";
+  auto out = fopen(tmp_file.c_str(), "wb");
+  if (!out) return;
+
+  unsigned long long file_size = dbf_->getFileSize(), num_entries = primary_key_index_->size();
+  long long mtime_sec = dbf_->getModificationTime().tv_sec, mtime_nsec = dbf_->getModificationTime().tv_nsec;
+  int primary_key = dbf_->getPrimaryKey();
+  bool is_ok = fwrite(dbase4_index_magic, sizeof(dbase4_index_magic), 1, out) == 1 &&
+    fwrite(&file_size, sizeof(file_size), 1, out) == 1 &&
+    fwrite(&mtime_sec, sizeof(mtime_sec), 1, out) == 1 &&
+    fwrite(&mtime_nsec, sizeof(mtime_nsec), 1, out) == 1 &&
+    fwrite(&primary_key, sizeof(primary_key), 1, out) == 1 &&
+    fwrite(&num_entries, sizeof(num_entries), 1, out) == 1;
+  for (auto it = primary_key_index_->begin(); is_ok && it != primary_key_index_->end(); ++it) {
+    unsigned int len = static_cast<unsigned int>(it->first.size());
+    is_ok = fwrite(&len, sizeof(len), 1, out) == 1 &&
+      (!len || fwrite(it->first.data(), len, 1, out) == 1) &&
+      fwrite(&it->second, sizeof(it->second), 1, out) == 1;
+  }
+  if (fclose(out) != 0) is_ok = false;
+
+  if (!is_ok || ::rename(tmp_file.c_str(), index_file_.c_str()) != 0) {
+    ::remove(tmp_file.c_str());
+  }
+}
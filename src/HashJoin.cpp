@@ -0,0 +1,372 @@
+#include "HashJoin.h"
+
+#include "SpillFile.h"
+
+#include <vector>
+#include <charconv>
+#include <stdexcept>
+
+#include "robin_hood.h"
+
+using namespace std;
+using namespace sqldb;
+
+// Number of partitions when the build table doesn't fit in memory
+#define JOIN_NUM_PARTITIONS 64
+
+// Marks the end of a chain of build rows
+#define JOIN_NO_ROW static_cast<size_t>(-1)
+
+struct JoinRow {
+  Key key, row_key;
+  std::vector<std::string> values;
+  std::vector<bool> is_null;
+};
+
+// Approximate memory used by a row, including the strings that don't fit
+// in the small string buffer
+static size_t estimate_size(const JoinRow & row) {
+  size_t n = sizeof(JoinRow) + sizeof(size_t) + row.values.size() * sizeof(std::string) + row.is_null.size() / 8;
+  n += (row.key.size() + row.row_key.size()) * 48;
+  for (auto & v : row.values) {
+    if (v.size() >= sizeof(std::string)) n += v.size() + 1;
+  }
+  return n;
+}
+
+// Returns the join key of the current row, or an empty key if the value is
+// null or, when the keys are numeric, not an integer
+static Key make_join_key(Cursor & input, int col, bool is_numeric_key) {
+  if (input.isNull(col)) return Key();
+  if (!is_numeric_key) return input.getKey(col);
+  long long v = 0;
+  if (is_numeric(input.getColumnType(col))) {
+    v = input.getLongLong(col);
+  } else {
+    auto s = input.getText(col);
+    auto [ ptr, ec ] = std::from_chars(s.data(), s.data() + s.size(), v);
+    if (ec != std::errc() || ptr != s.data() + s.size()) return Key();
+  }
+  Key key;
+  key.addComponent(v);
+  return key;
+}
+
+static void read_row(Cursor & input, int num_fields, JoinRow & row) {
+  row.values.resize(num_fields);
+  row.is_null.resize(num_fields);
+  for (int i = 0; i < num_fields; i++) {
+    row.is_null[i] = input.isNull(i);
+    if (!row.is_null[i]) row.values[i] = input.getText(i);
+  }
+}
+
+static size_t get_partition(const Key & key) {
+  // the low bits are left for the hash table
+  return (key.getHash() >> 24) % JOIN_NUM_PARTITIONS;
+}
+
+template<typename T>
+static T parse_value(std::string_view s, T default_value) {
+  if (!s.empty()) {
+    T v;
+    auto [ ptr, ec ] = std::from_chars(s.data(), s.data() + s.size(), v);
+    if (ec == std::errc()) return v;
+  }
+  return default_value;
+}
+
+// Hash table of build rows. Rows with the same key are chained in input
+// order.
+class JoinTable {
+public:
+  JoinTable() { }
+
+  bool empty() const { return rows_.empty(); }
+  size_t getMemoryUsed() const { return memory_used_; }
+
+  void add(JoinRow row) {
+    auto idx = rows_.size();
+    auto [ it, is_new ] = chains_.try_emplace(row.key, idx, idx);
+    if (!is_new) {
+      next_[it->second.second] = idx;
+      it->second.second = idx;
+    }
+    next_.push_back(JOIN_NO_ROW);
+    memory_used_ += estimate_size(row);
+    rows_.push_back(std::move(row));
+  }
+
+  size_t find(const Key & key) const {
+    auto it = chains_.find(key);
+    return it != chains_.end() ? it->second.first : JOIN_NO_ROW;
+  }
+
+  size_t getNext(size_t idx) const { return next_[idx]; }
+  const JoinRow & getRow(size_t idx) const { return rows_[idx]; }
+  std::vector<JoinRow> & getRows() { return rows_; }
+
+  void clear() {
+    rows_.clear();
+    next_.clear();
+    chains_.clear();
+    memory_used_ = 0;
+  }
+
+private:
+  std::vector<JoinRow> rows_;
+  std::vector<size_t> next_;
+  // maps the keys to the first and the last row of their chains
+  robin_hood::unordered_flat_map<Key, std::pair<size_t, size_t>> chains_;
+  size_t memory_used_ = 0;
+};
+
+class JoinCursor : public Cursor {
+public:
+  // Joins the build rows in memory with the rows of the probe cursor
+  JoinCursor(std::vector<std::string> column_names, std::vector<ColumnType> column_types, int num_probe_fields, JoinTable table, std::unique_ptr<Cursor> probe, int probe_column, bool is_numeric_key)
+    : column_names_(std::move(column_names)), column_types_(std::move(column_types)), num_probe_fields_(num_probe_fields), table_(std::move(table)), probe_(std::move(probe)), probe_column_(probe_column), is_numeric_key_(is_numeric_key) { }
+
+  // Joins the build and probe partitions one partition at a time
+  JoinCursor(std::vector<std::string> column_names, std::vector<ColumnType> column_types, int num_probe_fields, std::vector<std::unique_ptr<SpillFile>> build_partitions, std::vector<std::unique_ptr<SpillFile>> probe_partitions)
+    : column_names_(std::move(column_names)), column_types_(std::move(column_types)), num_probe_fields_(num_probe_fields), build_partitions_(std::move(build_partitions)), probe_partitions_(std::move(probe_partitions)) { }
+
+  // Moves to the first joined row and returns false if there are none
+  bool start() {
+    return next();
+  }
+
+  bool next() override {
+    if (match_ != JOIN_NO_ROW) match_ = table_.getNext(match_);
+    while (match_ == JOIN_NO_ROW) {
+      if (!nextProbeRow()) return false;
+      match_ = table_.find(probe_key_);
+    }
+    setRowKey(probe_ ? probe_->getRowKey() : probe_row_.row_key);
+    return true;
+  }
+
+  std::string_view getText(int column_index) override {
+    if (probe_ && column_index < num_probe_fields_) return probe_->getText(column_index);
+    auto [ row, idx ] = getValue(column_index);
+    return row && idx < row->values.size() ? std::string_view(row->values[idx]) : std::string_view();
+  }
+
+  double getDouble(int column_index, double default_value = 0.0) override {
+    if (probe_ && column_index < num_probe_fields_) return probe_->getDouble(column_index, default_value);
+    return parse_value(getText(column_index), default_value);
+  }
+
+  float getFloat(int column_index, float default_value = 0.0f) override {
+    if (probe_ && column_index < num_probe_fields_) return probe_->getFloat(column_index, default_value);
+    return parse_value(getText(column_index), default_value);
+  }
+
+  int getInt(int column_index, int default_value = 0) override {
+    if (probe_ && column_index < num_probe_fields_) return probe_->getInt(column_index, default_value);
+    return parse_value(getText(column_index), default_value);
+  }
+
+  long long getLongLong(int column_index, long long default_value = 0) override {
+    if (probe_ && column_index < num_probe_fields_) return probe_->getLongLong(column_index, default_value);
+    return parse_value(getText(column_index), default_value);
+  }
+
+  Key getKey(int column_index) override {
+    if (probe_ && column_index < num_probe_fields_) return probe_->getKey(column_index);
+    if (is_numeric(getColumnType(column_index))) {
+      Key key;
+      key.addComponent(getLongLong(column_index));
+      return key;
+    } else {
+      return Key(getText(column_index));
+    }
+  }
+
+  int getNumFields() const override { return static_cast<int>(column_names_.size()); }
+
+  std::vector<uint8_t> getBlob(int column_index) override {
+    if (probe_ && column_index < num_probe_fields_) return probe_->getBlob(column_index);
+    auto v = getText(column_index);
+    return std::vector<uint8_t>(v.begin(), v.end());
+  }
+
+  bool isNull(int column_index) const override {
+    if (probe_ && column_index < num_probe_fields_) return probe_->isNull(column_index);
+    auto [ row, idx ] = getValue(column_index);
+    return row && idx < row->is_null.size() ? row->is_null[idx] : true;
+  }
+
+  const std::string & getColumnName(int column_index) override {
+    auto idx = static_cast<size_t>(column_index);
+    return idx < column_names_.size() ? column_names_[idx] : Table::empty_string;
+  }
+
+  ColumnType getColumnType(int column_index) const override {
+    auto idx = static_cast<size_t>(column_index);
+    return idx < column_types_.size() ? column_types_[idx] : ColumnType::ANY;
+  }
+
+  void set(int column_idx, std::string_view value, bool is_defined = true) override {
+    throw std::runtime_error("Join cursor is read-only");
+  }
+  void set(int column_idx, int value, bool is_defined = true) override {
+    throw std::runtime_error("Join cursor is read-only");
+  }
+  void set(int column_idx, long long value, bool is_defined = true) override {
+    throw std::runtime_error("Join cursor is read-only");
+  }
+  void set(int column_idx, double value, bool is_defined = true) override {
+    throw std::runtime_error("Join cursor is read-only");
+  }
+  void set(int column_idx, const void * data, size_t len, bool is_defined = true) override {
+    throw std::runtime_error("Join cursor is read-only");
+  }
+  size_t execute() override {
+    throw std::runtime_error("Join cursor is read-only");
+  }
+  size_t update(const Key & key) override {
+    throw std::runtime_error("Join cursor is read-only");
+  }
+
+  long long getLastInsertId() const override { return 0; }
+
+private:
+  // Returns the stored row that holds the column and the index of the value
+  std::pair<const JoinRow *, size_t> getValue(int column_index) const {
+    if (column_index < 0) return std::pair(nullptr, 0);
+    if (column_index < num_probe_fields_) return std::pair(&probe_row_, column_index);
+    if (match_ == JOIN_NO_ROW) return std::pair(nullptr, 0);
+    return std::pair(&table_.getRow(match_), column_index - num_probe_fields_);
+  }
+
+  bool nextProbeRow() {
+    if (probe_) {
+      if (is_started_ && !probe_->next()) return false;
+      is_started_ = true;
+      probe_key_ = make_join_key(*probe_, probe_column_, is_numeric_key_);
+      return true;
+    }
+    while ( 1 ) {
+      if (probe_file_ && probe_file_->readKey(probe_row_.key)) {
+	if (!probe_file_->readKey(probe_row_.row_key)) {
+	  throw std::runtime_error("Truncated join partition");
+	}
+	probe_file_->readValues(probe_row_.values, probe_row_.is_null);
+	probe_key_ = probe_row_.key;
+	return true;
+      }
+      if (next_partition_ >= probe_partitions_.size()) return false;
+      loadPartition(next_partition_++);
+    }
+  }
+
+  // Reads the build rows of the partition into the hash table, and
+  // releases the files of the previous partition
+  void loadPartition(size_t partition) {
+    table_.clear();
+    probe_file_ = std::move(probe_partitions_[partition]);
+    auto build_file = std::move(build_partitions_[partition]);
+    if (!build_file || !probe_file_) {
+      probe_file_.reset();
+      return;
+    }
+    build_file->rewind();
+    JoinRow row;
+    while (build_file->readKey(row.key)) {
+      build_file->readValues(row.values, row.is_null);
+      table_.add(std::move(row));
+      row = JoinRow();
+    }
+    probe_file_->rewind();
+  }
+
+  std::vector<std::string> column_names_;
+  std::vector<ColumnType> column_types_;
+  int num_probe_fields_;
+  JoinTable table_;
+  size_t match_ = JOIN_NO_ROW;
+  Key probe_key_;
+
+  // the probe rows are either read from a cursor or from partitions
+  std::unique_ptr<Cursor> probe_;
+  int probe_column_ = 0;
+  bool is_numeric_key_ = false, is_started_ = false;
+
+  std::vector<std::unique_ptr<SpillFile>> build_partitions_, probe_partitions_;
+  std::unique_ptr<SpillFile> probe_file_;
+  size_t next_partition_ = 0;
+  JoinRow probe_row_;
+};
+
+static void spill_row(std::vector<std::unique_ptr<SpillFile>> & partitions, const std::string & temp_dir, const JoinRow & row, bool has_row_key) {
+  auto & f = partitions[get_partition(row.key)];
+  if (!f) f = std::make_unique<SpillFile>(temp_dir);
+  f->writeKey(row.key);
+  if (has_row_key) f->writeKey(row.row_key);
+  f->writeValues(row.values, row.is_null);
+}
+
+std::unique_ptr<Cursor>
+sqldb::hashJoin(Table & build, int build_column, Table & probe, int probe_column, size_t memory_budget, std::string temp_dir, int build_sheet, int probe_sheet) {
+  std::vector<std::string> column_names;
+  std::vector<ColumnType> column_types;
+  int num_probe_fields = probe.getNumFields(probe_sheet), num_build_fields = build.getNumFields(build_sheet);
+  for (int i = 0; i < num_probe_fields; i++) {
+    column_names.push_back(probe.getColumnName(i, probe_sheet));
+    column_types.push_back(probe.getColumnType(i, probe_sheet));
+  }
+  for (int i = 0; i < num_build_fields; i++) {
+    column_names.push_back(build.getColumnName(i, build_sheet));
+    column_types.push_back(build.getColumnType(i, build_sheet));
+  }
+  bool is_numeric_key = is_numeric(build.getColumnType(build_column, build_sheet)) || is_numeric(probe.getColumnType(probe_column, probe_sheet));
+
+  // The build rows are kept in memory until they exceed the budget, and
+  // then all of them are written to the partitions
+  JoinTable table;
+  std::vector<std::unique_ptr<SpillFile>> build_partitions;
+  if (auto input = build.seekBegin(build_sheet)) {
+    do {
+      JoinRow row;
+      row.key = make_join_key(*input, build_column, is_numeric_key);
+      if (row.key.empty()) continue;
+      read_row(*input, num_build_fields, row);
+      if (!build_partitions.empty()) {
+	spill_row(build_partitions, temp_dir, row, false);
+	continue;
+      }
+      table.add(std::move(row));
+      if (table.getMemoryUsed() >= memory_budget) {
+	build_partitions.resize(JOIN_NUM_PARTITIONS);
+	for (auto & r : table.getRows()) spill_row(build_partitions, temp_dir, r, false);
+	table.clear();
+      }
+    } while (input->next());
+  }
+  if (table.empty() && build_partitions.empty()) return std::unique_ptr<Cursor>(nullptr);
+
+  auto input = probe.seekBegin(probe_sheet);
+  if (!input) return std::unique_ptr<Cursor>(nullptr);
+
+  std::unique_ptr<JoinCursor> cursor;
+  if (build_partitions.empty()) {
+    cursor = std::make_unique<JoinCursor>(std::move(column_names), std::move(column_types), num_probe_fields, std::move(table), std::move(input), probe_column, is_numeric_key);
+  } else {
+    // probe rows are only kept for partitions that have build rows
+    std::vector<std::unique_ptr<SpillFile>> probe_partitions(JOIN_NUM_PARTITIONS);
+    do {
+      JoinRow row;
+      row.key = make_join_key(*input, probe_column, is_numeric_key);
+      if (row.key.empty() || !build_partitions[get_partition(row.key)]) continue;
+      row.row_key = input->getRowKey();
+      read_row(*input, num_probe_fields, row);
+      spill_row(probe_partitions, temp_dir, row, true);
+    } while (input->next());
+    input.reset();
+    cursor = std::make_unique<JoinCursor>(std::move(column_names), std::move(column_types), num_probe_fields, std::move(build_partitions), std::move(probe_partitions));
+  }
+
+  if (!cursor->start()) return std::unique_ptr<Cursor>(nullptr);
+  return cursor;
+}
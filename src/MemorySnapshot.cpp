@@ -0,0 +1,704 @@
+#include "MemorySnapshot.h"
+
+#include <Cursor.h>
+
+#include <vector>
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+#include <cstdio>
+#include <cstdint>
+#include <mutex>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "BinaryFormat.h"
+
+using namespace std;
+using namespace sqldb;
+
+// Maximum number of rows in a chunk
+#define SNAPSHOT_CHUNK_ROWS 4096
+// Size of the values after which a chunk is written early, so that the
+// offsets within a block fit in 32 bits
+#define SNAPSHOT_MAX_CHUNK_BYTES (1 << 30)
+
+// File layout, in native byte order:
+//
+//   magic
+//   chunks, each with a block for the row keys and one for each column
+//   footer: key type, columns (type, unique, decimals, name), sorted flag,
+//           number of rows and the chunk directory (first row, number of
+//           rows, first key, and the offset and size of each block)
+//   footer offset and magic
+//
+// A block of n values has n + 1 offsets, a null bitmap and the values, and
+// starts at a multiple of 8 bytes.
+static const char snapshot_magic[8] = { 'S', 'Q', 'D', 'B', 'S', 'N', 'P', '1' };
+
+static inline size_t block_header_size(size_t n) {
+  return 4 * (n + 1) + (n + 7) / 8;
+}
+
+// The values of one column (or the row keys) of a chunk being written
+class SnapshotBlockBuffer {
+public:
+  SnapshotBlockBuffer() { clear(); }
+
+  void add(std::string_view value, bool is_null) {
+    size_t n = offsets_.size() - 1;
+    if (n % 8 == 0) nulls_.push_back(0);
+    if (is_null) {
+      nulls_.back() |= 1 << (n % 8);
+    } else {
+      data_ += value;
+    }
+    offsets_.push_back(static_cast<uint32_t>(data_.size()));
+  }
+
+  void clear() {
+    offsets_.assign(1, 0);
+    nulls_.clear();
+    data_.clear();
+  }
+
+  size_t getDataSize() const { return data_.size(); }
+
+  const std::vector<uint32_t> & getOffsets() const { return offsets_; }
+  const std::vector<uint8_t> & getNulls() const { return nulls_; }
+  const std::string & getData() const { return data_; }
+
+private:
+  std::vector<uint32_t> offsets_;
+  std::vector<uint8_t> nulls_;
+  std::string data_;
+};
+
+// Writes the chunks as the rows arrive, and the footer at the end
+class SnapshotWriter {
+public:
+  SnapshotWriter(const std::string & filename, Table & table, int sheet)
+    : columns_(table.getNumFields(sheet)) {
+    // the schema is written in the footer
+    append_u32(footer_, static_cast<uint32_t>(table.getKeyType().size()));
+    for (auto type : table.getKeyType()) {
+      append_u32(footer_, static_cast<uint32_t>(type));
+    }
+    append_u32(footer_, static_cast<uint32_t>(columns_.size()));
+    for (int i = 0; i < static_cast<int>(columns_.size()); i++) {
+      append_u32(footer_, static_cast<uint32_t>(table.getColumnType(i, sheet)));
+      footer_ += table.isColumnUnique(i, sheet) ? '\1' : '\0';
+      int32_t decimals = table.getColumnDecimals(i);
+      append_bytes(footer_, &decimals, sizeof(decimals));
+      append_string(footer_, table.getColumnName(i, sheet));
+    }
+
+    f_ = fopen(filename.c_str(), "wb");
+    if (!f_) {
+      throw std::runtime_error("Failed to create snapshot file");
+    }
+    writeBytes(snapshot_magic, sizeof(snapshot_magic));
+  }
+  SnapshotWriter(const SnapshotWriter & other) = delete;
+  ~SnapshotWriter() {
+    if (f_) fclose(f_);
+  }
+
+  SnapshotWriter & operator=(const SnapshotWriter & other) = delete;
+
+  void add(Cursor & cursor) {
+    auto & key = cursor.getRowKey();
+    if (num_rows_ && !(last_key_ < key)) is_sorted_ = false;
+    last_key_ = key;
+    if (!chunk_rows_) first_key_ = key;
+
+    key_buffer_.clear();
+    append_key(key_buffer_, key);
+    keys_.add(key_buffer_, false);
+    size_t chunk_bytes = keys_.getDataSize();
+    for (size_t i = 0; i < columns_.size(); i++) {
+      int col = static_cast<int>(i);
+      bool is_null = cursor.isNull(col);
+      columns_[i].add(is_null ? std::string_view() : cursor.getText(col), is_null);
+      chunk_bytes += columns_[i].getDataSize();
+    }
+    num_rows_++;
+
+    if (++chunk_rows_ == SNAPSHOT_CHUNK_ROWS || chunk_bytes >= SNAPSHOT_MAX_CHUNK_BYTES) {
+      flushChunk();
+    }
+  }
+
+  void finish() {
+    flushChunk();
+
+    footer_ += is_sorted_ ? '\1' : '\0';
+    append_u64(footer_, num_rows_);
+    append_u64(footer_, num_chunks_);
+    footer_ += directory_;
+    directory_.clear();
+
+    uint64_t footer_offset = offset_;
+    writeBytes(footer_.data(), footer_.size());
+    writeBytes(&footer_offset, sizeof(footer_offset));
+    writeBytes(snapshot_magic, sizeof(snapshot_magic));
+
+    // the file is renamed over the old snapshot, so it must be on disk first
+    bool ok = fflush(f_) == 0 && fsync(fileno(f_)) == 0;
+    ok = fclose(f_) == 0 && ok;
+    f_ = nullptr;
+    if (!ok) {
+      throw std::runtime_error("Failed to write snapshot file");
+    }
+  }
+
+private:
+  void flushChunk() {
+    if (!chunk_rows_) return;
+
+    append_u64(directory_, num_rows_ - chunk_rows_);
+    append_u64(directory_, chunk_rows_);
+    append_key(directory_, first_key_);
+    writeBlock(keys_);
+    for (auto & block : columns_) writeBlock(block);
+
+    num_chunks_++;
+    chunk_rows_ = 0;
+  }
+
+  void writeBlock(SnapshotBlockBuffer & block) {
+    static const char padding[8] = { 0 };
+    if (offset_ % 8) writeBytes(padding, 8 - offset_ % 8);
+
+    auto start = offset_;
+    auto & offsets = block.getOffsets();
+    auto & nulls = block.getNulls();
+    writeBytes(offsets.data(), offsets.size() * sizeof(uint32_t));
+    writeBytes(nulls.data(), nulls.size());
+    writeBytes(block.getData().data(), block.getData().size());
+    append_u64(directory_, start);
+    append_u64(directory_, offset_ - start);
+
+    block.clear();
+  }
+
+  void writeBytes(const void * data, size_t len) {
+    if (len && fwrite(data, 1, len, f_) != len) {
+      throw std::runtime_error("Failed to write snapshot file");
+    }
+    offset_ += len;
+  }
+
+  FILE * f_ = nullptr;
+  uint64_t offset_ = 0, num_rows_ = 0, num_chunks_ = 0;
+  size_t chunk_rows_ = 0;
+  bool is_sorted_ = true;
+  Key first_key_, last_key_;
+  SnapshotBlockBuffer keys_;
+  std::vector<SnapshotBlockBuffer> columns_;
+  std::string footer_, directory_, key_buffer_;
+};
+
+// Memory mapped snapshot file. Only the footer is decoded when the file is
+// opened, and the blocks are read in place.
+class sqldb::SnapshotFile {
+public:
+  struct Block {
+    const char * data = nullptr;
+    size_t size = 0;
+  };
+
+  struct Chunk {
+    size_t first_row = 0, num_rows = 0;
+    Key first_key;
+    Block keys;
+    std::vector<Block> columns;
+  };
+
+  SnapshotFile(std::string fn) : fn_(std::move(fn)) {
+    open();
+  }
+  SnapshotFile(const SnapshotFile & other) = delete;
+  ~SnapshotFile() {
+    if (data_) {
+      munmap(const_cast<char *>(data_), size_);
+    }
+  }
+
+  SnapshotFile & operator=(const SnapshotFile & other) = delete;
+
+  int getNumFields() const { return static_cast<int>(columns_.size()); }
+  size_t getNumRows() const { return num_rows_; }
+  bool isSorted() const { return is_sorted_; }
+  const std::vector<ColumnType> & getKeyType() const { return key_type_; }
+
+  const std::string & getColumnName(int column_index) const {
+    auto idx = static_cast<size_t>(column_index);
+    return idx < columns_.size() ? columns_[idx].name : null_string;
+  }
+
+  ColumnType getColumnType(int column_index) const {
+    auto idx = static_cast<size_t>(column_index);
+    return idx < columns_.size() ? columns_[idx].type : ColumnType::ANY;
+  }
+
+  bool isColumnUnique(int column_index) const {
+    auto idx = static_cast<size_t>(column_index);
+    return idx < columns_.size() && columns_[idx].unique;
+  }
+
+  int getColumnDecimals(int column_index) const {
+    auto idx = static_cast<size_t>(column_index);
+    return idx < columns_.size() ? columns_[idx].decimals : 0;
+  }
+
+  const Chunk & getChunk(size_t chunk) const { return chunks_[chunk]; }
+
+  // Returns the chunk of the row
+  size_t findChunk(size_t row) const {
+    auto it = std::upper_bound(chunks_.begin(), chunks_.end(), row, [](size_t row, const Chunk & chunk) {
+      return row < chunk.first_row;
+    });
+    return it == chunks_.begin() ? 0 : static_cast<size_t>(it - chunks_.begin()) - 1;
+  }
+
+  std::string_view getValue(const Chunk & chunk, int column_index, size_t i) const {
+    auto idx = static_cast<size_t>(column_index);
+    if (idx >= columns_.size()) return std::string_view();
+    return getValue(chunk.columns[idx], chunk.num_rows, i);
+  }
+
+  bool isNull(const Chunk & chunk, int column_index, size_t i) const {
+    auto idx = static_cast<size_t>(column_index);
+    if (idx >= columns_.size()) return true;
+    auto nulls = reinterpret_cast<const uint8_t *>(chunk.columns[idx].data) + 4 * (chunk.num_rows + 1);
+    return (nulls[i / 8] >> (i % 8)) & 1;
+  }
+
+  Key getKey(const Chunk & chunk, size_t i) const {
+    auto v = getValue(chunk.keys, chunk.num_rows, i);
+    return BinaryReader(v.data(), v.data() + v.size(), "invalid snapshot file").readKey();
+  }
+
+  // Returns the first row with a key not less than key. The rows must be
+  // sorted.
+  size_t lowerBound(const Key & key) const {
+    // the last chunk that starts at or before the key
+    auto it = std::upper_bound(chunks_.begin(), chunks_.end(), key, [](const Key & key, const Chunk & chunk) {
+      return key < chunk.first_key;
+    });
+    if (it == chunks_.begin()) return 0;
+    auto & chunk = *(it - 1);
+    size_t lo = 0, hi = chunk.num_rows;
+    while (lo < hi) {
+      size_t mid = (lo + hi) / 2;
+      if (getKey(chunk, mid) < key) lo = mid + 1;
+      else hi = mid;
+    }
+    return chunk.first_row + lo;
+  }
+
+  // Returns the row with the key, or the number of rows if there is none
+  size_t findRow(const Key & key) const {
+    if (is_sorted_) {
+      size_t row = lowerBound(key);
+      if (row < num_rows_) {
+	auto & chunk = chunks_[findChunk(row)];
+	if (getKey(chunk, row - chunk.first_row) == key) return row;
+      }
+      return num_rows_;
+    }
+
+    // unsorted files are indexed on first use, and the first row wins
+    std::call_once(index_flag_, [this]() {
+      index_.reserve(num_rows_);
+      for (auto & chunk : chunks_) {
+	for (size_t i = 0; i < chunk.num_rows; i++) {
+	  index_.emplace(getKey(chunk, i), chunk.first_row + i);
+	}
+      }
+    });
+    auto it = index_.find(key);
+    return it != index_.end() ? it->second : num_rows_;
+  }
+
+private:
+  struct Column {
+    ColumnType type;
+    std::string name;
+    bool unique;
+    int decimals;
+  };
+
+  std::string_view getValue(const Block & block, size_t n, size_t i) const {
+    uint32_t begin, end;
+    memcpy(&begin, block.data + 4 * i, sizeof(begin));
+    memcpy(&end, block.data + 4 * (i + 1), sizeof(end));
+    size_t header_size = block_header_size(n);
+    if (begin > end || header_size + end > block.size) {
+      throw std::runtime_error("invalid snapshot file");
+    }
+    return std::string_view(block.data + header_size + begin, end - begin);
+  }
+
+  void open() {
+    int fd = ::open(fn_.c_str(), O_RDONLY);
+    if (fd < 0) {
+      throw std::runtime_error("failed to open snapshot file");
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < static_cast<off_t>(2 * sizeof(snapshot_magic) + 8)) {
+      ::close(fd);
+      throw std::runtime_error("invalid snapshot file");
+    }
+    size_ = static_cast<size_t>(st.st_size);
+    auto ptr = mmap(0, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (ptr == MAP_FAILED) {
+      throw std::runtime_error("failed to map snapshot file");
+    }
+    data_ = reinterpret_cast<const char *>(ptr);
+
+    try {
+      initialize();
+    } catch (...) {
+      munmap(ptr, size_);
+      data_ = 0;
+      throw;
+    }
+  }
+
+  void initialize() {
+    auto trailer = data_ + size_ - sizeof(snapshot_magic) - 8;
+    uint64_t footer_offset;
+    memcpy(&footer_offset, trailer, sizeof(footer_offset));
+    if (memcmp(data_, snapshot_magic, sizeof(snapshot_magic)) != 0 ||
+	memcmp(trailer + 8, snapshot_magic, sizeof(snapshot_magic)) != 0 ||
+	footer_offset < sizeof(snapshot_magic) || footer_offset > static_cast<uint64_t>(trailer - data_)) {
+      throw std::runtime_error("invalid snapshot file");
+    }
+
+    BinaryReader footer(data_ + footer_offset, trailer, "invalid snapshot file");
+    for (uint32_t i = 0, n = footer.readU32(); i < n; i++) {
+      key_type_.push_back(static_cast<ColumnType>(footer.readU32()));
+    }
+    for (uint32_t i = 0, n = footer.readU32(); i < n; i++) {
+      Column column;
+      column.type = static_cast<ColumnType>(footer.readU32());
+      column.unique = footer.readU8() != 0;
+      int32_t decimals;
+      footer.read(&decimals, sizeof(decimals));
+      column.decimals = decimals;
+      column.name = footer.readString();
+      columns_.push_back(std::move(column));
+    }
+    is_sorted_ = footer.readU8() != 0;
+    num_rows_ = footer.readU64();
+    uint64_t num_chunks = footer.readU64();
+    if (num_chunks > num_rows_) {
+      throw std::runtime_error("invalid snapshot file");
+    }
+
+    chunks_.reserve(num_chunks);
+    size_t row = 0;
+    for (uint64_t i = 0; i < num_chunks; i++) {
+      Chunk chunk;
+      chunk.first_row = footer.readU64();
+      chunk.num_rows = footer.readU64();
+      chunk.first_key = footer.readKey();
+      if (chunk.first_row != row || chunk.num_rows == 0 || chunk.num_rows > num_rows_ - row) {
+	throw std::runtime_error("invalid snapshot file");
+      }
+      row += chunk.num_rows;
+      chunk.keys = readBlock(footer, chunk.num_rows, footer_offset);
+      for (size_t j = 0; j < columns_.size(); j++) {
+	chunk.columns.push_back(readBlock(footer, chunk.num_rows, footer_offset));
+      }
+      chunks_.push_back(std::move(chunk));
+    }
+    if (row != num_rows_) {
+      throw std::runtime_error("invalid snapshot file");
+    }
+  }
+
+  Block readBlock(BinaryReader & footer, size_t n, uint64_t footer_offset) const {
+    uint64_t offset = footer.readU64(), size = footer.readU64();
+    if (offset < sizeof(snapshot_magic) || offset > footer_offset || size > footer_offset - offset || size < block_header_size(n)) {
+      throw std::runtime_error("invalid snapshot file");
+    }
+    return Block{ data_ + offset, size };
+  }
+
+  std::string fn_;
+  const char * data_ = 0;
+  size_t size_ = 0;
+
+  std::vector<ColumnType> key_type_;
+  std::vector<Column> columns_;
+  bool is_sorted_ = true;
+  size_t num_rows_ = 0;
+  std::vector<Chunk> chunks_;
+
+  mutable std::once_flag index_flag_;
+  mutable robin_hood::unordered_flat_map<Key, size_t> index_;
+
+  static inline std::string null_string;
+};
+
+class SnapshotCursor : public Cursor {
+public:
+  SnapshotCursor(std::shared_ptr<const SnapshotFile> file, size_t row, size_t end_row, std::shared_ptr<const RowFilter> filter = nullptr)
+    : file_(std::move(file)), row_(row), end_row_(std::min(end_row, file_->getNumRows())), filter_(std::move(filter)) {
+    is_valid_ = row_ < end_row_;
+    if (is_valid_) {
+      chunk_index_ = file_->findChunk(row_);
+      chunk_ = &file_->getChunk(chunk_index_);
+      if (filter_ && !filter_->matches(*this)) {
+	is_valid_ = next();
+      } else {
+	updateRowKey();
+      }
+    }
+  }
+
+  // false if no row in the range matches the filter
+  bool isValid() const { return is_valid_; }
+
+  bool next() override {
+    while (row_ + 1 < end_row_) {
+      row_++;
+      if (row_ >= chunk_->first_row + chunk_->num_rows) {
+	chunk_ = &file_->getChunk(++chunk_index_);
+      }
+      // the filter only reads the filtered columns
+      if (!filter_ || filter_->matches(*this)) {
+	updateRowKey();
+	return true;
+      }
+    }
+    return false;
+  }
+
+  std::string_view getText(int column_index) override {
+    return file_->getValue(*chunk_, column_index, row_ - chunk_->first_row);
+  }
+
+  bool isNull(int column_index) const override {
+    return file_->isNull(*chunk_, column_index, row_ - chunk_->first_row);
+  }
+
+  std::vector<uint8_t> getBlob(int column_index) override {
+    auto v = getText(column_index);
+    return std::vector<uint8_t>(v.begin(), v.end());
+  }
+
+  double getDouble(int column_index, double default_value = 0.0) override {
+    auto s = getText(column_index);
+    if (!s.empty()) {
+      double d;
+      auto [ ptr, ec ] = std::from_chars(s.data(), s.data() + s.size(), d);
+      if (ec == std::errc()) return d;
+    }
+    return default_value;
+  }
+
+  float getFloat(int column_index, float default_value = 0.0f) override {
+    auto s = getText(column_index);
+    if (!s.empty()) {
+      float f;
+      auto [ ptr, ec ] = std::from_chars(s.data(), s.data() + s.size(), f);
+      if (ec == std::errc()) return f;
+    }
+    return default_value;
+  }
+
+  int getInt(int column_index, int default_value = 0) override {
+    auto s = getText(column_index);
+    if (!s.empty()) {
+      int i;
+      auto [ ptr, ec ] = std::from_chars(s.data(), s.data() + s.size(), i);
+      if (ec == std::errc()) return i;
+    }
+    return default_value;
+  }
+
+  long long getLongLong(int column_index, long long default_value = 0) override {
+    auto s = getText(column_index);
+    if (!s.empty()) {
+      long long ll;
+      auto [ ptr, ec ] = std::from_chars(s.data(), s.data() + s.size(), ll);
+      if (ec == std::errc()) return ll;
+    }
+    return default_value;
+  }
+
+  Key getKey(int column_index) override {
+    auto s = getText(column_index);
+    auto type = getColumnType(column_index);
+    Key key;
+    long long ll = 0;
+    if (type == ColumnType::ANY) {
+      auto [ ptr, ec ] = std::from_chars(s.data(), s.data() + s.size(), ll);
+      if (ec == std::errc()) key.addComponent(ll);
+      else key.addComponent(s);
+    } else if (is_numeric(type)) {
+      std::from_chars(s.data(), s.data() + s.size(), ll);
+      key.addComponent(ll);
+    } else {
+      key.addComponent(s);
+    }
+    return key;
+  }
+
+  int getNumFields() const override { return file_->getNumFields(); }
+
+  const std::string & getColumnName(int column_index) override {
+    return file_->getColumnName(column_index);
+  }
+
+  ColumnType getColumnType(int column_index) const override {
+    return file_->getColumnType(column_index);
+  }
+
+  void set(int column_idx, std::string_view value, bool is_defined = true) override {
+    throw std::runtime_error("Snapshot is read-only");
+  }
+  void set(int column_idx, int value, bool is_defined = true) override {
+    throw std::runtime_error("Snapshot is read-only");
+  }
+  void set(int column_idx, long long value, bool is_defined = true) override {
+    throw std::runtime_error("Snapshot is read-only");
+  }
+  void set(int column_idx, double value, bool is_defined = true) override {
+    throw std::runtime_error("Snapshot is read-only");
+  }
+  void set(int column_idx, const void * data, size_t len, bool is_defined = true) override {
+    throw std::runtime_error("Snapshot is read-only");
+  }
+  size_t execute() override {
+    throw std::runtime_error("Snapshot is read-only");
+  }
+  size_t update(const Key & key) override {
+    throw std::runtime_error("Snapshot is read-only");
+  }
+
+  long long getLastInsertId() const override { return 0; }
+
+private:
+  void updateRowKey() {
+    setRowKey(file_->getKey(*chunk_, row_ - chunk_->first_row));
+  }
+
+  std::shared_ptr<const SnapshotFile> file_;
+  size_t row_, end_row_;
+  std::shared_ptr<const RowFilter> filter_;
+  const SnapshotFile::Chunk * chunk_ = nullptr;
+  size_t chunk_index_ = 0;
+  bool is_valid_;
+};
+
+// Returns a cursor over the rows [row, end_row), or null if none match
+static std::unique_ptr<Cursor> make_cursor(const std::shared_ptr<const SnapshotFile> & file, size_t row, size_t end_row, std::shared_ptr<const RowFilter> filter) {
+  auto cursor = make_unique<SnapshotCursor>(file, row, end_row, std::move(filter));
+  if (cursor->isValid()) return cursor;
+  else return std::unique_ptr<Cursor>(nullptr);
+}
+
+MemorySnapshot::MemorySnapshot(std::string filename)
+  : file_(make_shared<SnapshotFile>(std::move(filename)))
+{
+  setKeyType(file_->getKeyType());
+}
+
+void
+MemorySnapshot::write(Table & table, const std::string & filename, int sheet) {
+  auto tmp = filename + ".tmp";
+  try {
+    SnapshotWriter writer(tmp, table, sheet);
+    if (auto cursor = table.seekBegin(sheet)) {
+      do {
+	writer.add(*cursor);
+      } while (cursor->next());
+    }
+    writer.finish();
+  } catch (...) {
+    ::unlink(tmp.c_str());
+    throw;
+  }
+  if (rename(tmp.c_str(), filename.c_str()) != 0) {
+    ::unlink(tmp.c_str());
+    throw std::runtime_error("Failed to rename snapshot file");
+  }
+}
+
+int
+MemorySnapshot::getNumFields(int sheet) const {
+  return file_->getNumFields();
+}
+
+const std::string &
+MemorySnapshot::getColumnName(int column_index, int sheet) const {
+  return file_->getColumnName(column_index);
+}
+
+ColumnType
+MemorySnapshot::getColumnType(int column_index, int sheet) const {
+  return file_->getColumnType(column_index);
+}
+
+bool
+MemorySnapshot::isColumnUnique(int column_index, int sheet) const {
+  return file_->isColumnUnique(column_index);
+}
+
+int
+MemorySnapshot::getColumnDecimals(int column_index) const {
+  return file_->getColumnDecimals(column_index);
+}
+
+size_t
+MemorySnapshot::getNumRows() const {
+  return file_->getNumRows();
+}
+
+unique_ptr<Cursor>
+MemorySnapshot::seekBegin(int sheet) {
+  return make_cursor(file_, 0, file_->getNumRows(), getRowFilter());
+}
+
+unique_ptr<Cursor>
+MemorySnapshot::seek(const Key & key) {
+  size_t row = file_->findRow(key);
+  return make_cursor(file_, row, file_->getNumRows(), nullptr);
+}
+
+unique_ptr<Cursor>
+MemorySnapshot::seek(int row, int sheet) {
+  if (row < 0) return unique_ptr<Cursor>(nullptr);
+  return make_cursor(file_, static_cast<size_t>(row), file_->getNumRows(), nullptr);
+}
+
+unique_ptr<Cursor>
+MemorySnapshot::seekRange(const Key & lo, const Key & hi, int sheet) {
+  if (!file_->isSorted()) return Table::seekRange(lo, hi, sheet);
+  size_t begin = lo.empty() ? 0 : file_->lowerBound(lo);
+  size_t end = hi.empty() ? file_->getNumRows() : file_->lowerBound(hi);
+  return make_cursor(file_, begin, end, getRowFilter());
+}
+
+std::vector<std::unique_ptr<Cursor>>
+MemorySnapshot::seekPartitions(int num_partitions, int sheet) {
+  // the mapping is read-only, so cursors can share it between threads
+  std::vector<std::unique_ptr<Cursor>> r;
+  size_t num_rows = file_->getNumRows();
+  size_t n = std::min(num_rows, static_cast<size_t>(std::max(num_partitions, 1)));
+  for (size_t i = 0; i < n; i++) {
+    if (auto cursor = make_cursor(file_, num_rows * i / n, num_rows * (i + 1) / n, getRowFilter())) {
+      r.push_back(std::move(cursor));
+    }
+  }
+  return r;
+}
@@ -1,88 +1,631 @@
 #include <MemoryTable.h>
+#include <MemorySnapshot.h>
 #include <Cursor.h>
 
 #include <map>
+#include <set>
+#include <deque>
 #include <unordered_map>
+#include <algorithm>
+#include <stdexcept>
 #include <cassert>
 #include <mutex>
+#include <shared_mutex>
 #include <charconv>
+#include <cstdint>
+#include <thread>
+#include <atomic>
+
+#include "BinaryFormat.h"
+#include "WriteAheadLog.h"
 
 using namespace std;
 using namespace sqldb;
 
+// Maximum number of rows in a page, which is copied when a table changes a
+// page that it shares with its copies
+#define MEMORY_PAGE_SIZE 256
+
+// Number of the latest changed row keys that are kept for getChangedRows()
+#define MEMORY_CHANGED_ROWS_SIZE 16384
+
+// Log records start with one of these, followed by the arguments
+#define MEMORY_LOG_PUT 'P'            // key, values
+#define MEMORY_LOG_REMOVE 'R'         // key
+#define MEMORY_LOG_CLEAR 'C'
+#define MEMORY_LOG_ADD_COLUMN 'A'     // column, type, unique, decimals, name
+#define MEMORY_LOG_ADD_INDEX 'I'      // column, ordered, unique
+#define MEMORY_LOG_AUTO_INCREMENT 'N' // value
+
+// Number of open batches of the thread for each log. The changes in a
+// batch are synced when it ends instead of one at a time.
+static thread_local std::unordered_map<const WriteAheadLog *, int> log_batches;
+
 namespace sqldb {
   class MemoryTableCursor;
 };
 
+// Converts a stored value to a Key of the column type
+static inline Key make_key(std::string_view s, ColumnType type) {
+  if (type == ColumnType::ANY) {
+    long long ll;
+    auto [ ptr, ec ] = std::from_chars(s.data(), s.data() + s.size(), ll);
+    return ec == std::errc() ? Key(ll) : Key(s);
+  } else if (is_numeric(type)) {
+    long long ll = 0;
+    std::from_chars(s.data(), s.data() + s.size(), ll);
+    return Key(ll);
+  } else {
+    return Key(s);
+  }
+}
+
+// Secondary index from the values of a column to the row keys. Nulls are
+// not indexed.
+class MemoryIndex {
+public:
+  MemoryIndex(int column, ColumnType type, bool is_ordered, bool is_unique)
+    : column_(column), type_(type), is_ordered_(is_ordered), is_unique_(is_unique) { }
+
+  int getColumn() const { return column_; }
+  bool isOrdered() const { return is_ordered_; }
+  bool isUnique() const { return is_unique_; }
+
+  // Returns the indexed value of the row, or an empty key for null
+  Key getValue(const std::vector<std::string> & row) const {
+    auto idx = static_cast<size_t>(column_);
+    if (idx >= row.size() || row[idx].empty()) return Key();
+    return make_key(row[idx], type_);
+  }
+
+  void add(const Key & value, const Key & row_key) {
+    if (is_ordered_) {
+      ordered_.emplace(value, row_key);
+    } else {
+      hash_[value].push_back(row_key);
+    }
+  }
+
+  void remove(const Key & value, const Key & row_key) {
+    if (is_ordered_) {
+      ordered_.erase(std::pair(value, row_key));
+    } else {
+      auto it = hash_.find(value);
+      if (it != hash_.end()) {
+	auto & keys = it->second;
+	keys.erase(std::remove(keys.begin(), keys.end(), row_key), keys.end());
+	if (keys.empty()) hash_.erase(it);
+      }
+    }
+  }
+
+  // Returns true if a row other than row_key has the value
+  bool hasOtherRow(const Key & value, const Key & row_key) const {
+    if (is_ordered_) {
+      for (auto it = ordered_.lower_bound(std::pair(value, Key())); it != ordered_.end() && it->first == value; ++it) {
+	if (!(it->second == row_key)) return true;
+      }
+    } else {
+      auto it = hash_.find(value);
+      if (it != hash_.end()) {
+	for (auto & key : it->second) {
+	  if (!(key == row_key)) return true;
+	}
+      }
+    }
+    return false;
+  }
+
+  std::vector<Key> find(const Key & value) const {
+    std::vector<Key> r;
+    if (is_ordered_) {
+      for (auto it = ordered_.lower_bound(std::pair(value, Key())); it != ordered_.end() && it->first == value; ++it) {
+	r.push_back(it->second);
+      }
+    } else {
+      auto it = hash_.find(value);
+      if (it != hash_.end()) {
+	r = it->second;
+	std::sort(r.begin(), r.end());
+      }
+    }
+    return r;
+  }
+
+  std::vector<Key> findRange(const Key & min, const Key & max) const {
+    std::vector<Key> r;
+    auto it = min.empty() ? ordered_.begin() : ordered_.lower_bound(std::pair(min, Key()));
+    for ( ; it != ordered_.end() && (max.empty() || !(max < it->first)); ++it) {
+      r.push_back(it->second);
+    }
+    return r;
+  }
+
+  void clear() {
+    hash_.clear();
+    ordered_.clear();
+  }
+
+private:
+  int column_;
+  ColumnType type_;
+  bool is_ordered_, is_unique_;
+  robin_hood::unordered_flat_map<Key, std::vector<Key>> hash_;
+  // pairs of value and row key
+  std::set<std::pair<Key, Key>> ordered_;
+};
+
+using Row = std::vector<std::string>;
+using RowMap = std::map<Key, Row>;
+
+// Rows of a key range. Pages are shared between copies of a table and
+// copied before they are changed.
+struct MemoryPage {
+  RowMap rows;
+};
+
+// Pages keyed by the lower bound of their range. The first page starts
+// from the empty key, which is before all other keys.
+using PageMap = std::map<Key, std::shared_ptr<MemoryPage>>;
+
+struct RowPosition {
+  PageMap::iterator page;
+  RowMap::iterator row;
+};
+
 class sqldb::MemoryStorage {
 public:
   friend class sqldb::MemoryTableCursor;
   
-  MemoryStorage() { }
+  MemoryStorage() : pages_(make_shared<PageMap>()), indexes_(make_shared<std::vector<MemoryIndex>>()) {
+    pages_->emplace(Key(), make_shared<MemoryPage>());
+    changed();
+  }
+  MemoryStorage(const MemoryStorage & other) = delete;
+  ~MemoryStorage() {
+    if (checkpoint_thread_.joinable()) checkpoint_thread_.join();
+  }
+
+  MemoryStorage & operator=(const MemoryStorage & other) = delete;
+
+  // Returns a copy that shares the pages and the indexes with this one
+  // until either of them changes them
+  std::shared_ptr<MemoryStorage> copy() const;
 
   std::unique_ptr<Cursor> seek(const Key & key);
-  std::unique_ptr<Cursor> seekBegin();
+  std::unique_ptr<Cursor> seekBegin(std::shared_ptr<const RowFilter> filter);
+  std::unique_ptr<Cursor> seekRange(const Key & lo, const Key & hi, std::shared_ptr<const RowFilter> filter);
+  std::vector<std::unique_ptr<Cursor>> seekPartitions(int num_partitions, std::shared_ptr<const RowFilter> filter);
   std::unique_ptr<MemoryTableCursor> insertOrUpdate(const Key & key);
   std::unique_ptr<MemoryTableCursor> insertOrUpdate();
   std::unique_ptr<Cursor> increment(const Key & key);
   std::unique_ptr<Cursor> assign(std::vector<int> columns);
+  std::unique_ptr<Cursor> seekIndex(int column, const Key & value);
+  std::unique_ptr<Cursor> seekIndexRange(int column, const Key & min, const Key & max);
+  void addIndex(int column, bool is_ordered, bool is_unique);
+
+  // Restores the table from the log in dir, if there is one, and logs the
+  // changes from now on. Returns the key type of the log.
+  std::vector<ColumnType> openLog(const std::string & dir, std::vector<ColumnType> key_type, size_t checkpoint_size);
+  void checkpoint();
+
+  void beginBatch() {
+    if (log_) log_batches[log_.get()]++;
+  }
+
+  void endBatch() {
+    if (!log_) return;
+    auto it = log_batches.find(log_.get());
+    if (it != log_batches.end() && --(it->second) > 0) return;
+    if (it != log_batches.end()) log_batches.erase(it);
+    log_->sync();
+  }
+
+  // The changes are applied and logged as they are made, so a batch can't
+  // be undone. It's ended and made durable like a commit.
+  void rollbackBatch() {
+    if (!log_) return;
+    endBatch();
+    throw std::runtime_error("Changes to a logged table can't be rolled back");
+  }
+
+  // Waits until a logged change is on disk, unless the thread is in a batch
+  void syncLog(uint64_t record) {
+    if (record && !log_batches.count(log_.get())) log_->sync(record);
+  }
 
   void remove(const Key & key) {
-    std::lock_guard<std::mutex> guard(mutex_);
-    data_.erase(key);
+    uint64_t record = 0;
+    {
+      std::lock_guard<std::shared_mutex> guard(mutex_);
+      auto pos = find(key);
+      if (!isEnd(pos)) {
+	updateIndexes(key, &(pos.row->second), nullptr);
+	eraseRow(key);
+	record = logRemove(key);
+      }
+    }
+    syncLog(record);
   }
 
   void addColumn(std::string_view name, sqldb::ColumnType type, bool unique, int decimals) {
-    std::lock_guard<std::mutex> guard(mutex_);
-    header_row_.push_back(std::tuple(type, std::string(name), unique, decimals));
+    uint64_t record;
+    {
+      std::lock_guard<std::shared_mutex> guard(mutex_);
+      int column = static_cast<int>(header_row_.size());
+      addColumnLocked(name, type, unique, decimals);
+      record = logColumn(column);
+    }
+    syncLog(record);
   }
   
   int getNumFields() const {
-    std::lock_guard<std::mutex> guard(mutex_);
+    std::shared_lock<std::shared_mutex> guard(mutex_);
     return static_cast<int>(header_row_.size());
   }
   int getNumRows() const {
-    std::lock_guard<std::mutex> guard(mutex_);
-    return static_cast<int>(data_.size());
+    std::shared_lock<std::shared_mutex> guard(mutex_);
+    return static_cast<int>(num_rows_);
   }
 
   ColumnType getColumnType(int column_index) const {
-    std::lock_guard<std::mutex> guard(mutex_);
+    std::shared_lock<std::shared_mutex> guard(mutex_);
     auto idx = static_cast<size_t>(column_index);
     return idx < header_row_.size() ? std::get<0>(header_row_[idx]) : ColumnType::ANY;
   }
 
   const std::string & getColumnName(int column_index) const {
-    std::lock_guard<std::mutex> guard(mutex_);
+    std::shared_lock<std::shared_mutex> guard(mutex_);
     auto idx = static_cast<size_t>(column_index);
     return idx < header_row_.size() ? std::get<1>(header_row_[idx]) : null_string;
   }
 
   bool isColumnUnique(int column_index) const {
-    std::lock_guard<std::mutex> guard(mutex_);
+    std::shared_lock<std::shared_mutex> guard(mutex_);
     auto idx = static_cast<size_t>(column_index);
     return idx < header_row_.size() ? std::get<2>(header_row_[idx]) : false;
   }
 
   int getColumnDecimals(int column_index) const {
-    std::lock_guard<std::mutex> guard(mutex_);
+    std::shared_lock<std::shared_mutex> guard(mutex_);
     auto idx = static_cast<size_t>(column_index);
     return idx < header_row_.size() ? std::get<3>(header_row_[idx]) : false;
   }
 
   void clear() {
-    std::lock_guard<std::mutex> guard(mutex_);
-    data_.clear();    
+    uint64_t record;
+    {
+      std::lock_guard<std::shared_mutex> guard(mutex_);
+      clearLocked();
+      record = logClear();
+    }
+    syncLog(record);
   }
 
-  size_t size() const { return data_.size(); }
+  size_t size() const { return num_rows_; }
+
+  uint64_t getRowVersion() const {
+    std::shared_lock<std::shared_mutex> guard(mutex_);
+    return row_version_;
+  }
+
+  // Adds the keys of the rows changed after the version, and returns false
+  // if the version isn't one of the kept versions of this storage
+  bool getChangedRows(uint64_t version, std::vector<Key> & keys) const {
+    std::shared_lock<std::shared_mutex> guard(mutex_);
+    auto it = std::lower_bound(changed_rows_.begin(), changed_rows_.end(), version, [](const std::pair<uint64_t, Key> & a, uint64_t v) { return a.first < v; });
+    if (version == changed_rows_start_) {
+      it = changed_rows_.begin();
+    } else if (it != changed_rows_.end() && it->first == version) {
+      ++it;
+    } else {
+      return false;
+    }
+    for ( ; it != changed_rows_.end(); ++it) keys.push_back(it->second);
+    return true;
+  }
 
 private:
-  // use ordered map for iterator stability
-  std::map<Key, std::vector<std::string> > data_;
+  // The positions are valid until version_ changes. The caller must hold
+  // the lock for all of the following.
+
+  std::shared_ptr<MemoryStorage> copyLocked() const;
+  void addColumnLocked(std::string_view name, sqldb::ColumnType type, bool unique, int decimals);
+  void addIndexLocked(int column, bool is_ordered, bool is_unique);
+  
+  void clearLocked() {
+    pages_ = make_shared<PageMap>();
+    pages_->emplace(Key(), make_shared<MemoryPage>());
+    num_rows_ = 0;
+    version_++;
+    changed();
+    if (!indexes_->empty()) {
+      for (auto & index : getMutableIndexes()) index.clear();
+    }
+  }
+
+  // Replaces the row, or inserts it
+  void putRow(const Key & key, Row row) {
+    auto pos = find(key);
+    updateIndexes(key, isEnd(pos) ? nullptr : &(pos.row->second), &row);
+    getMutableRow(key).row->second = std::move(row);
+  }
+
+  // The log functions append a change to the log, if there is one, and
+  // return the record number (or 0)
+  uint64_t logPut(const Key & key, const Row & row) {
+    if (!log_) return 0;
+    log_record_.assign(1, MEMORY_LOG_PUT);
+    append_key(log_record_, key);
+    append_u32(log_record_, static_cast<uint32_t>(row.size()));
+    for (auto & v : row) append_string(log_record_, v);
+    return logRecord();
+  }
+
+  uint64_t logRemove(const Key & key) {
+    if (!log_) return 0;
+    log_record_.assign(1, MEMORY_LOG_REMOVE);
+    append_key(log_record_, key);
+    return logRecord();
+  }
+
+  uint64_t logClear() {
+    if (!log_) return 0;
+    log_record_.assign(1, MEMORY_LOG_CLEAR);
+    return logRecord();
+  }
+
+  uint64_t logColumn(int column) {
+    if (!log_) return 0;
+    auto & [ type, name, unique, decimals ] = header_row_[column];
+    log_record_.assign(1, MEMORY_LOG_ADD_COLUMN);
+    append_u32(log_record_, static_cast<uint32_t>(column));
+    append_u32(log_record_, static_cast<uint32_t>(type));
+    log_record_ += unique ? '\1' : '\0';
+    append_u32(log_record_, static_cast<uint32_t>(decimals));
+    append_string(log_record_, name);
+    return logRecord();
+  }
+
+  uint64_t logIndex(const MemoryIndex & index) {
+    if (!log_) return 0;
+    encodeIndex(index);
+    return logRecord();
+  }
+
+  uint64_t logAutoIncrement() {
+    if (!log_) return 0;
+    encodeAutoIncrement();
+    return logRecord();
+  }
+
+  void encodeIndex(const MemoryIndex & index) {
+    log_record_.assign(1, MEMORY_LOG_ADD_INDEX);
+    append_u32(log_record_, static_cast<uint32_t>(index.getColumn()));
+    log_record_ += index.isOrdered() ? '\1' : '\0';
+    log_record_ += index.isUnique() ? '\1' : '\0';
+  }
+
+  void encodeAutoIncrement() {
+    log_record_.assign(1, MEMORY_LOG_AUTO_INCREMENT);
+    append_u64(log_record_, static_cast<uint64_t>(auto_increment_));
+  }
+
+  // Appends log_record_ and starts a checkpoint if the log has grown enough
+  uint64_t logRecord() {
+    auto record = log_->append(log_record_);
+    if (log_->getSegmentSize() >= checkpoint_size_ && !is_checkpointing_) {
+      if (checkpoint_thread_.joinable()) checkpoint_thread_.join();
+      auto [ n, snapshot ] = startCheckpoint();
+      is_checkpointing_ = true;
+      checkpoint_thread_ = std::thread([this, n = n, snapshot = snapshot]() {
+	// a checkpoint that fails is retried when the new segment is full
+	try {
+	  writeSnapshot(n, snapshot);
+	} catch (...) { }
+	is_checkpointing_ = false;
+      });
+    }
+    return record;
+  }
+
+  // Starts a new log segment and returns its number and a copy of the
+  // table at its start
+  std::pair<uint64_t, std::shared_ptr<MemoryStorage>> startCheckpoint();
+  void writeSnapshot(uint64_t n, std::shared_ptr<MemoryStorage> snapshot);
+  void restoreColumn(int column, sqldb::ColumnType type, std::string_view name, bool unique, int decimals);
+  void applyLogRecord(std::string_view record);
+
+  bool isEnd(const RowPosition & pos) const { return pos.page == pages_->end(); }
+  RowPosition end() const { return RowPosition{ pages_->end(), RowMap::iterator() }; }
+
+  // Moves to the next row if pos is at the end of a page
+  RowPosition skipEmpty(RowPosition pos) const {
+    while (pos.page != pages_->end() && pos.row == pos.page->second->rows.end()) {
+      if (++pos.page != pages_->end()) pos.row = pos.page->second->rows.begin();
+    }
+    return pos;
+  }
+
+  RowPosition begin() const {
+    auto page = pages_->begin();
+    return skipEmpty(RowPosition{ page, page->second->rows.begin() });
+  }
+
+  RowPosition advance(RowPosition pos) const {
+    ++pos.row;
+    return skipEmpty(pos);
+  }
+
+  PageMap::iterator findPage(const Key & key) const {
+    return std::prev(pages_->upper_bound(key));
+  }
+
+  RowPosition find(const Key & key) const {
+    auto page = findPage(key);
+    auto row = page->second->rows.find(key);
+    return row != page->second->rows.end() ? RowPosition{ page, row } : end();
+  }
+
+  RowPosition lowerBound(const Key & key) const {
+    auto page = findPage(key);
+    return skipEmpty(RowPosition{ page, page->second->rows.lower_bound(key) });
+  }
+
+  // Returns the page of the key after copying it and the page map if they
+  // are shared with another table
+  PageMap::iterator getMutablePage(const Key & key) {
+    if (pages_.use_count() > 1) {
+      pages_ = make_shared<PageMap>(*pages_);
+      version_++;
+    }
+    auto page = findPage(key);
+    if (page->second.use_count() > 1) {
+      page->second = make_shared<MemoryPage>(*(page->second));
+      version_++;
+    }
+    // use_count() doesn't synchronize with copies released in other threads
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return page;
+  }
+
+  // Returns the position of the row for writing, and inserts an empty row
+  // if it's missing
+  RowPosition getMutableRow(const Key & key) {
+    auto page = getMutablePage(key);
+    auto & rows = page->second->rows;
+    auto [ it, is_new ] = rows.try_emplace(key);
+    changedRow(key);
+    if (is_new) {
+      num_rows_++;
+      if (rows.size() > MEMORY_PAGE_SIZE) {
+	splitPage(page);
+	return find(key);
+      }
+    }
+    return RowPosition{ page, it };
+  }
+
+  // Moves the upper half of the rows to a new page
+  void splitPage(PageMap::iterator page) {
+    auto & rows = page->second->rows;
+    auto it = std::next(rows.begin(), rows.size() / 2);
+    auto upper = make_shared<MemoryPage>();
+    Key lower_bound = it->first;
+    while (it != rows.end()) {
+      auto next = std::next(it);
+      upper->rows.insert(upper->rows.end(), rows.extract(it));
+      it = next;
+    }
+    pages_->emplace(std::move(lower_bound), std::move(upper));
+    version_++;
+  }
+
+  void eraseRow(const Key & key) {
+    auto page = getMutablePage(key);
+    if (page->second->rows.erase(key)) {
+      num_rows_--;
+      version_++;
+      changedRow(key);
+      if (page->second->rows.empty() && page != pages_->begin()) pages_->erase(page);
+    }
+  }
+
+  // Every storage and every change gets a new row version, so a table has
+  // the same version only if its rows are unchanged. changed() is for
+  // changes of all the rows, which drop the changed rows that were kept.
+  static uint64_t nextRowVersion() {
+    static std::atomic<uint64_t> last_row_version{ 0 };
+    return ++last_row_version;
+  }
+
+  void changed() {
+    row_version_ = changed_rows_start_ = nextRowVersion();
+    changed_rows_.clear();
+  }
+
+  void changedRow(const Key & key) {
+    row_version_ = nextRowVersion();
+    if (changed_rows_.size() == MEMORY_CHANGED_ROWS_SIZE) {
+      changed_rows_start_ = changed_rows_.front().first;
+      changed_rows_.pop_front();
+    }
+    changed_rows_.emplace_back(row_version_, key);
+  }
+
+  std::vector<MemoryIndex> & getMutableIndexes() {
+    if (indexes_.use_count() > 1) indexes_ = make_shared<std::vector<MemoryIndex>>(*indexes_);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return *indexes_;
+  }
+
+  // Returns the first row in [pos, end_key) that matches the filter
+  RowPosition findMatch(RowPosition pos, const Key & end_key, const RowFilter & filter) const {
+    for ( ; !isEnd(pos) && (end_key.empty() || pos.row->first < end_key); pos = advance(pos)) {
+      auto & row = pos.row->second;
+      bool is_match = filter.matchesKeys([&](int col) {
+	auto idx = static_cast<size_t>(col);
+	auto type = idx < header_row_.size() ? std::get<0>(header_row_[idx]) : ColumnType::ANY;
+	return make_key(idx < row.size() ? std::string_view(row[idx]) : std::string_view(), type);
+      });
+      if (is_match) return pos;
+    }
+    return end();
+  }
+
+  // Moves the row from old_row to new_row in the indexes, where a null row
+  // is a missing one. Throws if a unique index already has a new value, in
+  // which case no index is changed.
+  void updateIndexes(const Key & row_key, const Row * old_row, const Row * new_row) {
+    if (indexes_->empty()) return;
+    if (new_row) {
+      for (auto & index : *indexes_) {
+	if (!index.isUnique()) continue;
+	auto value = index.getValue(*new_row);
+	if (!value.empty() && index.hasOtherRow(value, row_key)) {
+	  throw std::runtime_error("Duplicate value in unique column " + std::get<1>(header_row_[index.getColumn()]));
+	}
+      }
+    }
+    for (auto & index : getMutableIndexes()) {
+      auto old_value = old_row ? index.getValue(*old_row) : Key();
+      auto new_value = new_row ? index.getValue(*new_row) : Key();
+      if (old_value == new_value) continue;
+      if (!old_value.empty()) index.remove(old_value, row_key);
+      if (!new_value.empty()) index.add(new_value, row_key);
+    }
+  }
+
+  // Returns the index of the column, or null
+  const MemoryIndex * findIndex(int column, bool is_ordered) const {
+    for (auto & index : *indexes_) {
+      if (index.getColumn() == column && (index.isOrdered() || !is_ordered)) return &index;
+    }
+    return nullptr;
+  }
+
+  std::shared_ptr<PageMap> pages_;
+  size_t num_rows_ = 0;
+  // incremented when positions are invalidated
+  uint64_t version_ = 0;
+  uint64_t row_version_ = 0;
+  // the latest changed rows with their versions, and the version before them
+  std::deque<std::pair<uint64_t, Key>> changed_rows_;
+  uint64_t changed_rows_start_ = 0;
+  std::shared_ptr<std::vector<MemoryIndex>> indexes_;
   std::vector<std::tuple<ColumnType, std::string, bool, int> > header_row_;
   long long auto_increment_ = 0;
-  mutable std::mutex mutex_;
+
+  // the log, which isn't shared with copies
+  std::shared_ptr<WriteAheadLog> log_;
+  std::vector<ColumnType> log_key_type_;
+  size_t checkpoint_size_ = 0;
+  std::string log_record_;
+  std::thread checkpoint_thread_;
+  std::atomic<bool> is_checkpointing_{ false };
+
+  // cursors that only read take a shared lock, so that scans can run in parallel
+  mutable std::shared_mutex mutex_;
 
   static inline std::string null_string;
 };
@@ -90,10 +633,16 @@ private:
 class sqldb::MemoryTableCursor : public Cursor {
 public:
   MemoryTableCursor(MemoryStorage * storage,
-		    std::map<Key, std::vector<std::string> >::iterator it,
-		    bool is_increment_op = false)
-    : storage_(storage), header_row_(storage->header_row_), it_(it), is_increment_op_(is_increment_op) {
-    updateRowKey();
+		    RowPosition pos,
+		    Key end_key = Key(),
+		    std::shared_ptr<const RowFilter> filter = nullptr)
+    : storage_(storage), header_row_(storage->header_row_), end_key_(std::move(end_key)), filter_(std::move(filter)), is_increment_op_(false) {
+    setPosition(pos);
+  }
+  MemoryTableCursor(MemoryStorage * storage,
+		    std::vector<Key> keys)
+    : storage_(storage), header_row_(storage->header_row_), keys_(std::move(keys)), is_increment_op_(false) {
+    setPosition(storage->find(keys_.front()));
   }
   MemoryTableCursor(MemoryStorage * storage,
 		    Key pending_key,
@@ -105,60 +654,57 @@ public:
     : storage_(storage), header_row_(storage->header_row_), selected_columns_(std::move(selected_columns)), is_increment_op_(false) { }
 
   size_t execute() override {    
-    std::lock_guard<std::mutex> guard(storage_->mutex_);
-    auto & data = storage_->data_;
-    if (!pending_key_.empty()) {
-      auto [ it, is_new ] = data.emplace(std::move(pending_key_), std::vector<std::string>());
-      it_ = std::move(it);
-      pending_key_.clear();
-    }
-    if (it_ != data.end()) {
-      auto & v = it_->second;
-      if (is_increment_op_) {
-	for (auto [ key, value ] : pending_row_) {
-	  if (v.size() <= static_cast<size_t>(key)) v.resize(static_cast<size_t>(key) + 1);
-	  auto & v0 = v[key];
-	  if (v0.empty()) {
-	    v0 = value;
-	  } else if (is_numeric(getColumnType(key))) {
-	    v0 = std::to_string(stoi(v0) + stoi(value));
-	  }
-	}      
+    uint64_t record;
+    {
+      std::lock_guard<std::shared_mutex> guard(storage_->mutex_);
+      if (pending_key_.empty() && !getCurrentRow()) return 0;
+      const Key & key = pending_key_.empty() ? getRowKey() : pending_key_;
+      RowPosition pos;
+      if (!storage_->indexes_->empty()) {
+	// the indexes are checked before the row is changed
+	auto old_pos = storage_->find(key);
+	const Row * old_row = storage_->isEnd(old_pos) ? nullptr : &(old_pos.row->second);
+	Row row;
+	if (old_row) row = *old_row;
+	applyPending(row);
+	storage_->updateIndexes(key, old_row, &row);
+	pos = storage_->getMutableRow(key);
+	pos.row->second = std::move(row);
       } else {
-	for (auto [ key, value ] : pending_row_) {
-	  if (v.size() <= static_cast<size_t>(key)) v.resize(static_cast<size_t>(key) + 1);
-	  v[key] = value;
-	}
+	pos = storage_->getMutableRow(key);
+	applyPending(pos.row->second);
       }
+      record = storage_->logPut(pos.row->first, pos.row->second);
+      setPosition(pos);
+      pending_key_.clear();
       pending_row_.clear();
-      return 1;
-    } else {
-      return 0;
     }
+    // the lock isn't held while waiting for the log
+    storage_->syncLog(record);
+    return 1;
   }
 
   size_t update(const Key & key) override {
-    std::lock_guard<std::mutex> guard(storage_->mutex_);
-    auto & data = storage_->data_;
-    auto it = data.find(key);
-    if (it != data.end()) {
-      auto & v = it->second;
-
-      for (size_t i = 0; i < selected_columns_.size(); i++) {
-	auto col = static_cast<size_t>(selected_columns_[i]);
-	auto it = pending_row_.find(static_cast<int>(i));
-	if (it != pending_row_.end()) {
-	  if (col >= v.size()) v.resize(col + 1);
-	  v[col] = it->second;
-	} else if (col < v.size()) {
-	  v[col].clear();
-	}
+    uint64_t record;
+    {
+      std::lock_guard<std::shared_mutex> guard(storage_->mutex_);
+      auto pos = storage_->find(key);
+      if (storage_->isEnd(pos)) return 0;
+      if (!storage_->indexes_->empty()) {
+	auto row = pos.row->second;
+	applyAssign(row);
+	storage_->updateIndexes(key, &(pos.row->second), &row);
+	pos = storage_->getMutableRow(key);
+	pos.row->second = std::move(row);
+      } else {
+	pos = storage_->getMutableRow(key);
+	applyAssign(pos.row->second);
       }
+      record = storage_->logPut(key, pos.row->second);
       pending_row_.clear();
-      return 1;
-    } else {
-      return 0;
     }
+    storage_->syncLog(record);
+    return 1;
   }
     
   void set(int column_idx, string_view value, bool is_defined = true) override {
@@ -175,39 +721,58 @@ public:
   void set(int column_idx, const void * data, size_t len, bool is_defined = true) override { set(column_idx, std::string_view(reinterpret_cast<const char *>(data), len), is_defined); }
 
   bool next() override {
-    std::lock_guard<std::mutex> guard(storage_->mutex_);
+    std::shared_lock<std::shared_mutex> guard(storage_->mutex_);
 
-    auto & data = storage_->data_;
-    if (it_ != data.end() && ++it_ != data.end()) {
-      updateRowKey();
-      return true;
-    } else {
+    if (is_end_ || getRowKey().empty()) {
       return false;
+    } else if (!keys_.empty()) {
+      while (++key_pos_ < keys_.size()) {
+	auto pos = storage_->find(keys_[key_pos_]);
+	if (!storage_->isEnd(pos)) {
+	  setPosition(pos);
+	  return true;
+	}
+      }
+      is_end_ = true;
+      return false;
+    }
+
+    sync();
+    // if the row was removed, the position is already at the next row
+    auto pos = is_current_ ? storage_->advance(pos_) : pos_;
+    if (filter_) {
+      pos = storage_->findMatch(pos, end_key_, *filter_);
+    } else if (!storage_->isEnd(pos) && !end_key_.empty() && !(pos.row->first < end_key_)) {
+      pos = storage_->end();
     }
+    if (storage_->isEnd(pos)) {
+      is_end_ = true;
+      return false;
+    }
+    setPosition(pos);
+    return true;
   }
 
   std::string_view getText(int column_index) override {
-    std::lock_guard<std::mutex> guard(storage_->mutex_);
+    std::shared_lock<std::shared_mutex> guard(storage_->mutex_);
 
-    auto & data = storage_->data_;
-    if (column_index >= 0 && it_ != data.end()) {
+    auto row = getCurrentRow();
+    if (column_index >= 0 && row) {
       auto idx = static_cast<size_t>(column_index);
-      auto & row = it_->second;
-      if (idx < row.size()) return row[idx];
+      if (idx < row->size()) return (*row)[idx];
     }
     return null_string;    
   }
     
   std::vector<uint8_t> getBlob(int column_index) override {
-    std::lock_guard<std::mutex> guard(storage_->mutex_);
+    std::shared_lock<std::shared_mutex> guard(storage_->mutex_);
 
-    auto & data = storage_->data_;
     std::vector<uint8_t> r;
-    if (column_index >= 0 && it_ != data.end()) {
+    auto row = getCurrentRow();
+    if (column_index >= 0 && row) {
       auto idx = static_cast<size_t>(column_index);
-      auto & row = it_->second;
-      if (idx < row.size()) {
-	auto & v = row[idx];
+      if (idx < row->size()) {
+	auto & v = (*row)[idx];
 	r.reserve(v.size());
 	for (size_t i = 0; i < v.size(); i++) r.push_back(static_cast<uint8_t>(v[i]));
       }
@@ -230,13 +795,12 @@ public:
   }
     
   bool isNull(int column_index) const override {
-    std::lock_guard<std::mutex> guard(storage_->mutex_);
+    std::shared_lock<std::shared_mutex> guard(storage_->mutex_);
 
-    auto & data = storage_->data_;
-    if (column_index >= 0 && it_ != data.end()) {
+    auto row = getCurrentRow();
+    if (column_index >= 0 && row) {
       auto idx = static_cast<size_t>(column_index);
-      auto & row = it_->second;
-      if (idx < row.size()) return row[idx].empty();
+      if (idx < row->size()) return (*row)[idx].empty();
     }
     return true;
   }
@@ -288,28 +852,80 @@ public:
   }
 
   Key getKey(int column_index) override {
-    auto type = getColumnType(column_index);
-    if (type == ColumnType::ANY) {
-      auto s = getText(column_index);
-      long long ll;
-      auto [ ptr, ec ] = std::from_chars(s.data(), s.data() + s.size(), ll);
-      return ec == std::errc() ? Key(ll) : Key(s);
-    } else if (is_numeric(type)) {
-      return Key(getLongLong(column_index));
+    return make_key(getText(column_index), getColumnType(column_index));
+  }
+
+protected:
+  void setPosition(RowPosition pos) {
+    pos_ = pos;
+    version_ = storage_->version_;
+    is_current_ = !storage_->isEnd(pos);
+    if (is_current_) setRowKey(pos.row->first);
+  }
+
+  // Finds the current row again if the positions have changed. The caller
+  // must hold the lock.
+  void sync() const {
+    if (version_ != storage_->version_) {
+      pos_ = storage_->lowerBound(getRowKey());
+      version_ = storage_->version_;
+      is_current_ = !storage_->isEnd(pos_) && pos_.row->first == getRowKey();
+    }
+  }
+
+  // Returns the current row, or null if there is none. The caller must
+  // hold the lock.
+  const Row * getCurrentRow() const {
+    if (is_end_ || getRowKey().empty()) return nullptr;
+    sync();
+    return is_current_ ? &(pos_.row->second) : nullptr;
+  }
+
+  void applyPending(Row & v) {
+    if (is_increment_op_) {
+      for (auto [ key, value ] : pending_row_) {
+	if (v.size() <= static_cast<size_t>(key)) v.resize(static_cast<size_t>(key) + 1);
+	auto & v0 = v[key];
+	if (v0.empty()) {
+	  v0 = value;
+	} else if (is_numeric(getColumnType(key))) {
+	  v0 = std::to_string(stoi(v0) + stoi(value));
+	}
+      }      
     } else {
-      return Key(getText(column_index));
+      for (auto [ key, value ] : pending_row_) {
+	if (v.size() <= static_cast<size_t>(key)) v.resize(static_cast<size_t>(key) + 1);
+	v[key] = value;
+      }
     }
   }
 
-protected:
-  void updateRowKey() {
-    setRowKey(it_->first);
+  void applyAssign(Row & v) {
+    for (size_t i = 0; i < selected_columns_.size(); i++) {
+      auto col = static_cast<size_t>(selected_columns_[i]);
+      auto it = pending_row_.find(static_cast<int>(i));
+      if (it != pending_row_.end()) {
+	if (col >= v.size()) v.resize(col + 1);
+	v[col] = it->second;
+      } else if (col < v.size()) {
+	v[col].clear();
+      }
+    }
   }
 
 private:
   MemoryStorage* storage_;
   std::vector<std::tuple<ColumnType, std::string, bool, int> > header_row_;
-  std::map<Key, std::vector<std::string> >::iterator it_;
+  // position of the current row, which is found again by key when the
+  // storage version changes
+  mutable RowPosition pos_;
+  mutable uint64_t version_ = 0;
+  mutable bool is_current_ = false;
+  bool is_end_ = false;
+  Key end_key_; // end of the partition, or empty
+  std::shared_ptr<const RowFilter> filter_;
+  std::vector<Key> keys_; // rows of an index lookup, or empty
+  size_t key_pos_ = 0;
   Key pending_key_;
   std::unordered_map<int, std::string> pending_row_;
   std::vector<int> selected_columns_;
@@ -319,28 +935,308 @@ private:
   static inline std::string null_string;
 };
 
+std::shared_ptr<MemoryStorage>
+MemoryStorage::copy() const {
+  std::shared_lock<std::shared_mutex> guard(mutex_);
+  return copyLocked();
+}
+
+std::shared_ptr<MemoryStorage>
+MemoryStorage::copyLocked() const {
+  auto r = make_shared<MemoryStorage>();
+  r->pages_ = pages_;
+  r->num_rows_ = num_rows_;
+  r->indexes_ = indexes_;
+  r->header_row_ = header_row_;
+  r->auto_increment_ = auto_increment_;
+  return r;
+}
+
 std::unique_ptr<Cursor>
 MemoryStorage::seek(const Key & key) {
-  std::lock_guard<std::mutex> guard(mutex_);
-  auto it = data_.find(key);
-  if (it != data_.end()) {
-    return std::make_unique<MemoryTableCursor>(this, move(it));
+  std::shared_lock<std::shared_mutex> guard(mutex_);
+  auto pos = find(key);
+  if (!isEnd(pos)) {
+    return std::make_unique<MemoryTableCursor>(this, pos);
+  } else {
+    return std::unique_ptr<Cursor>(nullptr);
+  }
+}
+
+std::unique_ptr<Cursor>
+MemoryStorage::seekBegin(std::shared_ptr<const RowFilter> filter) {
+  std::shared_lock<std::shared_mutex> guard(mutex_);
+  auto pos = filter ? findMatch(begin(), Key(), *filter) : begin();
+  if (!isEnd(pos)) {
+    return std::make_unique<MemoryTableCursor>(this, pos, Key(), move(filter));
   } else {
     return std::unique_ptr<Cursor>(nullptr);
   }
 }
 
 std::unique_ptr<Cursor>
-MemoryStorage::seekBegin() {
-  std::lock_guard<std::mutex> guard(mutex_);
-  auto it = data_.begin();
-  if (it != data_.end()) {
-    return std::make_unique<MemoryTableCursor>(this, move(it));
+MemoryStorage::seekRange(const Key & lo, const Key & hi, std::shared_ptr<const RowFilter> filter) {
+  std::shared_lock<std::shared_mutex> guard(mutex_);
+  auto pos = lowerBound(lo);
+  if (filter) {
+    pos = findMatch(pos, hi, *filter);
+  } else if (!isEnd(pos) && !hi.empty() && !(pos.row->first < hi)) {
+    pos = end();
+  }
+  if (!isEnd(pos)) {
+    return std::make_unique<MemoryTableCursor>(this, pos, hi, move(filter));
   } else {
     return std::unique_ptr<Cursor>(nullptr);
   }
 }
 
+std::vector<std::unique_ptr<Cursor>>
+MemoryStorage::seekPartitions(int num_partitions, std::shared_ptr<const RowFilter> filter) {
+  std::shared_lock<std::shared_mutex> guard(mutex_);
+  std::vector<std::unique_ptr<Cursor>> r;
+  size_t n = std::min(num_rows_, static_cast<size_t>(std::max(num_partitions, 1)));
+  if (!n) return r;
+
+  // find the first row of each partition, skipping whole pages
+  std::vector<RowPosition> starts;
+  size_t pos = 0;
+  for (auto page = pages_->begin(); page != pages_->end() && starts.size() < n; ++page) {
+    auto & rows = page->second->rows;
+    while (starts.size() < n) {
+      size_t start = num_rows_ * starts.size() / n;
+      if (start >= pos + rows.size()) break;
+      starts.push_back(RowPosition{ page, std::next(rows.begin(), start - pos) });
+    }
+    pos += rows.size();
+  }
+  for (size_t i = 0; i < starts.size(); i++) {
+    Key end_key = i + 1 < starts.size() ? starts[i + 1].row->first : Key();
+    auto start = filter ? findMatch(starts[i], end_key, *filter) : starts[i];
+    if (!isEnd(start)) r.push_back(std::make_unique<MemoryTableCursor>(this, start, std::move(end_key), filter));
+  }
+  return r;
+}
+
+std::unique_ptr<Cursor>
+MemoryStorage::seekIndex(int column, const Key & value) {
+  std::shared_lock<std::shared_mutex> guard(mutex_);
+  auto index = findIndex(column, false);
+  if (!index) throw std::runtime_error("Column is not indexed");
+  auto keys = index->find(value);
+  if (keys.empty()) return std::unique_ptr<Cursor>(nullptr);
+  return std::make_unique<MemoryTableCursor>(this, std::move(keys));
+}
+
+std::unique_ptr<Cursor>
+MemoryStorage::seekIndexRange(int column, const Key & min, const Key & max) {
+  std::shared_lock<std::shared_mutex> guard(mutex_);
+  auto index = findIndex(column, true);
+  if (!index) throw std::runtime_error("Column has no ordered index");
+  auto keys = index->findRange(min, max);
+  if (keys.empty()) return std::unique_ptr<Cursor>(nullptr);
+  return std::make_unique<MemoryTableCursor>(this, std::move(keys));
+}
+
+void
+MemoryStorage::addIndex(int column, bool is_ordered, bool is_unique) {
+  uint64_t record;
+  {
+    std::lock_guard<std::shared_mutex> guard(mutex_);
+    addIndexLocked(column, is_ordered, is_unique);
+    record = logIndex(*findIndex(column, is_ordered));
+  }
+  syncLog(record);
+}
+
+void
+MemoryStorage::addIndexLocked(int column, bool is_ordered, bool is_unique) {
+  auto idx = static_cast<size_t>(column);
+  if (idx >= header_row_.size()) throw std::runtime_error("Invalid column for index");
+  // the index replaces the old index of the column, so a unique column
+  // stays unique
+  is_unique |= std::get<2>(header_row_[idx]);
+
+  MemoryIndex index(column, std::get<0>(header_row_[idx]), is_ordered, is_unique);
+  for (auto pos = begin(); !isEnd(pos); pos = advance(pos)) {
+    auto & [ key, row ] = *(pos.row);
+    auto value = index.getValue(row);
+    if (value.empty()) continue;
+    if (is_unique && index.hasOtherRow(value, key)) {
+      throw std::runtime_error("Duplicate value in unique column " + std::get<1>(header_row_[idx]));
+    }
+    index.add(value, key);
+  }
+
+  // a new index of the same column replaces the old one
+  auto & indexes = getMutableIndexes();
+  auto it = std::find_if(indexes.begin(), indexes.end(), [&](const MemoryIndex & other) { return other.getColumn() == column; });
+  if (it != indexes.end()) {
+    *it = std::move(index);
+  } else {
+    indexes.push_back(std::move(index));
+  }
+  if (is_unique) std::get<2>(header_row_[idx]) = true;
+}
+
+void
+MemoryStorage::addColumnLocked(std::string_view name, sqldb::ColumnType type, bool unique, int decimals) {
+  int column = static_cast<int>(header_row_.size());
+  header_row_.push_back(std::tuple(type, std::string(name), unique, decimals));
+  changed();
+  if (unique) addIndexLocked(column, false, true);
+}
+
+std::vector<ColumnType>
+MemoryStorage::openLog(const std::string & dir, std::vector<ColumnType> key_type, size_t checkpoint_size) {
+  auto log = make_shared<WriteAheadLog>(dir);
+  bool is_new = log->empty(), needs_snapshot;
+  {
+    std::lock_guard<std::shared_mutex> guard(mutex_);
+    if (log_) {
+      throw std::runtime_error("Table already has a log");
+    }
+    if (!is_new && num_rows_) {
+      throw std::runtime_error("Table must be empty to restore it from a log");
+    }
+
+    auto fn = log->getSnapshotFile();
+    if (!fn.empty()) {
+      MemorySnapshot snapshot(fn);
+      if (key_type.empty()) key_type = snapshot.getKeyType();
+      for (int i = 0; i < snapshot.getNumFields(); i++) {
+	restoreColumn(i, snapshot.getColumnType(i), snapshot.getColumnName(i), snapshot.isColumnUnique(i), snapshot.getColumnDecimals(i));
+      }
+      if (auto cursor = snapshot.seekBegin()) {
+	Row row(header_row_.size());
+	do {
+	  for (size_t i = 0; i < row.size(); i++) {
+	    int col = static_cast<int>(i);
+	    row[i] = cursor->isNull(col) ? std::string_view() : cursor->getText(col);
+	  }
+	  putRow(cursor->getRowKey(), row);
+	} while (cursor->next());
+      }
+    }
+    log->recover([this](std::string_view record) { applyLogRecord(record); });
+
+    log_ = std::move(log);
+    log_key_type_ = key_type;
+    checkpoint_size_ = checkpoint_size;
+    // the current contents of a new log are its first snapshot
+    needs_snapshot = is_new && (num_rows_ || !header_row_.empty());
+  }
+
+  if (needs_snapshot) checkpoint();
+  return key_type;
+}
+
+void
+MemoryStorage::checkpoint() {
+  std::pair<uint64_t, std::shared_ptr<MemoryStorage>> r;
+  {
+    std::lock_guard<std::shared_mutex> guard(mutex_);
+    if (!log_) {
+      throw std::runtime_error("Table has no log");
+    }
+    r = startCheckpoint();
+  }
+  writeSnapshot(r.first, std::move(r.second));
+}
+
+std::pair<uint64_t, std::shared_ptr<MemoryStorage>>
+MemoryStorage::startCheckpoint() {
+  auto n = log_->rotate();
+  // the snapshot has the columns but not the indexes
+  for (auto & index : *indexes_) {
+    encodeIndex(index);
+    log_->append(log_record_);
+  }
+  encodeAutoIncrement();
+  log_->append(log_record_);
+  return std::pair(n, copyLocked());
+}
+
+void
+MemoryStorage::writeSnapshot(uint64_t n, std::shared_ptr<MemoryStorage> snapshot) {
+  // the records at the start of the segment complete the snapshot
+  log_->sync();
+  {
+    MemoryTable table(log_key_type_, snapshot);
+    MemorySnapshot::write(table, log_->getSnapshotFile(n));
+  }
+  log_->removeBefore(n);
+
+  // the pages are released under the lock, so that the table doesn't
+  // change them in place before the snapshot is done with them
+  std::lock_guard<std::shared_mutex> guard(mutex_);
+  snapshot.reset();
+}
+
+void
+MemoryStorage::restoreColumn(int column, sqldb::ColumnType type, std::string_view name, bool unique, int decimals) {
+  auto idx = static_cast<size_t>(column);
+  if (idx < header_row_.size()) {
+    // the table may have been created with the columns before restoring it
+    if (std::get<0>(header_row_[idx]) != type || std::get<1>(header_row_[idx]) != name) {
+      throw std::runtime_error("Log doesn't match the columns of the table");
+    }
+  } else if (idx == header_row_.size()) {
+    addColumnLocked(name, type, unique, decimals);
+  } else {
+    throw std::runtime_error("Corrupt log record");
+  }
+}
+
+void
+MemoryStorage::applyLogRecord(std::string_view record) {
+  BinaryReader in(record.data(), record.data() + record.size(), "Corrupt log record");
+  switch (in.readU8()) {
+  case MEMORY_LOG_PUT:
+    {
+      auto key = in.readKey();
+      Row row(in.readU32());
+      for (auto & v : row) v = in.readString();
+      putRow(key, std::move(row));
+    }
+    break;
+  case MEMORY_LOG_REMOVE:
+    {
+      auto key = in.readKey();
+      auto pos = find(key);
+      if (!isEnd(pos)) {
+	updateIndexes(key, &(pos.row->second), nullptr);
+	eraseRow(key);
+      }
+    }
+    break;
+  case MEMORY_LOG_CLEAR:
+    clearLocked();
+    break;
+  case MEMORY_LOG_ADD_COLUMN:
+    {
+      int column = static_cast<int>(in.readU32());
+      auto type = static_cast<ColumnType>(in.readU32());
+      bool unique = in.readU8() != 0;
+      int decimals = static_cast<int>(in.readU32());
+      restoreColumn(column, type, in.readString(), unique, decimals);
+    }
+    break;
+  case MEMORY_LOG_ADD_INDEX:
+    {
+      int column = static_cast<int>(in.readU32());
+      bool is_ordered = in.readU8() != 0;
+      bool is_unique = in.readU8() != 0;
+      addIndexLocked(column, is_ordered, is_unique);
+    }
+    break;
+  case MEMORY_LOG_AUTO_INCREMENT:
+    auto_increment_ = std::max(auto_increment_, static_cast<long long>(in.readU64()));
+    break;
+  default:
+    throw std::runtime_error("Corrupt log record");
+  }
+}
+
 std::unique_ptr<MemoryTableCursor>
 MemoryStorage::insertOrUpdate(const Key & key) {
   assert(!key.empty());
@@ -351,8 +1247,10 @@ std::unique_ptr<MemoryTableCursor>
 MemoryStorage::insertOrUpdate() {
   long long id = 0;
   {
-    std::lock_guard<std::mutex> guard(mutex_);
+    std::lock_guard<std::shared_mutex> guard(mutex_);
     id = ++auto_increment_;
+    // synced with the row
+    logAutoIncrement();
   }
   auto cursor = insertOrUpdate(sqldb::Key(id));
   cursor->setLastInsertId(id);
@@ -377,11 +1275,33 @@ MemoryTable::MemoryTable(std::vector<ColumnType> key_type)
   : Table(std::move(key_type)), storage_(make_shared<MemoryStorage>()) {
 }
 
+MemoryTable::MemoryTable(std::vector<ColumnType> key_type, std::shared_ptr<MemoryStorage> storage)
+  : Table(std::move(key_type)), storage_(std::move(storage)) {
+}
+
+MemoryTable::MemoryTable(const MemoryTable & other)
+  : Table(other), storage_(other.storage_->copy()) {
+}
+
+MemoryTable &
+MemoryTable::operator=(const MemoryTable & other) {
+  if (this != &other) {
+    Table::operator=(other);
+    storage_ = other.storage_->copy();
+  }
+  return *this;
+}
+
 void
 MemoryTable::addColumn(std::string_view name, sqldb::ColumnType type, bool unique, int decimals) {
   storage_->addColumn(std::move(name), type, unique, decimals);
 }
 
+void
+MemoryTable::addIndex(int column, IndexType type, bool unique) {
+  storage_->addIndex(column, type == IndexType::ORDERED, unique);
+}
+
 std::unique_ptr<Cursor>
 MemoryTable::insert(const Key & key) {
   return storage_->insertOrUpdate(key);
@@ -407,9 +1327,35 @@ MemoryTable::remove(const Key & key) {
   return storage_->remove(key);
 }
 
+void
+MemoryTable::openLog(const std::string & dir, size_t checkpoint_size) {
+  auto key_type = storage_->openLog(dir, getKeyType(), checkpoint_size);
+  if (getKeyType().empty()) setKeyType(std::move(key_type));
+}
+
+void
+MemoryTable::checkpoint() {
+  storage_->checkpoint();
+}
+
+void
+MemoryTable::begin() {
+  storage_->beginBatch();
+}
+
+void
+MemoryTable::commit() {
+  storage_->endBatch();
+}
+
+void
+MemoryTable::rollback() {
+  storage_->rollbackBatch();
+}
+
 std::unique_ptr<Cursor>
 MemoryTable::seekBegin(int sheet) {
-  return storage_->seekBegin(); 
+  return storage_->seekBegin(getRowFilter());
 }
 
 std::unique_ptr<Cursor>
@@ -417,6 +1363,26 @@ MemoryTable::seek(const Key & key) {
   return storage_->seek(key);
 }
 
+std::unique_ptr<Cursor>
+MemoryTable::seekRange(const Key & lo, const Key & hi, int sheet) {
+  return storage_->seekRange(lo, hi, getRowFilter());
+}
+
+std::vector<std::unique_ptr<Cursor>>
+MemoryTable::seekPartitions(int num_partitions, int sheet) {
+  return storage_->seekPartitions(num_partitions, getRowFilter());
+}
+
+std::unique_ptr<Cursor>
+MemoryTable::seekIndex(int column, const Key & value) {
+  return storage_->seekIndex(column, value);
+}
+
+std::unique_ptr<Cursor>
+MemoryTable::seekIndexRange(int column, const Key & min, const Key & max) {
+  return storage_->seekIndexRange(column, min, max);
+}
+
 int
 MemoryTable::getNumFields(int sheet) const {
   return storage_->getNumFields();
@@ -446,3 +1412,13 @@ void
 MemoryTable::clear() {
   storage_->clear();
 }
+
+uint64_t
+MemoryTable::getVersion() const {
+  return storage_->getRowVersion();
+}
+
+bool
+MemoryTable::getChangedRows(uint64_t version, std::vector<Key> & keys) const {
+  return storage_->getChangedRows(version, keys);
+}
@@ -2,21 +2,107 @@
 
 #include <cassert>
 #include <cstring>
+#include <charconv>
+#include <algorithm>
+#include <thread>
+#include <cerrno>
+
+#include <poll.h>
 
 #include <SQLException.h>
 
-#define MYSQL_MAX_BOUND_VARIABLES 255
 #define MYSQL_BIND_BUFFER_SIZE 4096
 
 using namespace std;
 using namespace sqldb;
 
+// Formats the shortest text that reads back as the same value, like the
+// server formats doubles and floats
+template<typename T>
+static std::string format_number(T value) {
+  char buffer[64];
+  auto r = std::to_chars(buffer, buffer + sizeof(buffer), value);
+  return std::string(buffer, r.ptr);
+}
+
+static inline ColumnType get_column_type(enum_field_types type) {
+  switch (type) {
+  case MYSQL_TYPE_TINY:
+  case MYSQL_TYPE_SHORT:
+  case MYSQL_TYPE_LONG:
+  case MYSQL_TYPE_INT24:
+  case MYSQL_TYPE_YEAR:
+    return ColumnType::INT;
+  case MYSQL_TYPE_LONGLONG:
+    return ColumnType::INT64;
+  case MYSQL_TYPE_FLOAT:
+    return ColumnType::FLOAT;
+  case MYSQL_TYPE_DOUBLE:
+  case MYSQL_TYPE_DECIMAL:
+  case MYSQL_TYPE_NEWDECIMAL:
+    return ColumnType::DOUBLE;
+  case MYSQL_TYPE_TINY_BLOB:
+  case MYSQL_TYPE_MEDIUM_BLOB:
+  case MYSQL_TYPE_LONG_BLOB:
+  case MYSQL_TYPE_BLOB:
+    return ColumnType::TEXT;
+  default:
+    break;
+  }
+  return ColumnType::VARCHAR;
+}
+
+// Bump allocator for variable length parameter values. The blocks are kept
+// when the arena is cleared so that executing the same statement repeatedly
+// doesn't allocate.
+class MySQLBindArena {
+public:
+  MySQLBindArena() { }
+
+  char * allocate(size_t size) {
+    while (current_ < blocks_.size()) {
+      auto & [ block, block_size ] = blocks_[current_];
+      if (used_ + size <= block_size) {
+	auto ptr = block.get() + used_;
+	used_ += size;
+	return ptr;
+      }
+      current_++;
+      used_ = 0;
+    }
+    auto block_size = size > MYSQL_BIND_BUFFER_SIZE ? size : MYSQL_BIND_BUFFER_SIZE;
+    blocks_.emplace_back(make_unique<char[]>(block_size), block_size);
+    current_ = blocks_.size() - 1;
+    used_ = size;
+    return blocks_.back().first.get();
+  }
+
+  void clear() {
+    current_ = 0;
+    used_ = 0;
+  }
+
+  size_t capacity() const {
+    size_t n = 0;
+    for (auto & [ block, block_size ] : blocks_) n += block_size;
+    return n;
+  }
+
+private:
+  std::vector<std::pair<unique_ptr<char[]>, size_t>> blocks_;
+  size_t current_ = 0, used_ = 0;
+};
+
 class MySQLStatement : public SQLStatement {
 public:
-  MySQLStatement(MYSQL_STMT * stmt) : stmt_(stmt) {
+  MySQLStatement(MYSQL_STMT * stmt, MySQL::ResultMode result_mode = MySQL::ResultMode::BUFFERED)
+    : stmt_(stmt), result_mode_(result_mode) {
     assert(stmt_);
-    num_bound_variables_ = mysql_stmt_param_count(stmt_);
-        
+    num_params_ = static_cast<int>(mysql_stmt_param_count(stmt_));
+    param_bind_.resize(num_params_);
+    param_value_.resize(num_params_);
+    param_buffer_.resize(num_params_);
+    
     reset();
   }
 
@@ -39,55 +125,213 @@ public:
   
   int getInt(int column_idx, int default_value = 0) override;
   double getDouble(int column_idx, double default_value = 0.0) override;
+  float getFloat(int column_idx, float default_value = 0.0f) override {
+    return static_cast<float>(getDouble(column_idx, default_value));
+  }
   long long getLongLong(int column_idx, long long default_value = 0LL) override;
   std::string_view getText(int column_idx) override;
   std::vector<uint8_t> getBlob(int column_idx) override;
+  Key getKey(int column_idx) override {
+    if (is_numeric(getColumnType(column_idx))) {
+      return Key(getLongLong(column_idx));
+    } else {
+      return Key(getText(column_idx));
+    }
+  }
   
   bool isNull(int column_idx) const override;
+  ColumnType getColumnType(int column_idx) const override;
   
   long long getLastInsertId() const override { return last_insert_id_; }
   size_t getAffectedRows() const override { return rows_affected_; }
   size_t getNumWarnings() const override { return num_warnings_; }
-  int getNumFields() const override { return num_bound_variables_; }
+  int getNumFields() const override { return num_fields_; }
 
-  const std::string & getColumnName(int column_idx) {
-    // TODO
-    return empty_string;
+  const std::string & getColumnName(int column_idx) override {
+    auto idx = static_cast<size_t>(column_idx);
+    return idx < column_names_.size() ? column_names_[idx] : empty_string;
+  }
+
+  size_t getMemoryUsage() const override {
+    size_t n = sizeof(*this);
+    n += param_bind_.capacity() * sizeof(MYSQL_BIND);
+    n += param_value_.capacity() * sizeof(long long);
+    n += param_buffer_.capacity() * sizeof(std::pair<char *, size_t>);
+    n += param_arena_.capacity();
+    n += result_bind_.capacity() * sizeof(MYSQL_BIND);
+    n += result_length_.capacity() * sizeof(unsigned long);
+    n += result_is_null_.capacity() * sizeof(my_bool);
+    n += result_error_.capacity() * sizeof(my_bool);
+    n += result_buffer_size_;
+    n += text_valid_.capacity();
+    for (auto & s : text_buffer_) n += sizeof(std::string) + s.capacity();
+    for (auto & s : column_names_) n += sizeof(std::string) + s.capacity();
+    n += column_types_.capacity() * sizeof(enum_field_types);
+    return n;
   }
     
 protected:
   void setData(int column_idx, enum_field_types buffer_type, const void * ptr, size_t size, bool is_defined = true, bool is_unsigned = false);
+  void bindResult(MYSQL_RES * meta);
   
 private:
   MYSQL_STMT * stmt_;
-  int num_bound_variables_ = 0;       
-  bool has_result_set_ = false, is_query_executed_ = false;
+  MySQL::ResultMode result_mode_;
+  int num_params_ = 0, num_fields_ = 0;
+  bool has_result_set_ = false, is_query_executed_ = false, is_result_bound_ = false;
   long long last_insert_id_ = 0;
   size_t rows_affected_ = 0, num_warnings_ = 0;
-  
-  MYSQL_BIND bind_data_[MYSQL_MAX_BOUND_VARIABLES];
-  size_t bind_length_[MYSQL_MAX_BOUND_VARIABLES];
-  my_bool bind_is_null_[MYSQL_MAX_BOUND_VARIABLES];
-  my_bool bind_error_[MYSQL_MAX_BOUND_VARIABLES];
-  char bind_out_buffer_[MYSQL_MAX_BOUND_VARIABLES * MYSQL_BIND_BUFFER_SIZE];
-  // char bind_in_buffer_[MYSQL_MAX_BOUND_VARIABLES * MYSQL_BIND_BUFFER_SIZE];
-  std::vector<unique_ptr<char[]>> bind_out_ptr_, bind_in_ptr_;
+
+  // parameter bindings are sized by the parameter count of the statement
+  std::vector<MYSQL_BIND> param_bind_;
+  std::vector<long long> param_value_; // storage for fixed size values
+  std::vector<std::pair<char *, size_t>> param_buffer_; // arena allocation of each parameter
+  MySQLBindArena param_arena_; // storage for variable length values
+
+  // result bindings are sized by the field count of the result set
+  std::vector<MYSQL_BIND> result_bind_;
+  std::vector<unsigned long> result_length_;
+  std::vector<my_bool> result_is_null_, result_error_;
+  unique_ptr<long long[]> result_buffer_; // output buffers of all columns
+  size_t result_buffer_size_ = 0;
+  std::vector<std::string> text_buffer_; // formatted numbers and truncated values
+  std::vector<char> text_valid_;
+  std::vector<std::string> column_names_;
+  std::vector<enum_field_types> column_types_;
 
   static inline my_bool is_null = 1, is_not_null = 0;
   static inline std::string empty_string;
 };
 
+// Result of a query sent with the text protocol. The rows have been
+// stored in the client, so reading them never blocks.
+class MySQLResult : public SQLStatement {
+public:
+  MySQLResult(MYSQL_RES * res, size_t affected_rows, size_t num_warnings, long long last_insert_id)
+    : res_(res), affected_rows_(affected_rows), num_warnings_(num_warnings), last_insert_id_(last_insert_id) {
+    if (res_) {
+      num_fields_ = static_cast<int>(mysql_num_fields(res_));
+      auto fields = mysql_fetch_fields(res_);
+      for (int i = 0; i < num_fields_; i++) {
+	column_names_.push_back(std::string(fields[i].name, fields[i].name_length));
+	column_types_.push_back(fields[i].type);
+      }
+    }
+  }
+  ~MySQLResult() {
+    if (res_) mysql_free_result(res_);
+  }
+
+  size_t execute() override { return affected_rows_; }
+  
+  bool next() override {
+    SQLStatement::reset();
+    if (res_ && (row_ = mysql_fetch_row(res_)) != nullptr) {
+      lengths_ = mysql_fetch_lengths(res_);
+      results_available_ = true;
+    } else {
+      row_ = nullptr;
+      lengths_ = nullptr;
+    }
+    return results_available_;
+  }
+
+  std::string_view getText(int column_idx) override {
+    if (isNull(column_idx)) return std::string_view();
+    return std::string_view(row_[column_idx], lengths_[column_idx]);
+  }
+  std::vector<uint8_t> getBlob(int column_idx) override {
+    auto s = getText(column_idx);
+    return std::vector<uint8_t>(s.begin(), s.end());
+  }
+  bool isNull(int column_idx) const override {
+    return !row_ || column_idx < 0 || column_idx >= num_fields_ || !row_[column_idx];
+  }
+  double getDouble(int column_idx, double default_value = 0.0) override {
+    auto s = getText(column_idx);
+    double d;
+    auto [ ptr, ec ] = std::from_chars(s.data(), s.data() + s.size(), d);
+    return !s.empty() && ec == std::errc() ? d : default_value;
+  }
+  float getFloat(int column_idx, float default_value = 0.0f) override {
+    return static_cast<float>(getDouble(column_idx, default_value));
+  }
+  int getInt(int column_idx, int default_value = 0) override {
+    return static_cast<int>(getLongLong(column_idx, default_value));
+  }
+  long long getLongLong(int column_idx, long long default_value = 0) override {
+    auto s = getText(column_idx);
+    long long ll;
+    auto [ ptr, ec ] = std::from_chars(s.data(), s.data() + s.size(), ll);
+    return !s.empty() && ec == std::errc() ? ll : default_value;
+  }
+  Key getKey(int column_idx) override {
+    if (is_numeric(getColumnType(column_idx))) {
+      return Key(getLongLong(column_idx));
+    } else {
+      return Key(getText(column_idx));
+    }
+  }
+
+  int getNumFields() const override { return num_fields_; }
+  const std::string & getColumnName(int column_idx) override {
+    auto idx = static_cast<size_t>(column_idx);
+    return idx < column_names_.size() ? column_names_[idx] : empty_string;
+  }
+  ColumnType getColumnType(int column_idx) const override {
+    auto idx = static_cast<size_t>(column_idx);
+    return idx < column_types_.size() ? get_column_type(column_types_[idx]) : ColumnType::ANY;
+  }
+
+  void set(int column_idx, std::string_view value, bool is_defined = true) override {
+    throw SQLException(SQLException::BIND_FAILED, "Query result can't be bound");
+  }
+  void set(int column_idx, int value, bool is_defined = true) override {
+    throw SQLException(SQLException::BIND_FAILED, "Query result can't be bound");
+  }
+  void set(int column_idx, long long value, bool is_defined = true) override {
+    throw SQLException(SQLException::BIND_FAILED, "Query result can't be bound");
+  }
+  void set(int column_idx, double value, bool is_defined = true) override {
+    throw SQLException(SQLException::BIND_FAILED, "Query result can't be bound");
+  }
+  void set(int column_idx, const void * data, size_t len, bool is_defined = true) override {
+    throw SQLException(SQLException::BIND_FAILED, "Query result can't be bound");
+  }
+
+  long long getLastInsertId() const override { return last_insert_id_; }
+  size_t getAffectedRows() const override { return affected_rows_; }
+  size_t getNumWarnings() const override { return num_warnings_; }
+  
+private:
+  MYSQL_RES * res_;
+  MYSQL_ROW row_ = nullptr;
+  unsigned long * lengths_ = nullptr;
+  int num_fields_ = 0;
+  size_t affected_rows_, num_warnings_;
+  long long last_insert_id_;
+  std::vector<std::string> column_names_;
+  std::vector<enum_field_types> column_types_;
+
+  static inline std::string empty_string;
+};
+
 MySQL::~MySQL() {
+  // cached statements must be closed before the connection
+  statement_cache_.clear();
+  if (async_result_) mysql_free_result(async_result_);
   if (conn_) mysql_close(conn_);
 }
 
 void
 MySQL::begin() {
   mysql_autocommit(conn_, 0); // disable autocommit
+  in_transaction_ = true;
 }
 
 void
 MySQL::commit() {
+  in_transaction_ = false;
   if (mysql_commit(conn_) != 0) {
     mysql_autocommit(conn_, 1); // enable autocommit
     throw SQLException(SQLException::COMMIT_FAILED);
@@ -98,6 +342,7 @@ MySQL::commit() {
 
 void
 MySQL::rollback() {
+  in_transaction_ = false;
   if (mysql_rollback(conn_) != 0) {
     mysql_autocommit(conn_, 1); // enable autocommit
     throw SQLException(SQLException::ROLLBACK_FAILED);
@@ -107,29 +352,39 @@ MySQL::rollback() {
 }
 
 std::unique_ptr<SQLStatement>
-MySQL::prepare(std::string_view query) {
+MySQL::prepare(std::string_view query, ResultMode mode, unsigned long prefetch_rows) {
   if (!conn_) {
     throw SQLException(SQLException::PREPARE_FAILED, "Not connected", std::string(query));
   }
   MYSQL_STMT * stmt = 0;
+  bool is_reconnected = false;
   while ( 1 ) {
-    if (stmt) mysql_stmt_close(stmt);	
     stmt = mysql_stmt_init(conn_);
-    if (!stmt) {
-      if (mysql_errno(conn_) == 2006) {
-	continue;
-      }
-      throw SQLException(SQLException::PREPARE_FAILED, mysql_error(conn_), std::string(query));
+    if (stmt && mysql_stmt_prepare(stmt, query.data(), query.size()) == 0) {
+      break;
     }
-    if (mysql_stmt_prepare(stmt, query.data(), query.size()) != 0) {
-      if (mysql_errno(conn_) == 2006) {
-	continue;
-      }
-      throw SQLException(SQLException::PREPARE_FAILED, mysql_error(conn_), std::string(query));
+    auto error = stmt ? mysql_stmt_errno(stmt) : mysql_errno(conn_);
+    std::string errmsg = stmt ? mysql_stmt_error(stmt) : mysql_error(conn_);
+    if (stmt) mysql_stmt_close(stmt);
+    // 2006 = server has gone away, 2013 = lost connection to server. The
+    // server rolls back an open transaction when the connection is lost,
+    // so the statement isn't retried on a new connection.
+    if ((error == 2006 || error == 2013) && !is_reconnected && !in_transaction_) {
+      is_reconnected = true;
+      if (reconnect()) continue;
+    }
+    throw SQLException(SQLException::PREPARE_FAILED, errmsg, std::string(query));
+  }
+  if (mode == ResultMode::CURSOR) {
+    unsigned long cursor_type = CURSOR_TYPE_READ_ONLY;
+    if (mysql_stmt_attr_set(stmt, STMT_ATTR_CURSOR_TYPE, &cursor_type) != 0 ||
+	(prefetch_rows && mysql_stmt_attr_set(stmt, STMT_ATTR_PREFETCH_ROWS, &prefetch_rows) != 0)) {
+      std::string errmsg = mysql_stmt_error(stmt);
+      mysql_stmt_close(stmt);
+      throw SQLException(SQLException::PREPARE_FAILED, errmsg, std::string(query));
     }
-    break;
   }
-  return std::make_unique<MySQLStatement>(stmt);
+  return std::make_unique<MySQLStatement>(stmt, mode);
 }
 
 void
@@ -145,16 +400,39 @@ MySQL::connect(string host_name, int port, string user_name, string password, st
 
 void
 MySQL::connect() {
+  // the cached statements are prepared again on first use
+  for (auto & [ query, stmt ] : statement_cache_) {
+    stmt.reset();
+  }
+  // the state of a non-blocking query belongs to the old connection
+  if (async_result_) {
+    mysql_free_result(async_result_);
+    async_result_ = 0;
+  }
+  connection_number_++;
+  is_nonblocking_ = false;
+  async_state_ = AsyncState::NONE;
+  async_status_ = 0;
+  async_error_ = nullptr;
   if (conn_) mysql_close(conn_);
+  in_transaction_ = false;
   conn_ = mysql_init(NULL);
   if (!conn_) {
     throw SQLException(SQLException::INIT_FAILED);
   }
 
   int flags = CLIENT_FOUND_ROWS; 
+  if (local_infile_) {
+    unsigned int enable = 1;
+    mysql_options(conn_, MYSQL_OPT_LOCAL_INFILE, &enable);
+    flags |= CLIENT_LOCAL_FILES;
+  }
+  if (multi_statements_) {
+    flags |= CLIENT_MULTI_STATEMENTS;
+  }
 
   if (!mysql_real_connect(conn_, host_name_.c_str(), user_name_.c_str(), password_.c_str(), db_name_.c_str(), port_, 0, flags)) {
-    auto errmsg = mysql_error(conn_);
+    std::string errmsg = mysql_error(conn_);
     mysql_close(conn_);
     conn_ = 0;
     throw SQLException(SQLException::CONNECTION_FAILED, errmsg);
@@ -163,6 +441,61 @@ MySQL::connect() {
   execute("SET NAMES utf8mb4");
 }
 
+bool
+MySQL::reconnect() {
+  auto delay = reconnect_backoff_;
+  for (int i = 0; i < max_reconnect_attempts_; i++) {
+    if (i) {
+      std::this_thread::sleep_for(delay);
+      delay *= 2;
+    }
+    try {
+      connect();
+      return true;
+    } catch (SQLException & e) {
+    }
+  }
+  return false;
+}
+
+SQLStatement &
+MySQL::prepareCached(std::string_view query) {
+  auto it = statement_cache_.find(std::string(query));
+  if (it == statement_cache_.end()) {
+    it = statement_cache_.emplace(std::string(query), std::unique_ptr<SQLStatement>()).first;
+  }
+  if (!it->second) {
+    it->second = prepare(query);
+  }
+  it->second->reset();
+  return *it->second;
+}
+
+bool
+MySQL::resetState() {
+  if (!conn_ || isQueryPending() || async_state_ == AsyncState::QUERY || async_state_ == AsyncState::STORE_RESULT) {
+    return false;
+  }
+  // the connection is busy until the rows of an unbuffered result are read
+  if (conn_->status != MYSQL_STATUS_READY) {
+    return false;
+  }
+  if (async_result_) {
+    mysql_free_result(async_result_);
+    async_result_ = 0;
+  }
+  async_state_ = AsyncState::NONE;
+  async_error_ = nullptr;
+  if (in_transaction_) {
+    try {
+      rollback();
+    } catch (SQLException & e) {
+      return false;
+    }
+  }
+  return true;
+}
+
 bool
 MySQL::ping() {
   if (conn_ && mysql_ping(conn_) == 0) {
@@ -187,7 +520,7 @@ MySQLStatement::execute() {
   is_query_executed_ = true;
   has_result_set_ = false;
   
-  if (mysql_stmt_bind_param(stmt_, bind_data_) != 0) {
+  if (num_params_ && mysql_stmt_bind_param(stmt_, param_bind_.data()) != 0) {
     throw SQLException(SQLException::EXECUTE_FAILED, mysql_stmt_error(stmt_));
   }
   
@@ -209,26 +542,19 @@ MySQLStatement::execute() {
     
   // NULL if no metadata / results
   if (prepare_meta_result) {
-    // Get total columns in the query
-    num_bound_variables_ = mysql_num_fields(prepare_meta_result);
-    mysql_free_result(prepare_meta_result);
-
-    // reserve varibles if larger than MAX
-    memset(bind_data_, 0, num_bound_variables_ * sizeof(MYSQL_BIND));
-    
-    for (int i = 0; i < num_bound_variables_; i++) {
-      bind_length_[i] = 0;
-      
-      // bind[i].buffer_type = MYSQL_TYPE_STRING;
-      bind_data_[i].buffer = 0; // new char[255];
-      bind_data_[i].buffer_length = 0; // 255;
-      bind_data_[i].is_null = &bind_is_null_[i];
-      bind_data_[i].length = &bind_length_[i];
-      bind_data_[i].error = &bind_error_[i];
+    // Output buffers are allocated once from the metadata and reused for all rows
+    if (!is_result_bound_) {
+      bindResult(prepare_meta_result);
     }
+    mysql_free_result(prepare_meta_result);
     
     /* Bind the result buffers */
-    if (mysql_stmt_bind_result(stmt_, bind_data_) || mysql_stmt_store_result(stmt_)) {
+    if (mysql_stmt_bind_result(stmt_, result_bind_.data())) {
+      throw SQLException(SQLException::EXECUTE_FAILED, mysql_stmt_error(stmt_));
+    }
+
+    // In streaming modes the rows are fetched from the server in next()
+    if (result_mode_ == MySQL::ResultMode::BUFFERED && mysql_stmt_store_result(stmt_)) {
       throw SQLException(SQLException::EXECUTE_FAILED, mysql_stmt_error(stmt_));
     }
     
@@ -244,13 +570,17 @@ MySQLStatement::reset() {
 
   rows_affected_ = 0;
   is_query_executed_ = false;
-  has_result_set_ = false;
+  if (has_result_set_) {
+    // discards the rows of an unfinished streaming result
+    mysql_stmt_free_result(stmt_);
+    has_result_set_ = false;
+  }
 
-  bind_out_ptr_.clear();
-  bind_in_ptr_.clear();
+  param_arena_.clear();
+  std::fill(param_buffer_.begin(), param_buffer_.end(), std::pair<char *, size_t>(nullptr, 0));
 
-  memset(bind_data_, 0, num_bound_variables_ * sizeof(MYSQL_BIND));
-  for (int i = 0; i < num_bound_variables_; i++) {
+  if (num_params_) memset(param_bind_.data(), 0, num_params_ * sizeof(MYSQL_BIND));
+  for (int i = 0; i < num_params_; i++) {
     set(i, 0, false);
   } 
   // no need to reset. just rebind parameter and execute again. not tested though
@@ -262,8 +592,8 @@ MySQLStatement::next() {
   
   assert(stmt_);
 
-  bind_in_ptr_.clear();
   rows_affected_ = 0;
+  std::fill(text_valid_.begin(), text_valid_.end(), 0);
   
   if (!is_query_executed_) {
     execute();
@@ -323,190 +653,893 @@ MySQLStatement::set(int column_idx, const void * data, size_t len, bool is_defin
 
 int
 MySQLStatement::getInt(int column_idx, int default_value) {
-  if (column_idx < 0 || column_idx >= MYSQL_MAX_BOUND_VARIABLES) throw SQLException(SQLException::BAD_COLUMN_INDEX, "");
-
-  assert(stmt_);
-  
-  long a = default_value;
-   
-  if (bind_is_null_[column_idx]) {
-
-  } else if (bind_length_[column_idx]) {
-    long unsigned int dummy1;
-    my_bool dummy2;
-    MYSQL_BIND b;
-    memset(&b, 0, sizeof(MYSQL_BIND));
-    b.buffer_type = MYSQL_TYPE_LONG;
-    b.buffer = (char *)&a;  
-    b.buffer_length = sizeof(a);
-    b.length = &dummy1; 
-    b.is_null = &dummy2;
-    if (mysql_stmt_fetch_column(stmt_, &b, column_idx, 0) != 0) {
-      throw SQLException(SQLException::GET_FAILED, mysql_stmt_error(stmt_));
-    }
-  }
-
-  return a;
+  return static_cast<int>(getLongLong(column_idx, default_value));
 }
 
 double
 MySQLStatement::getDouble(int column_idx, double default_value) {
-  if (column_idx < 0 || column_idx >= MYSQL_MAX_BOUND_VARIABLES) throw SQLException(SQLException::BAD_COLUMN_INDEX, "");
-  assert(stmt_);
-  double a = default_value;
-   
-  if (bind_is_null_[column_idx]) {
-    // cerr << "null value\n";
-  } else if (1 || bind_length_[column_idx]) {
-    long unsigned int dummy1;
-    my_bool dummy2;
-    MYSQL_BIND b;
-    memset(&b, 0, sizeof(MYSQL_BIND));
-    b.buffer_type = MYSQL_TYPE_DOUBLE;
-    b.buffer = (char *)&a;  
-    b.buffer_length = sizeof(a);
-    b.length = &dummy1; 
-    b.is_null = &dummy2;
-    if (mysql_stmt_fetch_column(stmt_, &b, column_idx, 0) != 0) {
-      throw SQLException(SQLException::GET_FAILED, mysql_stmt_error(stmt_));
-    }
-  } else {
-    // cerr << "empty value\n";
+  if (column_idx < 0 || column_idx >= num_fields_) throw SQLException(SQLException::BAD_COLUMN_INDEX, "");
+  
+  if (!results_available_ || result_is_null_[column_idx]) {
+    return default_value;
   }
-
-  return a;
+  
+  auto & b = result_bind_[column_idx];
+  switch (b.buffer_type) {
+  case MYSQL_TYPE_LONGLONG:
+    if (b.is_unsigned) return static_cast<double>(*reinterpret_cast<unsigned long long *>(b.buffer));
+    else return static_cast<double>(*reinterpret_cast<long long *>(b.buffer));
+  case MYSQL_TYPE_DOUBLE:
+    return *reinterpret_cast<double *>(b.buffer);
+  default:
+    break;
+  }
+  
+  auto s = getText(column_idx);
+  double d;
+  auto [ ptr, ec ] = std::from_chars(s.data(), s.data() + s.size(), d);
+  return ec == std::errc() ? d : default_value;
 }
 
 long long
 MySQLStatement::getLongLong(int column_idx, long long default_value) {
-  if (column_idx < 0 || column_idx >= MYSQL_MAX_BOUND_VARIABLES) throw SQLException(SQLException::BAD_COLUMN_INDEX, "");
+  if (column_idx < 0 || column_idx >= num_fields_) throw SQLException(SQLException::BAD_COLUMN_INDEX, "");
 
-  assert(stmt_);
-  
-  long long a = default_value;
-   
-  if (bind_is_null_[column_idx]) {
+  if (!results_available_ || result_is_null_[column_idx]) {
+    return default_value;
+  }
+
+  auto & b = result_bind_[column_idx];
+  switch (b.buffer_type) {
+  case MYSQL_TYPE_LONGLONG:
+    return *reinterpret_cast<long long *>(b.buffer);
+  case MYSQL_TYPE_DOUBLE:
+    return static_cast<long long>(*reinterpret_cast<double *>(b.buffer));
+  default:
+    break;
+  }
 
-  } else if (bind_length_[column_idx]) {
-    long unsigned int dummy1;
-    my_bool dummy2;
-    MYSQL_BIND b;
-    memset(&b, 0, sizeof(MYSQL_BIND));
-    b.buffer_type = MYSQL_TYPE_LONGLONG;
-    b.buffer = (char *)&a;  
-    b.buffer_length = sizeof(a);
-    b.length = &dummy1;
-    b.is_null = &dummy2;
-    if (mysql_stmt_fetch_column(stmt_, &b, column_idx, 0) != 0) {
-      throw SQLException(SQLException::GET_FAILED, mysql_stmt_error(stmt_));
+  switch (column_types_[column_idx]) {
+  case MYSQL_TYPE_DATE:
+  case MYSQL_TYPE_NEWDATE:
+  case MYSQL_TYPE_TIME:
+  case MYSQL_TYPE_DATETIME:
+  case MYSQL_TYPE_TIMESTAMP:
+  case MYSQL_TYPE_DECIMAL:
+  case MYSQL_TYPE_NEWDECIMAL:
+    {
+      // temporal values are fetched as strings, but their integer value is
+      // e.g. 20200101100000, so the server converts them
+      long long a = default_value;
+      unsigned long dummy1;
+      my_bool dummy2;
+      MYSQL_BIND b2;
+      memset(&b2, 0, sizeof(MYSQL_BIND));
+      b2.buffer_type = MYSQL_TYPE_LONGLONG;
+      b2.buffer = &a;
+      b2.buffer_length = sizeof(a);
+      b2.length = &dummy1;
+      b2.is_null = &dummy2;
+      if (mysql_stmt_fetch_column(stmt_, &b2, column_idx, 0) != 0) {
+	throw SQLException(SQLException::GET_FAILED, mysql_stmt_error(stmt_));
+      }
+      return a;
     }
+  default:
+    break;
   }
 
-  return a;
+  auto s = getText(column_idx);
+  long long ll;
+  auto [ ptr, ec ] = std::from_chars(s.data(), s.data() + s.size(), ll);
+  return ec == std::errc() ? ll : default_value;
 }
 
 string_view
 MySQLStatement::getText(int column_idx) {
-  if (column_idx < 0 || column_idx >= MYSQL_MAX_BOUND_VARIABLES) throw SQLException(SQLException::BAD_COLUMN_INDEX, "");
+  if (column_idx < 0 || column_idx >= num_fields_) throw SQLException(SQLException::BAD_COLUMN_INDEX, "");
 
   assert(stmt_);
     
-  if (!bind_is_null_[column_idx]) {
-    auto len = bind_length_[column_idx];
+  if (!results_available_ || result_is_null_[column_idx]) {
+    return empty_string;
+  }
+
+  auto & b = result_bind_[column_idx];
+  auto len = result_length_[column_idx];
+  
+  if (b.buffer_type != MYSQL_TYPE_LONGLONG && b.buffer_type != MYSQL_TYPE_DOUBLE && len <= b.buffer_length) {
+    // the value fit in the bound buffer
+    return string_view(reinterpret_cast<const char *>(b.buffer), len);
+  }
 
-    if (len) {
-      auto tmp = make_unique<char[]>(len);
-	
-      long unsigned int dummy1;
+  auto & text = text_buffer_[column_idx];
+  
+  if (!text_valid_[column_idx]) {
+    text_valid_[column_idx] = 1;
+
+    if (b.buffer_type == MYSQL_TYPE_LONGLONG) {
+      if (b.is_unsigned) text = std::to_string(*reinterpret_cast<unsigned long long *>(b.buffer));
+      else text = std::to_string(*reinterpret_cast<long long *>(b.buffer));
+    } else if (b.buffer_type == MYSQL_TYPE_DOUBLE) {
+      // floats are fetched as doubles, so they are formatted as floats
+      auto d = *reinterpret_cast<double *>(b.buffer);
+      if (column_types_[column_idx] == MYSQL_TYPE_FLOAT) text = format_number(static_cast<float>(d));
+      else text = format_number(d);
+    } else {
+      // the value was truncated so fetch it again with a larger buffer
+      text.resize(len);
+      
+      unsigned long dummy1;
       my_bool dummy2;
-      MYSQL_BIND b;
-      memset(&b, 0, sizeof(MYSQL_BIND));
-      b.buffer_type = MYSQL_TYPE_STRING;
-      b.buffer = tmp.get();
-      b.buffer_length = len;
-      b.length = &dummy1; 
-      b.is_null = &dummy2;
+      MYSQL_BIND b2;
+      memset(&b2, 0, sizeof(MYSQL_BIND));
+      b2.buffer_type = b.buffer_type;
+      b2.buffer = text.data();
+      b2.buffer_length = len;
+      b2.length = &dummy1; 
+      b2.is_null = &dummy2;
       
-      if (mysql_stmt_fetch_column(stmt_, &b, column_idx, 0) != 0) {
+      if (mysql_stmt_fetch_column(stmt_, &b2, column_idx, 0) != 0) {
 	throw SQLException(SQLException::GET_FAILED, mysql_stmt_error(stmt_));
       }
-
-      string_view r(tmp.get(), len);
-      
-      if (static_cast<int>(bind_in_ptr_.size()) <= column_idx) bind_in_ptr_.resize(column_idx + 1);
-      bind_in_ptr_[column_idx] = std::move(tmp);
-
-      return r;
     }
   }
-  
-  return empty_string;
+
+  return text;
 }
 
 std::vector<uint8_t>
 MySQLStatement::getBlob(int column_idx) {
-  if (column_idx < 0 || column_idx >= MYSQL_MAX_BOUND_VARIABLES) throw SQLException(SQLException::BAD_COLUMN_INDEX, "");
+  auto s = getText(column_idx);
+  return std::vector<uint8_t>(s.begin(), s.end());
+}
 
-  assert(stmt_);
-  
-  std::vector<uint8_t> s;
+bool
+MySQLStatement::isNull(int column_idx) const {
+  if (column_idx < 0 || column_idx >= num_fields_) throw SQLException(SQLException::BAD_COLUMN_INDEX, "");
+  return result_is_null_[column_idx];
+}
+
+ColumnType
+MySQLStatement::getColumnType(int column_idx) const {
+  auto idx = static_cast<size_t>(column_idx);
+  return idx < column_types_.size() ? get_column_type(column_types_[idx]) : ColumnType::ANY;
+}
+
+void
+MySQLStatement::bindResult(MYSQL_RES * meta) {
+  num_fields_ = static_cast<int>(mysql_num_fields(meta));
+  auto fields = mysql_fetch_fields(meta);
   
-  if (!bind_is_null_[column_idx]) {
-    auto len = (size_t)bind_length_[column_idx];
-    if (len) {
-      auto tmp = make_unique<char[]>(len);
-      
-      long unsigned int dummy1;
-      my_bool dummy2;
-      MYSQL_BIND b;
-      
-      memset(&b, 0, sizeof(MYSQL_BIND));
+  result_bind_.assign(num_fields_, MYSQL_BIND());
+  result_length_.assign(num_fields_, 0);
+  result_is_null_.assign(num_fields_, 0);
+  result_error_.assign(num_fields_, 0);
+  text_buffer_.assign(num_fields_, std::string());
+  text_valid_.assign(num_fields_, 0);
+  column_names_.clear();
+  column_types_.clear();
+
+  // Calculate the buffer offsets. Numeric values are fetched as 8 byte
+  // integers or doubles, and other values as strings that are truncated to
+  // MYSQL_BIND_BUFFER_SIZE bytes.
+  std::vector<size_t> offsets;
+  size_t total_size = 0;
+  for (int i = 0; i < num_fields_; i++) {
+    auto & field = fields[i];
+    auto & b = result_bind_[i];
+
+    column_names_.push_back(std::string(field.name, field.name_length));
+    column_types_.push_back(field.type);
+    
+    switch (field.type) {
+    case MYSQL_TYPE_TINY:
+    case MYSQL_TYPE_SHORT:
+    case MYSQL_TYPE_LONG:
+    case MYSQL_TYPE_INT24:
+    case MYSQL_TYPE_LONGLONG:
+    case MYSQL_TYPE_YEAR:
+      b.buffer_type = MYSQL_TYPE_LONGLONG;
+      b.buffer_length = sizeof(long long);
+      b.is_unsigned = (field.flags & UNSIGNED_FLAG) != 0;
+      break;
+    case MYSQL_TYPE_FLOAT:
+    case MYSQL_TYPE_DOUBLE:
+      b.buffer_type = MYSQL_TYPE_DOUBLE;
+      b.buffer_length = sizeof(double);
+      break;
+    case MYSQL_TYPE_TINY_BLOB:
+    case MYSQL_TYPE_MEDIUM_BLOB:
+    case MYSQL_TYPE_LONG_BLOB:
+    case MYSQL_TYPE_BLOB:
       b.buffer_type = MYSQL_TYPE_BLOB;
-      b.buffer = tmp.get();
-      b.buffer_length = len;
-      b.length = &dummy1; 
-      b.is_null = &dummy2;
-      
-      if (mysql_stmt_fetch_column(stmt_, &b, column_idx, 0) != 0) {
-	throw SQLException(SQLException::GET_FAILED, mysql_stmt_error(stmt_));
-      }
-      for (size_t i = 0; i < len; i++) {
-	s.push_back(tmp[i]);
-      }
+      b.buffer_length = field.length > 0 && field.length < MYSQL_BIND_BUFFER_SIZE ? field.length : MYSQL_BIND_BUFFER_SIZE;
+      break;
+    default:
+      b.buffer_type = MYSQL_TYPE_STRING;
+      b.buffer_length = field.length > 0 && field.length < MYSQL_BIND_BUFFER_SIZE ? field.length : MYSQL_BIND_BUFFER_SIZE;
+      break;
     }
+
+    offsets.push_back(total_size);
+    total_size += (b.buffer_length + 7) & ~size_t(7);
   }
+  
+  result_buffer_ = make_unique<long long[]>(total_size / sizeof(long long) + 1);
+  result_buffer_size_ = total_size;
 
-  return s;
-}
+  for (int i = 0; i < num_fields_; i++) {
+    auto & b = result_bind_[i];
+    b.buffer = reinterpret_cast<char *>(result_buffer_.get()) + offsets[i];
+    b.is_null = &result_is_null_[i];
+    b.length = &result_length_[i];
+    b.error = &result_error_[i];
+  }
 
-bool
-MySQLStatement::isNull(int column_idx) const {
-  if (column_idx < 0 || column_idx >= MYSQL_MAX_BOUND_VARIABLES) throw SQLException(SQLException::BAD_COLUMN_INDEX, "");
-  return bind_is_null_[column_idx];
+  is_result_bound_ = true;
 }
 
 void
 MySQLStatement::setData(int column_idx, enum_field_types buffer_type, const void * ptr, size_t size, bool is_defined, bool is_unsigned) {
-  if (column_idx < 0 || column_idx >= num_bound_variables_) {
+  if (column_idx < 0 || column_idx >= num_params_) {
     throw SQLException(SQLException::BAD_COLUMN_INDEX, "");
   }
+  auto & bind = param_bind_[column_idx];
   char * buffer;
-  if (size <= MYSQL_BIND_BUFFER_SIZE) {
-    buffer = &bind_out_buffer_[column_idx * MYSQL_BIND_BUFFER_SIZE];
+  if (size <= sizeof(long long)) {
+    buffer = reinterpret_cast<char *>(&param_value_[column_idx]);
+  } else if (size <= param_buffer_[column_idx].second) {
+    // reuse the previous arena allocation of the parameter
+    buffer = param_buffer_[column_idx].first;
   } else {
-    auto tmp = unique_ptr<char[]>(new char[size]);
-    buffer = tmp.get();
-    if (static_cast<int>(bind_out_ptr_.size()) <= column_idx) bind_out_ptr_.resize(column_idx + 1);
-    bind_out_ptr_[column_idx] = move(tmp);
-  }
-  memcpy(buffer, ptr, size);
-  bind_data_[column_idx].buffer_type = buffer_type;
-  bind_data_[column_idx].buffer = buffer;
-  bind_data_[column_idx].buffer_length = size;
-  bind_data_[column_idx].is_unsigned = is_unsigned;
+    buffer = param_arena_.allocate(size);
+    param_buffer_[column_idx] = std::pair(buffer, size);
+  }
+  if (size) memcpy(buffer, ptr, size);
+  bind.buffer_type = buffer_type;
+  bind.buffer = buffer;
+  bind.buffer_length = size;
+  bind.is_unsigned = is_unsigned;
   if (is_defined) {
-    bind_data_[column_idx].is_null = &is_not_null;
+    bind.is_null = &is_not_null;
   } else {
-    bind_data_[column_idx].is_null = &is_null;
+    bind.is_null = &is_null;
+  }
+}
+
+namespace {
+  // State of a LOAD DATA LOCAL INFILE transfer from a cursor
+  struct LocalInfileSource {
+    Cursor * cursor = nullptr;
+    bool has_row = false;
+    std::string buffer;
+    size_t pos = 0;
+    std::string errmsg;
+  };
+};
+
+// Quotes a table or column name with backticks
+static std::string quote_identifier(std::string_view name) {
+  std::string r = "`";
+  for (auto c : name) {
+    if (c == '`') r += '`';
+    r += c;
+  }
+  r += '`';
+  return r;
+}
+
+static void append_tsv_field(std::string & output, std::string_view value) {
+  for (auto c : value) {
+    switch (c) {
+    case '\\': output += "\\\\"; break;
+    case '\t': output += "\\t"; break;
+    case '\n': output += "\\n"; break;
+    case '\r': output += "\\r"; break;
+    case 0: output += "\\0"; break;
+    default: output += c;
+    }
+  }
+}
+
+static int local_infile_init(void ** ptr, const char * filename, void * userdata) {
+  *ptr = userdata;
+  return 0;
+}
+
+static int local_infile_read(void * ptr, char * buf, unsigned int buf_len) {
+  auto & source = *static_cast<LocalInfileSource *>(ptr);
+  try {
+    // produce rows until the request can be filled
+    while (source.has_row && source.buffer.size() - source.pos < buf_len) {
+      if (source.pos) {
+	source.buffer.erase(0, source.pos);
+	source.pos = 0;
+      }
+      auto & cursor = *source.cursor;
+      for (int i = 0, n = cursor.getNumFields(); i < n; i++) {
+	if (i) source.buffer += '\t';
+	if (cursor.isNull(i)) source.buffer += "\\N";
+	else append_tsv_field(source.buffer, cursor.getText(i));
+      }
+      source.buffer += '\n';
+      source.has_row = cursor.next();
+    }
+  } catch (std::exception & e) {
+    source.errmsg = e.what();
+    return -1;
+  }
+  auto n = std::min(static_cast<size_t>(buf_len), source.buffer.size() - source.pos);
+  memcpy(buf, source.buffer.data() + source.pos, n);
+  source.pos += n;
+  return static_cast<int>(n);
+}
+
+static void local_infile_end(void * ptr) {
+}
+
+static int local_infile_error(void * ptr, char * error_msg, unsigned int error_msg_len) {
+  auto & source = *static_cast<LocalInfileSource *>(ptr);
+  if (error_msg_len) {
+    auto n = std::min(static_cast<size_t>(error_msg_len - 1), source.errmsg.size());
+    memcpy(error_msg, source.errmsg.data(), n);
+    error_msg[n] = 0;
+  }
+  return 2000; // CR_UNKNOWN_ERROR
+}
+
+size_t
+MySQL::load(std::string_view table, Table & source, std::vector<std::string> columns) {
+  if (!conn_) {
+    throw SQLException(SQLException::EXECUTE_FAILED, "Not connected");
+  }
+  if (!local_infile_) {
+    // the option would also let the server request any file of the client
+    throw SQLException(SQLException::EXECUTE_FAILED, "LOCAL INFILE is not enabled");
+  }
+  if (columns.empty()) {
+    for (int i = 0; i < source.getNumFields(); i++) {
+      columns.push_back(source.getColumnName(i));
+    }
+  }
+
+  std::string query = "LOAD DATA LOCAL INFILE 'sqldb' INTO TABLE " + quote_identifier(table) + " CHARACTER SET utf8mb4 FIELDS TERMINATED BY '\\t' ESCAPED BY '\\\\' LINES TERMINATED BY '\\n' (";
+  for (size_t i = 0; i < columns.size(); i++) {
+    if (i) query += ", ";
+    query += quote_identifier(columns[i]);
+  }
+  query += ")";
+
+  auto cursor = source.seekBegin();
+  LocalInfileSource data;
+  data.cursor = cursor.get();
+  data.has_row = cursor.get() != nullptr;
+
+  mysql_set_local_infile_handler(conn_, local_infile_init, local_infile_read, local_infile_end, local_infile_error, &data);
+  int r = mysql_real_query(conn_, query.data(), query.size());
+  mysql_set_local_infile_default(conn_);
+  
+  if (r != 0) {
+    throw SQLException(SQLException::EXECUTE_FAILED, data.errmsg.empty() ? mysql_error(conn_) : data.errmsg, query);
+  }
+  return mysql_affected_rows(conn_);
+}
+
+std::vector<std::unique_ptr<SQLStatement>>
+MySQL::executeBatch(const std::vector<std::string> & queries) {
+  std::vector<std::unique_ptr<SQLStatement>> results;
+  if (queries.empty()) return results;
+  if (!conn_) {
+    throw SQLException(SQLException::EXECUTE_FAILED, "Not connected");
+  }
+
+  std::string query;
+  for (auto & q : queries) {
+    if (!query.empty()) query += ";\n";
+    query += q;
+  }
+
+  if (!multi_statements_ && mysql_set_server_option(conn_, MYSQL_OPTION_MULTI_STATEMENTS_ON) != 0) {
+    throw SQLException(SQLException::EXECUTE_FAILED, mysql_error(conn_), query);
+  }
+
+  int status = mysql_real_query(conn_, query.data(), query.size());
+  while (status == 0) {
+    auto res = mysql_store_result(conn_);
+    if (!res && mysql_field_count(conn_) != 0) {
+      status = 1;
+      break;
+    }
+    results.push_back(std::make_unique<MySQLResult>(res, res ? 0 : mysql_affected_rows(conn_), mysql_warning_count(conn_), mysql_insert_id(conn_)));
+    
+    // -1 = no more results, > 0 = the next statement failed
+    status = mysql_next_result(conn_);
+  }
+
+  std::string errmsg;
+  if (status > 0) {
+    errmsg = mysql_error(conn_);
+  }
+  if (!multi_statements_) {
+    mysql_set_server_option(conn_, MYSQL_OPTION_MULTI_STATEMENTS_OFF);
+  }
+  if (status > 0) {
+    auto idx = results.size() < queries.size() ? results.size() : queries.size() - 1;
+    throw SQLException(SQLException::EXECUTE_FAILED, errmsg, queries[idx]);
+  }
+  return results;
+}
+
+int
+MySQL::startQuery(std::string_view query) {
+#ifdef MARIADB_PACKAGE_VERSION_ID
+  if (!conn_) {
+    throw SQLException(SQLException::EXECUTE_FAILED, "Not connected", std::string(query));
+  }
+  if (async_state_ == AsyncState::QUERY || async_state_ == AsyncState::STORE_RESULT) {
+    throw SQLException(SQLException::DATABASE_MISUSE, "Previous query is still pending", std::string(query));
+  }
+  if (!is_nonblocking_) {
+    mysql_options(conn_, MYSQL_OPT_NONBLOCK, 0);
+    is_nonblocking_ = true;
+  }
+  if (async_result_) {
+    mysql_free_result(async_result_);
+    async_result_ = 0;
+  }
+  async_error_ = nullptr;
+  
+  // the query must stay valid until the operation completes
+  async_query_ = std::string(query);
+  async_state_ = AsyncState::QUERY;
+  int error = 0;
+  int status = mysql_real_query_start(&error, conn_, async_query_.data(), async_query_.size());
+  return advanceQuery(status, error);
+#else
+  throw SQLException(SQLException::EXECUTE_FAILED, "Non-blocking queries require MariaDB Connector/C", std::string(query));
+#endif
+}
+
+int
+MySQL::continueQuery(int ready_status) {
+#ifdef MARIADB_PACKAGE_VERSION_ID
+  int error = 0, status = 0;
+  switch (async_state_) {
+  case AsyncState::QUERY:
+    status = mysql_real_query_cont(&error, conn_, ready_status);
+    break;
+  case AsyncState::STORE_RESULT:
+    status = mysql_store_result_cont(&async_result_, conn_, ready_status);
+    break;
+  case AsyncState::NONE:
+  case AsyncState::DONE:
+    return 0;
+  }
+  return advanceQuery(status, error);
+#else
+  throw SQLException(SQLException::EXECUTE_FAILED, "Non-blocking queries require MariaDB Connector/C");
+#endif
+}
+
+int
+MySQL::advanceQuery(int status, int error) {
+#ifdef MARIADB_PACKAGE_VERSION_ID
+  while (status == 0) {
+    if (async_state_ == AsyncState::QUERY) {
+      if (error) {
+	async_state_ = AsyncState::NONE;
+	async_status_ = 0;
+	throw SQLException(SQLException::EXECUTE_FAILED, mysql_error(conn_), async_query_);
+      }
+      if (mysql_field_count(conn_) == 0) {
+	// no result set
+	async_state_ = AsyncState::DONE;
+      } else {
+	async_state_ = AsyncState::STORE_RESULT;
+	status = mysql_store_result_start(&async_result_, conn_);
+	continue;
+      }
+    } else if (async_state_ == AsyncState::STORE_RESULT) {
+      if (!async_result_ && mysql_errno(conn_)) {
+	async_state_ = AsyncState::NONE;
+	async_status_ = 0;
+	throw SQLException(SQLException::EXECUTE_FAILED, mysql_error(conn_), async_query_);
+      }
+      async_state_ = AsyncState::DONE;
+    }
+    break;
+  }
+  async_status_ = status;
+  if (status & MYSQL_WAIT_TIMEOUT) {
+    async_deadline_ = std::chrono::steady_clock::now() + std::chrono::milliseconds(getTimeout());
+  }
+  return status;
+#else
+  return 0;
+#endif
+}
+
+std::unique_ptr<SQLStatement>
+MySQL::takeResult() {
+  if (async_error_) {
+    auto e = async_error_;
+    async_error_ = nullptr;
+    std::rethrow_exception(e);
+  }
+  if (async_state_ != AsyncState::DONE) {
+    throw SQLException(SQLException::DATABASE_MISUSE, "No completed query", async_query_);
+  }
+  async_state_ = AsyncState::NONE;
+  auto res = std::exchange(async_result_, nullptr);
+  return std::make_unique<MySQLResult>(res, res ? 0 : mysql_affected_rows(conn_), mysql_warning_count(conn_), mysql_insert_id(conn_));
+}
+
+int
+MySQL::getSocket() const {
+#ifdef MARIADB_PACKAGE_VERSION_ID
+  return conn_ ? mysql_get_socket(conn_) : -1;
+#else
+  return -1;
+#endif
+}
+
+unsigned int
+MySQL::getTimeout() const {
+#ifdef MARIADB_PACKAGE_VERSION_ID
+  return conn_ ? mysql_get_timeout_value_ms(conn_) : 0;
+#else
+  return 0;
+#endif
+}
+
+size_t
+MySQL::poll(const std::vector<MySQL *> & connections, int timeout_ms) {
+#ifdef MARIADB_PACKAGE_VERSION_ID
+  std::vector<struct pollfd> fds;
+  std::vector<MySQL *> pending;
+  auto now = std::chrono::steady_clock::now();
+  for (auto conn : connections) {
+    if (!conn->isQueryPending()) continue;
+    
+    struct pollfd fd;
+    fd.fd = conn->getSocket();
+    fd.events = 0;
+    fd.revents = 0;
+    if (conn->async_status_ & MYSQL_WAIT_READ) fd.events |= POLLIN;
+    if (conn->async_status_ & MYSQL_WAIT_WRITE) fd.events |= POLLOUT;
+    if (conn->async_status_ & MYSQL_WAIT_EXCEPT) fd.events |= POLLPRI;
+    if (conn->async_status_ & MYSQL_WAIT_TIMEOUT) {
+      // the time left of the wait of the connection
+      auto left = std::chrono::ceil<std::chrono::milliseconds>(conn->async_deadline_ - now).count();
+      int t = static_cast<int>(std::max<long long>(left, 0));
+      if (timeout_ms < 0 || t < timeout_ms) timeout_ms = t;
+    }
+    fds.push_back(fd);
+    pending.push_back(conn);
+  }
+  if (pending.empty()) return 0;
+
+  int r = ::poll(fds.data(), fds.size(), timeout_ms);
+  if (r < 0 && errno != EINTR) {
+    throw SQLException(SQLException::DATABASE_ERROR, strerror(errno));
+  }
+
+  size_t num_pending = 0;
+  now = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < pending.size(); i++) {
+    auto conn = pending[i];
+    int ready = 0;
+    if (fds[i].revents & (POLLIN | POLLHUP | POLLERR)) ready |= MYSQL_WAIT_READ;
+    if (fds[i].revents & POLLOUT) ready |= MYSQL_WAIT_WRITE;
+    if (fds[i].revents & POLLPRI) ready |= MYSQL_WAIT_EXCEPT;
+    // the timeout of the caller doesn't end the wait of the connection
+    if (!ready && (conn->async_status_ & MYSQL_WAIT_TIMEOUT) && now >= conn->async_deadline_) ready = MYSQL_WAIT_TIMEOUT;
+    if (ready) {
+      try {
+	conn->continueQuery(ready);
+      } catch (...) {
+	// reported by takeResult()
+	conn->async_error_ = std::current_exception();
+      }
+    }
+    if (conn->isQueryPending()) num_pending++;
+  }
+  return num_pending;
+#else
+  return 0;
+#endif
+}
+
+std::unique_ptr<MySQLBulkInsert>
+MySQL::prepareBulkInsert(std::string table, std::vector<std::string> columns, size_t batch_size) {
+  if (!conn_) {
+    throw SQLException(SQLException::PREPARE_FAILED, "Not connected");
+  }
+  return std::make_unique<MySQLBulkInsert>(*this, std::move(table), std::move(columns), batch_size);
+}
+
+MySQLBulkInsert::MySQLBulkInsert(MySQL & conn, std::string table, std::vector<std::string> columns, size_t batch_size)
+  : conn_(conn), table_(std::move(table)), columns_(std::move(columns)), batch_size_(batch_size ? batch_size : 1), connection_number_(conn.connection_number_)
+{
+  if (columns_.empty()) {
+    throw SQLException(SQLException::PREPARE_FAILED, "No columns for bulk insert");
+  }
+  pending_row_.resize(columns_.size());
+  rows_.reserve(columns_.size() * batch_size_);
+}
+
+MySQLBulkInsert::~MySQLBulkInsert() {
+  try {
+    flush();
+  } catch (SQLException & e) {
+  }
+  if (array_stmt_) mysql_stmt_close(array_stmt_);
+}
+
+size_t
+MySQLBulkInsert::execute() {
+  for (auto & v : pending_row_) {
+    rows_.push_back(std::move(v));
+    v = Value();
+  }
+  num_rows_++;
+  
+  // the next row is bound from the first column again
+  SQLStatement::reset();
+
+  if (num_rows_ >= batch_size_) {
+    flush();
+  }
+  return 1;
+}
+
+void
+MySQLBulkInsert::flush() {
+  if (!num_rows_) return;
+
+  if (connection_number_ != conn_.connection_number_) {
+    // the statements belong to a closed connection, so they are prepared
+    // again on the new one
+    if (array_stmt_) {
+      mysql_stmt_close(array_stmt_);
+      array_stmt_ = 0;
+    }
+    batch_stmt_.reset();
+    batch_stmt_rows_ = 0;
+    connection_number_ = conn_.connection_number_;
+  }
+
+  if (!has_array_binding_ || !flushArray()) {
+    flushMultiRow();
+  }
+}
+
+void
+MySQLBulkInsert::dropRows(size_t n) {
+  rows_.erase(rows_.begin(), rows_.begin() + n * columns_.size());
+  num_rows_ -= n;
+}
+
+void
+MySQLBulkInsert::set(int column_idx, std::string_view value, bool is_defined) {
+  if (is_defined) setValue(column_idx, std::string(value));
+  else setValue(column_idx, Value());
+}
+
+void
+MySQLBulkInsert::set(int column_idx, int value, bool is_defined) {
+  if (is_defined) setValue(column_idx, static_cast<long long>(value));
+  else setValue(column_idx, Value());
+}
+
+void
+MySQLBulkInsert::set(int column_idx, long long value, bool is_defined) {
+  if (is_defined) setValue(column_idx, value);
+  else setValue(column_idx, Value());
+}
+
+void
+MySQLBulkInsert::set(int column_idx, double value, bool is_defined) {
+  if (is_defined) setValue(column_idx, value);
+  else setValue(column_idx, Value());
+}
+
+void
+MySQLBulkInsert::set(int column_idx, const void * data, size_t len, bool is_defined) {
+  if (is_defined) setValue(column_idx, std::string(reinterpret_cast<const char *>(data), len));
+  else setValue(column_idx, Value());
+}
+
+void
+MySQLBulkInsert::setValue(int column_idx, Value value) {
+  if (column_idx < 0 || column_idx >= static_cast<int>(columns_.size())) {
+    throw SQLException(SQLException::BAD_COLUMN_INDEX, "");
+  }
+  pending_row_[column_idx] = std::move(value);
+}
+
+std::string
+MySQLBulkInsert::makeQuery(size_t num_rows) const {
+  std::string row = "(";
+  std::string query = "INSERT INTO " + quote_identifier(table_) + " (";
+  for (size_t i = 0; i < columns_.size(); i++) {
+    if (i) {
+      query += ", ";
+      row += ", ";
+    }
+    query += quote_identifier(columns_[i]);
+    row += "?";
+  }
+  row += ")";
+  query += ") VALUES ";
+  for (size_t i = 0; i < num_rows; i++) {
+    if (i) query += ", ";
+    query += row;
+  }
+  return query;
+}
+
+bool
+MySQLBulkInsert::flushArray() {
+#ifdef MARIADB_PACKAGE_VERSION_ID
+  auto num_columns = columns_.size();
+  
+  if (!array_stmt_) {
+    auto query = makeQuery(1);
+    array_stmt_ = mysql_stmt_init(conn_.conn_);
+    if (!array_stmt_) {
+      throw SQLException(SQLException::PREPARE_FAILED, mysql_error(conn_.conn_), query);
+    }
+    if (mysql_stmt_prepare(array_stmt_, query.data(), query.size()) != 0) {
+      std::string errmsg = mysql_stmt_error(array_stmt_);
+      mysql_stmt_close(array_stmt_);
+      array_stmt_ = 0;
+      throw SQLException(SQLException::PREPARE_FAILED, errmsg, query);
+    }
+  }
+  
+  unsigned int array_size = static_cast<unsigned int>(num_rows_);
+  if (mysql_stmt_attr_set(array_stmt_, STMT_ATTR_ARRAY_SIZE, &array_size) != 0) {
+    // array binding is not supported, use multi-row inserts from now on
+    has_array_binding_ = false;
+    return false;
+  }
+
+  std::vector<MYSQL_BIND> bind(num_columns);
+  memset(bind.data(), 0, num_columns * sizeof(MYSQL_BIND));
+  std::vector<std::vector<long long>> int_values(num_columns);
+  std::vector<std::vector<double>> double_values(num_columns);
+  std::vector<std::vector<char *>> string_values(num_columns);
+  std::vector<std::vector<unsigned long>> lengths(num_columns);
+  std::vector<std::vector<char>> indicators(num_columns);
+
+  for (size_t col = 0; col < num_columns; col++) {
+    // Use the widest type in the column: string, double or integer
+    int type = 0;
+    for (size_t row = 0; row < num_rows_; row++) {
+      auto & v = rows_[row * num_columns + col];
+      if (std::holds_alternative<std::string>(v)) type = 3;
+      else if (std::holds_alternative<double>(v)) type = std::max(type, 2);
+      else if (std::holds_alternative<long long>(v)) type = std::max(type, 1);
+    }
+
+    auto & b = bind[col];
+    auto & ind = indicators[col];
+    ind.resize(num_rows_);
+    b.u_indicator = ind.data();
+
+    for (size_t row = 0; row < num_rows_; row++) {
+      auto & v = rows_[row * num_columns + col];
+      ind[row] = std::holds_alternative<std::monostate>(v) ? STMT_INDICATOR_NULL : STMT_INDICATOR_NONE;
+    }
+
+    if (type == 1) {
+      auto & values = int_values[col];
+      values.resize(num_rows_);
+      for (size_t row = 0; row < num_rows_; row++) {
+	auto & v = rows_[row * num_columns + col];
+	if (std::holds_alternative<long long>(v)) values[row] = std::get<long long>(v);
+      }
+      b.buffer_type = MYSQL_TYPE_LONGLONG;
+      b.buffer = values.data();
+    } else if (type == 2) {
+      auto & values = double_values[col];
+      values.resize(num_rows_);
+      for (size_t row = 0; row < num_rows_; row++) {
+	auto & v = rows_[row * num_columns + col];
+	if (std::holds_alternative<double>(v)) values[row] = std::get<double>(v);
+	else if (std::holds_alternative<long long>(v)) values[row] = static_cast<double>(std::get<long long>(v));
+      }
+      b.buffer_type = MYSQL_TYPE_DOUBLE;
+      b.buffer = values.data();
+    } else {
+      auto & values = string_values[col];
+      auto & len = lengths[col];
+      values.resize(num_rows_);
+      len.resize(num_rows_);
+      for (size_t row = 0; row < num_rows_; row++) {
+	auto & v = rows_[row * num_columns + col];
+	if (std::holds_alternative<long long>(v)) v = std::to_string(std::get<long long>(v));
+	else if (std::holds_alternative<double>(v)) v = format_number(std::get<double>(v));
+	if (std::holds_alternative<std::string>(v)) {
+	  auto & s = std::get<std::string>(v);
+	  values[row] = s.data();
+	  len[row] = s.size();
+	}
+      }
+      // for column-wise binding the buffer is an array of pointers to the values
+      b.buffer_type = MYSQL_TYPE_STRING;
+      b.buffer = values.data();
+      b.length = len.data();
+    }
+  }
+
+  bool ok = mysql_stmt_bind_param(array_stmt_, bind.data()) == 0 && mysql_stmt_execute(array_stmt_) == 0;
+  // the rows are dropped even if the statement fails, since the server may
+  // have inserted some of them, and a retry must not insert them again
+  dropRows(num_rows_);
+  if (!ok) {
+    throw SQLException(SQLException::EXECUTE_FAILED, mysql_stmt_error(array_stmt_));
+  }
+
+  rows_affected_ += mysql_stmt_affected_rows(array_stmt_);
+  last_insert_id_ = mysql_stmt_insert_id(array_stmt_);
+  
+  return true;
+#else
+  has_array_binding_ = false;
+  return false;
+#endif
+}
+
+void
+MySQLBulkInsert::flushMultiRow() {
+  auto num_columns = columns_.size();
+  // the number of placeholders in a statement is limited to 65535
+  auto max_rows = std::max(static_cast<size_t>(1), std::min(batch_size_, 65535 / num_columns));
+
+  // each statement takes its rows from the front of the buffer
+  while (num_rows_) {
+    auto n = std::min(num_rows_, max_rows);
+
+    std::unique_ptr<SQLStatement> tmp;
+    SQLStatement * stmt;
+    if (n == max_rows) {
+      if (!batch_stmt_ || batch_stmt_rows_ != n) {
+	batch_stmt_ = conn_.prepare(makeQuery(n));
+	batch_stmt_rows_ = n;
+      }
+      stmt = batch_stmt_.get();
+    } else {
+      tmp = conn_.prepare(makeQuery(n));
+      stmt = tmp.get();
+    }
+
+    stmt->reset();
+    for (size_t i = 0; i < n * num_columns; i++) {
+      auto & v = rows_[i];
+      if (std::holds_alternative<long long>(v)) {
+	stmt->set(static_cast<int>(i), std::get<long long>(v));
+      } else if (std::holds_alternative<double>(v)) {
+	stmt->set(static_cast<int>(i), std::get<double>(v));
+      } else if (std::holds_alternative<std::string>(v)) {
+	stmt->set(static_cast<int>(i), std::string_view(std::get<std::string>(v)));
+      } else {
+	stmt->set(static_cast<int>(i), 0, false);
+      }
+    }
+    // the rows of a failed statement are dropped as well, so that a retry
+    // only sends the rows that weren't sent yet
+    try {
+      stmt->execute();
+    } catch (...) {
+      dropRows(n);
+      throw;
+    }
+    dropRows(n);
+
+    rows_affected_ += stmt->getAffectedRows();
+    last_insert_id_ = stmt->getLastInsertId();
   }
 }
@@ -0,0 +1,183 @@
+#include <MySQLPool.h>
+
+#include <SQLException.h>
+
+#include <vector>
+
+using namespace std;
+using namespace sqldb;
+
+void
+MySQLConnectionHandle::release() {
+  if (pool_ && conn_) {
+    pool_->release(std::move(conn_));
+  }
+}
+
+MySQLPool::MySQLPool(std::string host_name, int port, std::string user_name, std::string password, std::string db_name, size_t min_size, size_t max_size)
+  : host_name_(std::move(host_name)),
+    user_name_(std::move(user_name)),
+    password_(std::move(password)),
+    db_name_(std::move(db_name)),
+    port_(port),
+    min_size_(min_size),
+    max_size_(max_size < min_size ? min_size : max_size)
+{
+  for (size_t i = 0; i < min_size_; i++) {
+    idle_.push_back(IdleConnection{ create(), std::chrono::steady_clock::now() });
+    num_open_++;
+  }
+}
+
+MySQLPool::~MySQLPool() {
+  // all connections must have been returned to the pool at this point
+  std::lock_guard<std::mutex> guard(mutex_);
+  idle_.clear();
+}
+
+MySQLConnectionHandle
+MySQLPool::acquire(std::chrono::milliseconds timeout) {
+  auto start = std::chrono::steady_clock::now();
+  auto deadline = start + timeout;
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  while ( 1 ) {
+    std::unique_ptr<MySQL> conn;
+
+    if (!idle_.empty()) {
+      // use the most recently returned connection since it's the most likely to be alive
+      auto idle = std::move(idle_.back());
+      idle_.pop_back();
+      bool needs_check = std::chrono::steady_clock::now() - idle.idle_since >= ping_interval_;
+
+      lock.unlock();
+      bool is_valid = !needs_check || check(*idle.conn);
+      lock.lock();
+
+      if (!is_valid) {
+	num_open_--;
+	cv_.notify_one();
+	continue;
+      }
+      conn = std::move(idle.conn);
+    } else if (num_open_ < max_size_) {
+      num_open_++;
+      lock.unlock();
+      try {
+	conn = create();
+      } catch (...) {
+	lock.lock();
+	num_open_--;
+	cv_.notify_one();
+	throw;
+      }
+      lock.lock();
+    } else {
+      if (cv_.wait_until(lock, deadline) == std::cv_status::timeout && idle_.empty() && num_open_ >= max_size_) {
+	stats_.num_timeouts++;
+	throw SQLException(SQLException::CONNECTION_FAILED, "Timed out waiting for a connection from the pool");
+      }
+      continue;
+    }
+
+    auto wait = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+    stats_.num_checkouts++;
+    stats_.total_wait += wait;
+    if (wait > stats_.max_wait) stats_.max_wait = wait;
+
+    return MySQLConnectionHandle(this, std::move(conn));
+  }
+}
+
+void
+MySQLPool::maintain() {
+  std::vector<std::unique_ptr<MySQL>> to_check;
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    auto now = std::chrono::steady_clock::now();
+    for (auto it = idle_.begin(); it != idle_.end(); ) {
+      if (now - it->idle_since >= ping_interval_) {
+	to_check.push_back(std::move(it->conn));
+	it = idle_.erase(it);
+      } else {
+	it++;
+      }
+    }
+  }
+
+  for (auto & conn : to_check) {
+    if (!check(*conn)) conn.reset();
+    release(std::move(conn));
+  }
+
+  while ( 1 ) {
+    {
+      std::lock_guard<std::mutex> guard(mutex_);
+      if (num_open_ >= min_size_) break;
+      num_open_++;
+    }
+    std::unique_ptr<MySQL> conn;
+    try {
+      conn = create();
+    } catch (SQLException & e) {
+      std::lock_guard<std::mutex> guard(mutex_);
+      num_open_--;
+      break;
+    }
+    release(std::move(conn));
+  }
+}
+
+size_t
+MySQLPool::size() const {
+  std::lock_guard<std::mutex> guard(mutex_);
+  return num_open_;
+}
+
+size_t
+MySQLPool::getNumIdle() const {
+  std::lock_guard<std::mutex> guard(mutex_);
+  return idle_.size();
+}
+
+MySQLPool::Stats
+MySQLPool::getStats() const {
+  std::lock_guard<std::mutex> guard(mutex_);
+  return stats_;
+}
+
+void
+MySQLPool::release(std::unique_ptr<MySQL> conn) {
+  // the next user must not inherit a transaction or a pending result, so
+  // connections that can't be reset are closed
+  bool is_reusable = conn && conn->isConnected() && conn->resetState();
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    if (is_reusable) {
+      idle_.push_back(IdleConnection{ std::move(conn), std::chrono::steady_clock::now() });
+    } else {
+      num_open_--;
+    }
+  }
+  cv_.notify_one();
+}
+
+std::unique_ptr<MySQL>
+MySQLPool::create() {
+  auto conn = std::make_unique<MySQL>();
+  conn->setReconnectPolicy(max_reconnect_attempts_, reconnect_backoff_);
+  conn->connect(host_name_, port_, user_name_, password_, db_name_);
+  return conn;
+}
+
+bool
+MySQLPool::check(MySQL & conn) {
+  if (conn.ping()) {
+    return true;
+  }
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    stats_.num_reconnects++;
+  }
+  return conn.reconnect();
+}
@@ -1,261 +1,763 @@
 #include "ODBC.h"
 
-#include <sqlext.h>
+#include "SQLException.h"
+
+#include <charconv>
+#include <cstring>
 
 using namespace std;
 using namespace sqldb;
 
-ODBCStatement::ODBCStatement(stmt)
-  : stmt(_stmt) {
-  
-}
+// Largest buffer that is bound for a single value. Longer values are read
+// again with SQLGetData.
+#define ODBC_BIND_BUFFER_SIZE 4096
+// Upper limit for the result buffers of a statement
+#define ODBC_RESULT_BUFFER_SIZE (16 * 1024 * 1024)
 
-ODBCStatement::~ODBCStatement() {
-  SQLFreeHandle(SQL_HANDLE_STMT, stmt);
+static std::string get_error(SQLSMALLINT handle_type, SQLHANDLE handle) {
+  if (!handle) return "Invalid handle";
+
+  std::string r;
+  SQLCHAR state[6], msg[1024];
+  SQLINTEGER native_error;
+  SQLSMALLINT len;
+  for (SQLSMALLINT i = 1; SQL_SUCCEEDED(SQLGetDiagRec(handle_type, handle, i, state, &native_error, msg, sizeof(msg), &len)); i++) {
+    if (!r.empty()) r += "\n";
+    r += reinterpret_cast<char *>(state);
+    r += ": ";
+    r += reinterpret_cast<char *>(msg);
+  }
+  return r;
 }
 
-void
-ODBCStatement::clearBoundData() {
-  while (!bound_data.empty()) {
-    query_data & d = bound_data.back();
-    delete[] d.ptr;
-    bound_data.pop_back();
-  }
-}
-
-unsigned int
-ODBCStatement::getAffectedRows() {
-  if (!stmt) return false;
-  SQLLEN count;
-  if (SQL_SUCCEEDED(SQLRowCount(stmt, &count))) {
-    if (count >= 0) {
-      return (unsigned int)count;
-    } else {
-      // fprintf(stderr, "SQLRowCount returned %d\n", count);
-    }
-  } else {
-    error_string = CreateErrorString(SQL_HANDLE_STMT, stmt);
-    // fprintf(stderr, "SQLRowCount failed: %s\n", error_string.c_str()); 
+// Encloses connection string values with special characters in braces
+static std::string quote_attribute(const std::string & value) {
+  if (value.find_first_of(";{}=") == std::string::npos) return value;
+  std::string r = "{";
+  for (auto c : value) {
+    if (c == '}') r += "}}";
+    else r += c;
   }
-  return 0;
+  r += "}";
+  return r;
 }
 
-ODBC::ODBC(const string & _dsn, const string & _username, const string & _password)
-  : dsn(_dsn),
-    username(_username),
-    password(_password)
+ODBC::ODBC(std::string dsn, std::string user_name, std::string password)
+  : dsn_(std::move(dsn)),
+    user_name_(std::move(user_name)),
+    password_(std::move(password))
 {
-  nts = SQL_NTS;
 }
 
 ODBC::~ODBC() {
   disconnect();
 }
 
-bool
+void
 ODBC::disconnect() {
-  clearBoundData();
-  if (dbc) {
-    SQLDisconnect(dbc);
-    SQLFreeHandle(SQL_HANDLE_DBC, dbc);
+  if (dbc_) {
+    SQLDisconnect(dbc_);
+    SQLFreeHandle(SQL_HANDLE_DBC, dbc_);
+    dbc_ = SQL_NULL_HDBC;
   }
-  if (env) {
-    SQLFreeHandle(SQL_HANDLE_ENV, env);
+  if (env_) {
+    SQLFreeHandle(SQL_HANDLE_ENV, env_);
+    env_ = SQL_NULL_HENV;
   }
-  return true;
 }
 
-bool
+void
 ODBC::connect() {
-  // retcode = SQLAllocEnv(&henv);
-  if (!SQL_SUCCEEDED(SQLAllocHandle(SQL_HANDLE_ENV, SQL_NULL_HANDLE, &env))) {
-    error_string = "Failed to create ODBC environment";
-    // cerr << "ODBC connect failed: " << error_string << endl;
-    return false;
-  }
+  disconnect();
 
-  if (!SQL_SUCCEEDED(SQLSetEnvAttr(env, SQL_ATTR_ODBC_VERSION, (void *) SQL_OV_ODBC3, 0))) {
-    error_string = "Failed to set ODBC version";
-    // cerr << "ODBC connect failed: " << error_string << endl;
-    return false;
+  if (!SQL_SUCCEEDED(SQLAllocHandle(SQL_HANDLE_ENV, SQL_NULL_HANDLE, &env_))) {
+    env_ = SQL_NULL_HENV;
+    throw SQLException(SQLException::INIT_FAILED, "Failed to create ODBC environment");
   }
-
-#if 0
-  if (!SQL_SUCCEEDED(SQLSetEnvAttr(env, SQL_ATTR_AUTOCOMMIT, (void *) SQL_AUTOCOMMIT_ON, 0))) {
-    error_string = "Failed to set auto commit";
-    // fprintf(stderr, "ODBC connect failed: %s\n", error_string.c_str());
-    return false;
+  if (!SQL_SUCCEEDED(SQLSetEnvAttr(env_, SQL_ATTR_ODBC_VERSION, (SQLPOINTER)SQL_OV_ODBC3, 0))) {
+    std::string errmsg = get_error(SQL_HANDLE_ENV, env_);
+    disconnect();
+    throw SQLException(SQLException::INIT_FAILED, errmsg);
   }
-#endif
-  
-  if (!SQL_SUCCEEDED(SQLAllocHandle(SQL_HANDLE_DBC, env, &dbc))) {
-    error_string = "Failed to create ODBC connection handle";
-    // cerr << "ODBC connect failed: " << error_string << endl;
-    return false;
+  if (!SQL_SUCCEEDED(SQLAllocHandle(SQL_HANDLE_DBC, env_, &dbc_))) {
+    std::string errmsg = get_error(SQL_HANDLE_ENV, env_);
+    dbc_ = SQL_NULL_HDBC;
+    disconnect();
+    throw SQLException(SQLException::INIT_FAILED, errmsg);
   }
-  
-  string conn_str = "DSN=" + dsn + ";UID=" + username + ";PWD=" + password;
 
-  SQLCHAR tmp[256];
-  strncpy((char*)tmp, conn_str.c_str(), 256);
-  tmp[255] = 0;
+  std::string conn_str;
+  if (dsn_.find('=') != std::string::npos) {
+    conn_str = dsn_;
+    while (!conn_str.empty() && conn_str.back() == ';') conn_str.pop_back();
+  } else {
+    conn_str = "DSN=" + quote_attribute(dsn_);
+  }
+  if (!user_name_.empty()) conn_str += ";UID=" + quote_attribute(user_name_);
+  if (!password_.empty()) conn_str += ";PWD=" + quote_attribute(password_);
 
-  // cerr << "trying to connect to ODBC database, dsn = \"" << tmp << "\"\n";
-  // if (SQLConnect(dbc, dsn.c_str(), dsn.size(), "hr", SQL_NTS, "hr", SQL_NTS) != SQL_SUCCESS) {
-  if (!SQL_SUCCEEDED(SQLDriverConnect(dbc, 0, tmp, SQL_NTS, 0, 0, 0, SQL_DRIVER_NOPROMPT))) {
-    // printSQLError(2, hdbc);
-    error_string = "Failed to connect to ODBC database";
-    // cerr << "ODBC connect failed: " << error_string << endl;
-    return false;
+  auto r = SQLDriverConnect(dbc_, 0, reinterpret_cast<SQLCHAR *>(conn_str.data()), static_cast<SQLSMALLINT>(conn_str.size()), 0, 0, 0, SQL_DRIVER_NOPROMPT);
+  if (!SQL_SUCCEEDED(r)) {
+    std::string errmsg = get_error(SQL_HANDLE_DBC, dbc_);
+    SQLFreeHandle(SQL_HANDLE_DBC, dbc_);
+    dbc_ = SQL_NULL_HDBC;
+    disconnect();
+    throw SQLException(SQLException::CONNECTION_FAILED, errmsg);
   }
-  
-  return true;
+}
+
+std::unique_ptr<SQLStatement>
+ODBC::prepare(std::string_view query) {
+  return prepareBatch(query, 1);
 }
 
 std::unique_ptr<ODBCStatement>
-ODBC::prepare(const string & query) {
-  clearBoundData();
-
-  HSTMT stmt;
-  
-  if (!SQL_SUCCEEDED(SQLAllocHandle(SQL_HANDLE_STMT, dbc, &stmt))) {
-    error_string = "Failed to create statement handle";
-    // cerr << "ODBC connect failed: " << error_string << endl;
-    return false;
+ODBC::prepareBatch(std::string_view query, size_t batch_size) {
+  if (!dbc_) {
+    throw SQLException(SQLException::PREPARE_FAILED, "Not connected");
   }
-  
-  query_data & qd = bindData(query.c_str(), query.size());
-  if (!SQL_SUCCEEDED(SQLPrepare(stmt, qd.ptr, qd.size))) {
-    // fprintf(stderr, "ODBC prepare failed\n");
-    return false;
+  SQLHSTMT stmt = SQL_NULL_HSTMT;
+  if (!SQL_SUCCEEDED(SQLAllocHandle(SQL_HANDLE_STMT, dbc_, &stmt))) {
+    throw SQLException(SQLException::PREPARE_FAILED, get_error(SQL_HANDLE_DBC, dbc_), std::string(query));
+  }
+  std::string query_str(query);
+  if (!SQL_SUCCEEDED(SQLPrepare(stmt, reinterpret_cast<SQLCHAR *>(query_str.data()), static_cast<SQLINTEGER>(query_str.size())))) {
+    std::string errmsg = get_error(SQL_HANDLE_STMT, stmt);
+    SQLFreeHandle(SQL_HANDLE_STMT, stmt);
+    throw SQLException(SQLException::PREPARE_FAILED, errmsg, query_str);
   }
-  return true;
+  return std::make_unique<ODBCStatement>(stmt, std::move(query_str), batch_size ? batch_size : 1, row_array_size_);
 }
 
-bool
-ODBC::Finalize() {
-#if 0
-  if (!SQL_SUCCEEDED(SQLCloseCursor(stmt))) {
-    // fprintf(stderr, "ODBC close cursor failed\n");
-    return false;
+void
+ODBC::begin() {
+  if (!dbc_) {
+    throw SQLException(SQLException::DATABASE_MISUSE, "Not connected");
+  }
+  if (!SQL_SUCCEEDED(SQLSetConnectAttr(dbc_, SQL_ATTR_AUTOCOMMIT, (SQLPOINTER)SQL_AUTOCOMMIT_OFF, SQL_IS_UINTEGER))) {
+    throw SQLException(SQLException::DATABASE_ERROR, get_error(SQL_HANDLE_DBC, dbc_));
   }
-#endif
-  ClearBoundData();
-  return true;
 }
 
-ODBC::query_data &
-ODBC::bindData(const void * ptr, size_t size) {
-  query_data d;
-  d.size = (SQLINTEGER)size;
-  d.ptr = new unsigned char[size];
-  memcpy(d.ptr, ptr, size);
-  bound_data.push_back(d);
-  return bound_data.back();
+void
+ODBC::commit() {
+  endTransaction(SQL_COMMIT);
 }
 
-bool
-ODBC::bind(unsigned int index, unsigned int value) {
-  if (!stmt) return false;
-  query_data & qd = BindData(&value, sizeof(value));
-  if (!SQL_SUCCEEDED(SQLBindParameter(stmt, index, SQL_PARAM_INPUT, SQL_C_ULONG,
-				      SQL_INTEGER, 0, 0, qd.ptr, qd.size, &qd.size))) {
-    // fprintf(stderr, "ODBC failed to bind\n");
-    return false;
+void
+ODBC::rollback() {
+  endTransaction(SQL_ROLLBACK);
+}
+
+void
+ODBC::endTransaction(SQLSMALLINT completion_type) {
+  if (!dbc_) {
+    throw SQLException(SQLException::DATABASE_MISUSE, "Not connected");
+  }
+  std::string errmsg;
+  bool failed = !SQL_SUCCEEDED(SQLEndTran(SQL_HANDLE_DBC, dbc_, completion_type));
+  if (failed) errmsg = get_error(SQL_HANDLE_DBC, dbc_);
+
+  // return to auto-commit mode until the next begin()
+  SQLSetConnectAttr(dbc_, SQL_ATTR_AUTOCOMMIT, (SQLPOINTER)SQL_AUTOCOMMIT_ON, SQL_IS_UINTEGER);
+
+  if (failed) {
+    throw SQLException(completion_type == SQL_COMMIT ? SQLException::COMMIT_FAILED : SQLException::ROLLBACK_FAILED, errmsg);
   }
-  return true;
 }
 
 bool
-ODBC::bind(unsigned int index, int value) {
-  if (!stmt) return false;
-  query_data & qd = BindData(&value, sizeof(value));
-  if (!SQL_SUCCEEDED(SQLBindParameter(stmt, index, SQL_PARAM_INPUT, SQL_C_SLONG,
-				      SQL_INTEGER, 0, 0, qd.ptr, qd.size, &qd.size))) {
-    // fprintf(stderr, "ODBC failed to bind\n");
-    return false;
+ODBC::ping() {
+  if (!dbc_) return false;
+  SQLUINTEGER dead = 0;
+  if (!SQL_SUCCEEDED(SQLGetConnectAttr(dbc_, SQL_ATTR_CONNECTION_DEAD, &dead, SQL_IS_UINTEGER, 0))) {
+    // the driver can't tell
+    return true;
   }
-  return true;
+  return dead != SQL_CD_TRUE;
 }
 
-bool
-ODBC::bind(unsigned int index, double value) {
-  if (!stmt) return false;
-  query_data & qd = BindData(&value, sizeof(value));
-  if (!SQL_SUCCEEDED(SQLBindParameter(stmt, index, SQL_PARAM_INPUT, SQL_C_DOUBLE, SQL_DOUBLE, 0, 0, qd.ptr, qd.size, &qd.size))) {
-    // fprintf(stderr, "ODBC failed to bind\n");
-    return false;
+ODBCStatement::ODBCStatement(SQLHSTMT stmt, std::string query, size_t batch_size, size_t row_array_size)
+  : stmt_(stmt), query_(std::move(query)), batch_size_(batch_size), row_array_size_(row_array_size)
+{
+  SQLSMALLINT n = 0;
+  if (SQL_SUCCEEDED(SQLNumParams(stmt_, &n)) && n > 0) {
+    num_params_ = static_cast<size_t>(n);
+  }
+  pending_row_.resize(num_params_);
+  params_.resize(num_params_);
+  if (batch_size_ > 1 && num_params_) {
+    rows_.reserve(num_params_ * batch_size_);
+    param_status_.resize(batch_size_);
+    SQLSetStmtAttr(stmt_, SQL_ATTR_PARAM_BIND_TYPE, (SQLPOINTER)SQL_PARAM_BIND_BY_COLUMN, 0);
+    SQLSetStmtAttr(stmt_, SQL_ATTR_PARAM_STATUS_PTR, param_status_.data(), 0);
+    SQLSetStmtAttr(stmt_, SQL_ATTR_PARAMS_PROCESSED_PTR, &params_processed_, 0);
   }
-  return true;
 }
 
-bool
-ODBC::bind(unsigned int index, const string & str) {
-  return Bind(index, str.c_str());
+ODBCStatement::~ODBCStatement() {
+  if (batch_size_ > 1) {
+    try {
+      flush();
+    } catch (SQLException & e) {
+    }
+  }
+  closeCursor();
+  SQLFreeHandle(SQL_HANDLE_STMT, stmt_);
+}
+
+size_t
+ODBCStatement::execute() {
+  if (batch_size_ > 1) {
+    for (auto & v : pending_row_) {
+      rows_.push_back(std::move(v));
+      v = Value();
+    }
+  } else {
+    rows_ = pending_row_;
+  }
+  num_rows_++;
+  is_executed_ = true;
+
+  // the next row is bound from the first column again
+  SQLStatement::reset();
+
+  if (batch_size_ > 1) {
+    if (num_rows_ >= batch_size_) flush();
+    return 1;
+  }
+
+  rows_affected_ = 0;
+  flush();
+
+  SQLSMALLINT num_columns = 0;
+  if (SQL_SUCCEEDED(SQLNumResultCols(stmt_, &num_columns)) && num_columns > 0) {
+    if (columns_.size() != static_cast<size_t>(num_columns)) {
+      bindResults(static_cast<size_t>(num_columns));
+    }
+    has_cursor_ = true;
+    results_available_ = fetch();
+  }
+  return rows_affected_;
+}
+
+void
+ODBCStatement::flush() {
+  if (!num_rows_) return;
+
+  closeCursor();
+
+  size_t n = num_rows_;
+  bindParams();
+  rows_.clear();
+  num_rows_ = 0;
+
+  SQLULEN paramset_size = n;
+  if (n > 1 && has_param_arrays_) {
+    // the driver may replace the value with the largest size it supports
+    SQLSetStmtAttr(stmt_, SQL_ATTR_PARAMSET_SIZE, (SQLPOINTER)paramset_size, 0);
+    SQLULEN actual = 1;
+    SQLGetStmtAttr(stmt_, SQL_ATTR_PARAMSET_SIZE, &actual, 0, 0);
+    paramset_size_ = actual;
+    if (actual != paramset_size) has_param_arrays_ = false;
+  }
+  if (n > 1 && !has_param_arrays_) {
+    paramset_size = 1;
+  }
+  if (paramset_size != paramset_size_) {
+    SQLSetStmtAttr(stmt_, SQL_ATTR_PARAMSET_SIZE, (SQLPOINTER)paramset_size, 0);
+    paramset_size_ = paramset_size;
+  }
+
+  if (paramset_size == n) {
+    bindParamRow(0);
+    executeOnce();
+  } else {
+    for (size_t i = 0; i < n; i++) {
+      bindParamRow(i);
+      executeOnce();
+    }
+  }
+}
+
+void
+ODBCStatement::executeOnce() {
+  auto r = SQLExecute(stmt_);
+  if (!SQL_SUCCEEDED(r) && r != SQL_NO_DATA) {
+    throw SQLException(SQLException::EXECUTE_FAILED, get_error(SQL_HANDLE_STMT, stmt_), query_);
+  }
+  if (paramset_size_ > 1) {
+    size_t num_failed = 0;
+    for (size_t i = 0; i < params_processed_ && i < paramset_size_; i++) {
+      if (param_status_[i] == SQL_PARAM_ERROR) num_failed++;
+    }
+    if (num_failed) {
+      throw SQLException(SQLException::EXECUTE_FAILED, std::to_string(num_failed) + " of " + std::to_string(paramset_size_) + " rows failed: " + get_error(SQL_HANDLE_STMT, stmt_), query_);
+    }
+  }
+
+  SQLLEN count = 0;
+  if (SQL_SUCCEEDED(SQLRowCount(stmt_, &count)) && count > 0) {
+    rows_affected_ += static_cast<size_t>(count);
+  }
+  if (batch_size_ > 1) {
+    // some drivers return a row count for each parameter set
+    while (SQL_SUCCEEDED(SQLMoreResults(stmt_))) {
+      if (SQL_SUCCEEDED(SQLRowCount(stmt_, &count)) && count > 0) {
+	rows_affected_ += static_cast<size_t>(count);
+      }
+    }
+    SQLFreeStmt(stmt_, SQL_CLOSE);
+  }
+}
+
+void
+ODBCStatement::bindParams() {
+  size_t n = num_rows_;
+  for (size_t j = 0; j < num_params_; j++) {
+    auto & p = params_[j];
+
+    // use the narrowest C type that represents all the values of the column
+    enum { NONE = 0, INTEGER, REAL, TEXT, BINARY } kind = NONE;
+    size_t max_len = 0;
+    bool has_numbers = false;
+    for (size_t i = 0; i < n; i++) {
+      auto & v = rows_[i * num_params_ + j];
+      switch (v.index()) {
+      case 1: if (kind < INTEGER) kind = INTEGER; has_numbers = true; break;
+      case 2: if (kind < REAL) kind = REAL; has_numbers = true; break;
+      case 3:
+	if (kind < TEXT) kind = TEXT;
+	max_len = std::max(max_len, std::get<std::string>(v).size());
+	break;
+      case 4:
+	kind = BINARY;
+	max_len = std::max(max_len, std::get<std::vector<uint8_t>>(v).size());
+	break;
+      }
+    }
+    // numbers converted to text need at most 32 characters
+    if (kind >= TEXT && has_numbers && max_len < 32) max_len = 32;
+
+    switch (kind) {
+    case NONE:
+      p.c_type = SQL_C_CHAR;
+      p.sql_type = SQL_VARCHAR;
+      p.width = 1;
+      break;
+    case INTEGER:
+      p.c_type = SQL_C_SBIGINT;
+      p.sql_type = SQL_BIGINT;
+      p.width = sizeof(long long);
+      break;
+    case REAL:
+      p.c_type = SQL_C_DOUBLE;
+      p.sql_type = SQL_DOUBLE;
+      p.width = sizeof(double);
+      break;
+    case TEXT:
+      p.c_type = SQL_C_CHAR;
+      p.sql_type = max_len > 8000 ? SQL_LONGVARCHAR : SQL_VARCHAR;
+      p.width = max_len ? static_cast<SQLLEN>(max_len) : 1;
+      break;
+    case BINARY:
+      p.c_type = SQL_C_BINARY;
+      p.sql_type = max_len > 8000 ? SQL_LONGVARBINARY : SQL_VARBINARY;
+      p.width = max_len ? static_cast<SQLLEN>(max_len) : 1;
+      break;
+    }
+
+    p.data.resize(n * p.width);
+    p.indicators.resize(n);
+    for (size_t i = 0; i < n; i++) {
+      auto & v = rows_[i * num_params_ + j];
+      auto ptr = p.data.data() + i * p.width;
+      auto & ind = p.indicators[i];
+      switch (v.index()) {
+      case 0:
+	ind = SQL_NULL_DATA;
+	break;
+      case 1:
+	if (kind == INTEGER) {
+	  memcpy(ptr, &std::get<long long>(v), sizeof(long long));
+	  ind = sizeof(long long);
+	} else if (kind == REAL) {
+	  double d = static_cast<double>(std::get<long long>(v));
+	  memcpy(ptr, &d, sizeof(double));
+	  ind = sizeof(double);
+	} else {
+	  ind = std::to_chars(ptr, ptr + p.width, std::get<long long>(v)).ptr - ptr;
+	}
+	break;
+      case 2:
+	if (kind == REAL) {
+	  memcpy(ptr, &std::get<double>(v), sizeof(double));
+	  ind = sizeof(double);
+	} else {
+	  ind = std::to_chars(ptr, ptr + p.width, std::get<double>(v)).ptr - ptr;
+	}
+	break;
+      case 3: {
+	auto & s = std::get<std::string>(v);
+	memcpy(ptr, s.data(), s.size());
+	ind = static_cast<SQLLEN>(s.size());
+      }
+	break;
+      case 4: {
+	auto & b = std::get<std::vector<uint8_t>>(v);
+	memcpy(ptr, b.data(), b.size());
+	ind = static_cast<SQLLEN>(b.size());
+      }
+	break;
+      }
+    }
+  }
+}
+
+void
+ODBCStatement::bindParamRow(size_t row) {
+  for (size_t j = 0; j < num_params_; j++) {
+    auto & p = params_[j];
+    auto r = SQLBindParameter(stmt_, static_cast<SQLUSMALLINT>(j + 1), SQL_PARAM_INPUT, p.c_type, p.sql_type, p.width, 0, p.data.data() + row * p.width, p.width, p.indicators.data() + row);
+    if (!SQL_SUCCEEDED(r)) {
+      throw SQLException(SQLException::BIND_FAILED, get_error(SQL_HANDLE_STMT, stmt_), query_);
+    }
+  }
+}
+
+void
+ODBCStatement::bindResults(size_t num_columns) {
+  SQLFreeStmt(stmt_, SQL_UNBIND);
+  columns_.clear();
+  columns_.resize(num_columns);
+
+  size_t row_width = 0;
+  for (size_t i = 0; i < num_columns; i++) {
+    auto & col = columns_[i];
+    SQLCHAR name[256];
+    SQLSMALLINT name_len = 0, sql_type = 0, decimals = 0, nullable = 0;
+    SQLULEN size = 0;
+    if (!SQL_SUCCEEDED(SQLDescribeCol(stmt_, static_cast<SQLUSMALLINT>(i + 1), name, sizeof(name), &name_len, &sql_type, &size, &decimals, &nullable))) {
+      throw SQLException(SQLException::EXECUTE_FAILED, get_error(SQL_HANDLE_STMT, stmt_), query_);
+    }
+    col.name.assign(reinterpret_cast<char *>(name), std::min<size_t>(name_len, sizeof(name) - 1));
+
+    switch (sql_type) {
+    case SQL_BIT:
+    case SQL_TINYINT:
+    case SQL_SMALLINT:
+    case SQL_INTEGER:
+    case SQL_BIGINT:
+      col.type = sql_type == SQL_BIT ? ColumnType::BOOL : (sql_type == SQL_BIGINT ? ColumnType::INT64 : ColumnType::INT);
+      col.c_type = SQL_C_SBIGINT;
+      col.width = sizeof(long long);
+      break;
+    case SQL_REAL:
+    case SQL_FLOAT:
+    case SQL_DOUBLE:
+      col.type = sql_type == SQL_REAL ? ColumnType::FLOAT : ColumnType::DOUBLE;
+      col.c_type = SQL_C_DOUBLE;
+      col.width = sizeof(double);
+      break;
+    case SQL_BINARY:
+    case SQL_VARBINARY:
+    case SQL_LONGVARBINARY:
+      col.type = ColumnType::BLOB;
+      col.c_type = SQL_C_BINARY;
+      col.width = size && size < ODBC_BIND_BUFFER_SIZE ? static_cast<SQLLEN>(size) : ODBC_BIND_BUFFER_SIZE;
+      break;
+    default:
+      // dates and decimals are read as text
+      if (sql_type == SQL_LONGVARCHAR || sql_type == SQL_WLONGVARCHAR) col.type = ColumnType::TEXT;
+      else if (sql_type == SQL_DECIMAL || sql_type == SQL_NUMERIC) col.type = ColumnType::DOUBLE;
+      else col.type = ColumnType::VARCHAR;
+      col.c_type = SQL_C_CHAR;
+      // UTF-8 needs up to four bytes per character, and one more for the terminator
+      col.width = size && size < ODBC_BIND_BUFFER_SIZE / 4 ? static_cast<SQLLEN>(size * 4 + 1) : ODBC_BIND_BUFFER_SIZE;
+      break;
+    }
+    row_width += col.width + sizeof(SQLLEN);
+  }
+
+  SQLULEN rows = row_array_size_;
+  if (row_width * rows > ODBC_RESULT_BUFFER_SIZE) {
+    rows = std::max<SQLULEN>(1, ODBC_RESULT_BUFFER_SIZE / row_width);
+  }
+  SQLSetStmtAttr(stmt_, SQL_ATTR_ROW_BIND_TYPE, (SQLPOINTER)SQL_BIND_BY_COLUMN, 0);
+  SQLSetStmtAttr(stmt_, SQL_ATTR_ROW_ARRAY_SIZE, (SQLPOINTER)rows, 0);
+  // the driver may replace the value with the largest size it supports
+  SQLULEN actual = 1;
+  if (SQL_SUCCEEDED(SQLGetStmtAttr(stmt_, SQL_ATTR_ROW_ARRAY_SIZE, &actual, 0, 0)) && actual > 0) {
+    rows = actual;
+  } else {
+    rows = 1;
+  }
+  row_status_.resize(rows);
+  SQLSetStmtAttr(stmt_, SQL_ATTR_ROW_STATUS_PTR, row_status_.data(), 0);
+  SQLSetStmtAttr(stmt_, SQL_ATTR_ROWS_FETCHED_PTR, &rows_fetched_, 0);
+
+  for (size_t i = 0; i < num_columns; i++) {
+    auto & col = columns_[i];
+    col.data.resize(rows * col.width);
+    col.indicators.resize(rows);
+    if (!SQL_SUCCEEDED(SQLBindCol(stmt_, static_cast<SQLUSMALLINT>(i + 1), col.c_type, col.data.data(), col.width, col.indicators.data()))) {
+      throw SQLException(SQLException::EXECUTE_FAILED, get_error(SQL_HANDLE_STMT, stmt_), query_);
+    }
+  }
 }
 
 bool
-ODBC::bind(unsigned int index, const char * str) {
-  if (!stmt) return false;
-  query_data & qd = BindData(str, strlen(str));
-  if (!SQL_SUCCEEDED(SQLBindParameter(stmt, index, SQL_PARAM_INPUT, SQL_C_CHAR,
-				      SQL_CHAR, 0, 0, qd.ptr, qd.size, &qd.size))) {
-    // fprintf(stderr, "ODBC failed to bind\n");
+ODBCStatement::fetch() {
+  current_row_ = 0;
+  rows_fetched_ = 0;
+  auto r = SQLFetch(stmt_);
+  if (r == SQL_NO_DATA) {
+    closeCursor();
     return false;
+  } else if (!SQL_SUCCEEDED(r)) {
+    std::string errmsg = get_error(SQL_HANDLE_STMT, stmt_);
+    closeCursor();
+    throw SQLException(SQLException::DATABASE_ERROR, errmsg, query_);
   }
-  return true;
+  row_number_++;
+  return rows_fetched_ > 0;
 }
 
 bool
-ODBC::execute() {
-  if (!stmt) return false;
-  long rv = SQLExecute(stmt);
-  ClearBoundData();
-  if (SQL_SUCCEEDED(rv) || rv == SQL_NO_DATA) {
-    return true;
+ODBCStatement::next() {
+  SQLStatement::reset();
+  if (!is_executed_) {
+    // execute() fetches the first row
+    execute();
+    return results_available_;
+  }
+  if (!has_cursor_) return false;
+  if (++current_row_ < rows_fetched_) {
+    row_number_++;
+    results_available_ = true;
   } else {
-    error_string = createErrorString(SQL_HANDLE_STMT, stmt);
-    // fprintf(stderr, "ODBC execute failed(%d): %s\n", rv, error_string.c_str());
-    return false;
+    results_available_ = fetch();
+  }
+  return results_available_;
+}
+
+void
+ODBCStatement::reset() {
+  SQLStatement::reset();
+  closeCursor();
+  is_executed_ = false;
+}
+
+void
+ODBCStatement::closeCursor() {
+  if (has_cursor_) {
+    SQLFreeStmt(stmt_, SQL_CLOSE);
+    has_cursor_ = false;
   }
+  rows_fetched_ = 0;
+  current_row_ = 0;
 }
 
 void
-ODBC::Commit() {
-  if (!env) return;
-  SQLEndTran(SQL_HANDLE_ENV, env, SQL_COMMIT);
+ODBCStatement::set(int column_idx, std::string_view value, bool is_defined) {
+  if (is_defined) setValue(column_idx, std::string(value));
+  else setValue(column_idx, Value());
 }
 
 void
-ODBC::Rollback() {
-  if (!env) return;
-  SQLEndTran(SQL_HANDLE_ENV, env, SQL_ROLLBACK);
+ODBCStatement::set(int column_idx, int value, bool is_defined) {
+  if (is_defined) setValue(column_idx, static_cast<long long>(value));
+  else setValue(column_idx, Value());
 }
 
-string
-ODBC::createErrorString(SQLSMALLINT handle_type, SQLHANDLE handle) {
-  if (!handle) return "Invalid handle";
+void
+ODBCStatement::set(int column_idx, long long value, bool is_defined) {
+  if (is_defined) setValue(column_idx, value);
+  else setValue(column_idx, Value());
+}
+
+void
+ODBCStatement::set(int column_idx, double value, bool is_defined) {
+  if (is_defined) setValue(column_idx, value);
+  else setValue(column_idx, Value());
+}
+
+void
+ODBCStatement::set(int column_idx, const void * data, size_t len, bool is_defined) {
+  auto ptr = reinterpret_cast<const uint8_t *>(data);
+  if (is_defined) setValue(column_idx, std::vector<uint8_t>(ptr, ptr + len));
+  else setValue(column_idx, Value());
+}
+
+void
+ODBCStatement::setValue(int column_idx, Value value) {
+  if (column_idx < 0 || column_idx >= static_cast<int>(num_params_)) {
+    throw SQLException(SQLException::BAD_COLUMN_INDEX, "");
+  }
+  pending_row_[column_idx] = std::move(value);
+}
+
+const char *
+ODBCStatement::getData(int column_index, size_t & len) {
+  auto idx = static_cast<size_t>(column_index);
+  if (!results_available_ || idx >= columns_.size()) return nullptr;
+  auto & col = columns_[idx];
+  auto ind = col.indicators[current_row_];
+  if (ind == SQL_NULL_DATA) return nullptr;
+  auto ptr = col.data.data() + current_row_ * col.width;
+
+  if (col.c_type == SQL_C_SBIGINT || col.c_type == SQL_C_DOUBLE) {
+    if (col.text_row != row_number_) {
+      char buffer[32];
+      std::to_chars_result r;
+      if (col.c_type == SQL_C_SBIGINT) {
+	long long v;
+	memcpy(&v, ptr, sizeof(v));
+	r = std::to_chars(buffer, buffer + sizeof(buffer), v);
+      } else {
+	double v;
+	memcpy(&v, ptr, sizeof(v));
+	r = std::to_chars(buffer, buffer + sizeof(buffer), v);
+      }
+      col.text.assign(buffer, r.ptr);
+      col.text_row = row_number_;
+    }
+    len = col.text.size();
+    return col.text.data();
+  }
+
+  SQLLEN capacity = col.c_type == SQL_C_CHAR ? col.width - 1 : col.width;
+  if (ind != SQL_NO_TOTAL && ind <= capacity) {
+    len = static_cast<size_t>(ind);
+    return ptr;
+  }
+
+  // the value didn't fit the bound buffer, so read it again
+  if (col.text_row != row_number_) {
+    if (rows_fetched_ > 1 && !SQL_SUCCEEDED(SQLSetPos(stmt_, current_row_ + 1, SQL_POSITION, SQL_LOCK_NO_CHANGE))) {
+      throw SQLException(SQLException::GET_FAILED, get_error(SQL_HANDLE_STMT, stmt_), query_);
+    }
+    col.text.clear();
+    char buffer[ODBC_BIND_BUFFER_SIZE];
+    size_t chunk_size = col.c_type == SQL_C_CHAR ? sizeof(buffer) - 1 : sizeof(buffer);
+    while ( 1 ) {
+      SQLLEN n = 0;
+      auto r = SQLGetData(stmt_, static_cast<SQLUSMALLINT>(idx + 1), col.c_type, buffer, sizeof(buffer), &n);
+      if (r == SQL_NO_DATA || (SQL_SUCCEEDED(r) && n == SQL_NULL_DATA)) break;
+      if (!SQL_SUCCEEDED(r)) {
+	throw SQLException(SQLException::GET_FAILED, get_error(SQL_HANDLE_STMT, stmt_), query_);
+      }
+      col.text.append(buffer, n == SQL_NO_TOTAL || static_cast<size_t>(n) > chunk_size ? chunk_size : static_cast<size_t>(n));
+      if (r == SQL_SUCCESS) break;
+    }
+    col.text_row = row_number_;
+  }
+  len = col.text.size();
+  return col.text.data();
+}
+
+std::string_view
+ODBCStatement::getText(int column_index) {
+  size_t len = 0;
+  auto ptr = getData(column_index, len);
+  return ptr ? std::string_view(ptr, len) : std::string_view();
+}
+
+std::vector<uint8_t>
+ODBCStatement::getBlob(int column_index) {
+  size_t len = 0;
+  auto ptr = reinterpret_cast<const uint8_t *>(getData(column_index, len));
+  return ptr ? std::vector<uint8_t>(ptr, ptr + len) : std::vector<uint8_t>();
+}
+
+bool
+ODBCStatement::isNull(int column_index) const {
+  auto idx = static_cast<size_t>(column_index);
+  if (!results_available_ || idx >= columns_.size()) return true;
+  return columns_[idx].indicators[current_row_] == SQL_NULL_DATA;
+}
+
+const std::string &
+ODBCStatement::getColumnName(int column_index) {
+  auto idx = static_cast<size_t>(column_index);
+  return idx < columns_.size() ? columns_[idx].name : empty_string;
+}
+
+ColumnType
+ODBCStatement::getColumnType(int column_index) const {
+  auto idx = static_cast<size_t>(column_index);
+  return idx < columns_.size() ? columns_[idx].type : ColumnType::ANY;
+}
+
+long long
+ODBCStatement::getLongLong(int column_index, long long default_value) {
+  if (isNull(column_index)) return default_value;
+  auto & col = columns_[column_index];
+  auto ptr = col.data.data() + current_row_ * col.width;
+  if (col.c_type == SQL_C_SBIGINT) {
+    long long v;
+    memcpy(&v, ptr, sizeof(v));
+    return v;
+  } else if (col.c_type == SQL_C_DOUBLE) {
+    double v;
+    memcpy(&v, ptr, sizeof(v));
+    return static_cast<long long>(v);
+  }
+  size_t len = 0;
+  auto s = getData(column_index, len);
+  long long v;
+  auto [ end, ec ] = std::from_chars(s, s + len, v);
+  return ec == std::errc() ? v : default_value;
+}
 
-  SQLSMALLINT errRecNo = 1;
-  SQLCHAR errSQLStateBuf[256];
-  SQLINTEGER errCode = 0;
-  SQLCHAR errMsgBuf[256]; 
-  SQLSMALLINT errMsgBufLen = 256;
-  SQLSMALLINT errInfoSize;
-  
-  memset (errSQLStateBuf, 0x00, sizeof (errSQLStateBuf));
-  memset (errMsgBuf, 0x00, sizeof (errMsgBuf));
-
-  long retcode = SQLGetDiagRec (handle_type, handle, errRecNo,
-               errSQLStateBuf, &errCode, errMsgBuf, errMsgBufLen,
-               &errInfoSize);
-
-  if (retcode != SQL_NO_DATA_FOUND) {
-    // fprintf(stderr, "ODBC error: %s\n", (char*)errMsgBuf);
-    errRecNo++;
-    return (char*)errMsgBuf;
+double
+ODBCStatement::getDouble(int column_index, double default_value) {
+  if (isNull(column_index)) return default_value;
+  auto & col = columns_[column_index];
+  auto ptr = col.data.data() + current_row_ * col.width;
+  if (col.c_type == SQL_C_DOUBLE) {
+    double v;
+    memcpy(&v, ptr, sizeof(v));
+    return v;
+  } else if (col.c_type == SQL_C_SBIGINT) {
+    long long v;
+    memcpy(&v, ptr, sizeof(v));
+    return static_cast<double>(v);
+  }
+  size_t len = 0;
+  auto s = getData(column_index, len);
+  double v;
+  auto [ end, ec ] = std::from_chars(s, s + len, v);
+  return ec == std::errc() ? v : default_value;
+}
+
+float
+ODBCStatement::getFloat(int column_index, float default_value) {
+  return isNull(column_index) ? default_value : static_cast<float>(getDouble(column_index));
+}
+
+int
+ODBCStatement::getInt(int column_index, int default_value) {
+  return isNull(column_index) ? default_value : static_cast<int>(getLongLong(column_index));
+}
+
+Key
+ODBCStatement::getKey(int column_index) {
+  if (is_numeric(getColumnType(column_index))) {
+    return Key(getLongLong(column_index));
   } else {
-    // fprintf(stderr, "ODBC error: not found\n");
-    return "";
+    return Key(getText(column_index));
+  }
+}
+
+size_t
+ODBCStatement::getMemoryUsage() const {
+  size_t n = rows_.capacity() * sizeof(Value);
+  for (auto & p : params_) {
+    n += p.data.capacity() + p.indicators.capacity() * sizeof(SQLLEN);
+  }
+  for (auto & col : columns_) {
+    n += col.data.capacity() + col.indicators.capacity() * sizeof(SQLLEN) + col.text.capacity();
   }
+  return n;
 }
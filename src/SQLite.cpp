@@ -5,6 +5,8 @@
 #include <cassert>
 #include <vector>
 #include <charconv>
+#include <cstring>
+#include <cctype>
 
 using namespace sqldb;
 
@@ -15,6 +17,15 @@ public:
     assert(stmt_);
 
     num_columns_ = sqlite3_column_count(stmt_);
+
+    // Column metadata doesn't change between rows, so fetch it once
+    column_names_.reserve(num_columns_);
+    declared_types_.reserve(num_columns_);
+    for (int i = 0; i < num_columns_; i++) {
+      auto name = sqlite3_column_name(stmt_, i);
+      column_names_.push_back(name ? name : "");
+      declared_types_.push_back(getDeclaredType(sqlite3_column_decltype(stmt_, i)));
+    }
   }
   ~SQLiteStatement() {
     if (stmt_) sqlite3_finalize(stmt_);
@@ -93,26 +104,31 @@ public:
   }
   
   int getInt(int column_index, int default_value = 0) override {
-    if (!isNull(column_index)) {
-      return sqlite3_column_int(stmt_, column_index);
+    if (results_available_) {
+      // NULL is read as zero, so the type only needs to be checked for zeros
+      auto v = sqlite3_column_int(stmt_, column_index);
+      if (v || !isNull(column_index)) return v;
     }
     return default_value;
   }
   double getDouble(int column_index, double default_value = 0.0) override {
-    if (!isNull(column_index)) {
-      return sqlite3_column_double(stmt_, column_index);
+    if (results_available_) {
+      auto v = sqlite3_column_double(stmt_, column_index);
+      if (v != 0.0 || !isNull(column_index)) return v;
     }
     return default_value;
   }
   float getFloat(int column_index, float default_value) override {
-    if (!isNull(column_index)) {
-      return static_cast<float>(sqlite3_column_double(stmt_, column_index));
+    if (results_available_) {
+      auto v = sqlite3_column_double(stmt_, column_index);
+      if (v != 0.0 || !isNull(column_index)) return static_cast<float>(v);
     }
     return default_value;
   }
   long long getLongLong(int column_index, long long default_value = 0) override {
-    if (!isNull(column_index)) {
-      return sqlite3_column_int64(stmt_, column_index);
+    if (results_available_) {
+      auto v = sqlite3_column_int64(stmt_, column_index);
+      if (v || !isNull(column_index)) return v;
     }
     return default_value;
   }
@@ -131,21 +147,27 @@ public:
     if (results_available_) {
       auto data = reinterpret_cast<const uint8_t*>(sqlite3_column_blob(stmt_, column_index));
       auto len = sqlite3_column_bytes(stmt_, column_index);
-      r.reserve(len);
-      for (int i = 0; i < len; i++) r.push_back(data[i]);
+      if (data) r.assign(data, data + len);
     }
     return r;
   }
   Key getKey(int column_index) override {
     auto type = getColumnType(column_index);
+    if (type != ColumnType::ANY && is_numeric(type)) {
+      // the declared type doesn't keep NULL or text out of the column, so
+      // the actual type is checked for zeros
+      auto v = results_available_ ? sqlite3_column_int64(stmt_, column_index) : 0;
+      if (v) return Key(v);
+      auto actual_type = results_available_ ? sqlite3_column_type(stmt_, column_index) : SQLITE_NULL;
+      if (actual_type == SQLITE_INTEGER || actual_type == SQLITE_FLOAT) return Key(v);
+      type = ColumnType::ANY;
+    }
     if (type == ColumnType::ANY) {
       // FIXME: get actual type
       auto s = getText(column_index);
       long long ll;
       auto [ ptr, ec ] = std::from_chars(s.data(), s.data() + s.size(), ll);
       return ec == std::errc() ? Key(ll) : Key(s);
-    } else if (is_numeric(type)) {
-      return Key(getLongLong(column_index));
     } else {
       return Key(getText(column_index));
     }
@@ -160,7 +182,15 @@ public:
   }
   
   ColumnType getColumnType(int column_index) const override {
-    switch (sqlite3_column_type(stmt_, column_index)) {
+    // Use the declared type when the column has one, unless the value is
+    // text that SQLite stored in a numeric column
+    auto idx = static_cast<size_t>(column_index);
+    auto actual_type = sqlite3_column_type(stmt_, column_index);
+    if (idx < declared_types_.size() && declared_types_[idx] != ColumnType::ANY) {
+      auto type = declared_types_[idx];
+      if (!is_numeric(type) || (actual_type != SQLITE3_TEXT && actual_type != SQLITE_BLOB)) return type;
+    }
+    switch (actual_type) {
     case SQLITE_INTEGER: return ColumnType::INT64;
     case SQLITE_FLOAT: return ColumnType::FLOAT;
     case SQLITE_BLOB: return ColumnType::VARCHAR; // should be blob
@@ -170,7 +200,7 @@ public:
       break;
     }
     return ColumnType::ANY;
-    }
+  }
 
   int getNumFields() const override {
     return num_columns_;
@@ -184,23 +214,31 @@ public:
   }
 
   const std::string & getColumnName(int column_index) override {
-    if (column_names_.empty()) {
-      for (int i = 0; i < num_columns_; i++) {
-	column_names_.push_back(sqlite3_column_name(stmt_, i));
-      }
-    }
     auto idx = static_cast<size_t>(column_index);
     return idx < column_names_.size() ? column_names_[idx] : null_string;
   }
 
 protected:
   void step();
+
+  // Maps the declared type to a column type using the SQLite affinity rules
+  static ColumnType getDeclaredType(const char * decltype_str) {
+    if (!decltype_str) return ColumnType::ANY;
+    std::string s;
+    for (auto p = decltype_str; *p; p++) s += static_cast<char>(toupper(static_cast<unsigned char>(*p)));
+    if (s.find("INT") != std::string::npos) return ColumnType::INT64;
+    if (s.find("CHAR") != std::string::npos || s.find("CLOB") != std::string::npos) return ColumnType::VARCHAR;
+    if (s.find("TEXT") != std::string::npos) return ColumnType::TEXT;
+    if (s.find("REAL") != std::string::npos || s.find("FLOA") != std::string::npos || s.find("DOUB") != std::string::npos) return ColumnType::DOUBLE;
+    return ColumnType::ANY;
+  }
     
 private:
   sqlite3 * db_;
   sqlite3_stmt * stmt_;
   int num_columns_;
   std::vector<std::string> column_names_;
+  std::vector<ColumnType> declared_types_;
   
   static inline std::string null_string;
 };
@@ -264,6 +302,126 @@ SQLite::prepare(std::string_view query) {
   return std::make_unique<SQLiteStatement>(db_, stmt);
 }
 
+// A copy that stays busy for this many steps in a row (about 10 seconds)
+// fails, since another connection keeps the database locked
+#define SQLITE_COPY_MAX_BUSY_STEPS 1000
+#define SQLITE_COPY_BUSY_SLEEP_MS 10
+
+static void copy_database(sqlite3 * dest, sqlite3 * src, int pages_per_step, const std::function<bool(int, int)> & progress) {
+  auto backup = sqlite3_backup_init(dest, "main", src, "main");
+  if (!backup) {
+    throw SQLException(SQLException::DATABASE_ERROR, sqlite3_errmsg(dest));
+  }
+
+  int r, num_busy = 0;
+  const char * error = nullptr;
+  while ( 1 ) {
+    r = sqlite3_backup_step(backup, pages_per_step);
+    if (r == SQLITE_DONE) {
+      break;
+    } else if (r == SQLITE_OK || r == SQLITE_BUSY || r == SQLITE_LOCKED) {
+      if (progress && !progress(sqlite3_backup_remaining(backup), sqlite3_backup_pagecount(backup))) {
+	error = "Copy was aborted";
+	break;
+      }
+      if (r == SQLITE_OK) {
+	num_busy = 0;
+      } else if (++num_busy > SQLITE_COPY_MAX_BUSY_STEPS) {
+	error = "Database is locked";
+	break;
+      } else {
+	// let other connections use the source database between steps
+	sqlite3_sleep(SQLITE_COPY_BUSY_SLEEP_MS);
+      }
+    } else {
+      break;
+    }
+  }
+
+  if (sqlite3_backup_finish(backup) != SQLITE_OK) {
+    throw SQLException(SQLException::DATABASE_ERROR, sqlite3_errmsg(dest));
+  }
+  if (error) {
+    throw SQLException(SQLException::DATABASE_ERROR, error);
+  }
+}
+
+void
+SQLite::save(const std::string & db_file, int pages_per_step, std::function<bool(int, int)> progress) {
+  if (!db_) {
+    throw SQLException(SQLException::DATABASE_MISUSE);
+  }
+  sqlite3 * file_db = 0;
+  if (sqlite3_open_v2(db_file.c_str(), &file_db, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, 0) != SQLITE_OK) {
+    std::string errmsg = file_db ? sqlite3_errmsg(file_db) : "";
+    sqlite3_close(file_db);
+    throw SQLException(SQLException::OPEN_FAILED, errmsg);
+  }
+  try {
+    copy_database(file_db, db_, pages_per_step, progress);
+  } catch (...) {
+    sqlite3_close(file_db);
+    throw;
+  }
+  sqlite3_close(file_db);
+}
+
+void
+SQLite::load(const std::string & db_file, int pages_per_step, std::function<bool(int, int)> progress) {
+  if (!db_) {
+    throw SQLException(SQLException::DATABASE_MISUSE);
+  }
+  sqlite3 * file_db = 0;
+  if (sqlite3_open_v2(db_file.c_str(), &file_db, SQLITE_OPEN_READONLY, 0) != SQLITE_OK) {
+    std::string errmsg = file_db ? sqlite3_errmsg(file_db) : "";
+    sqlite3_close(file_db);
+    throw SQLException(SQLException::OPEN_FAILED, errmsg);
+  }
+  try {
+    copy_database(db_, file_db, pages_per_step, progress);
+  } catch (...) {
+    sqlite3_close(file_db);
+    throw;
+  }
+  sqlite3_close(file_db);
+}
+
+std::vector<uint8_t>
+SQLite::serialize() const {
+  if (!db_) {
+    throw SQLException(SQLException::DATABASE_MISUSE);
+  }
+  sqlite3_int64 size = 0;
+  auto data = sqlite3_serialize(db_, "main", &size, 0);
+  if (!data) {
+    throw SQLException(SQLException::DATABASE_ERROR, sqlite3_errmsg(db_));
+  }
+  std::vector<uint8_t> r(data, data + size);
+  sqlite3_free(data);
+  return r;
+}
+
+void
+SQLite::deserialize(const void * data, size_t len, bool read_only) {
+  if (!db_) {
+    throw SQLException(SQLException::DATABASE_MISUSE);
+  }
+  // SQLite takes the ownership of the buffer and frees it on close
+  auto buffer = reinterpret_cast<unsigned char *>(sqlite3_malloc64(len));
+  if (!buffer && len) {
+    throw SQLException(SQLException::DATABASE_ERROR, "Out of memory");
+  }
+  memcpy(buffer, data, len);
+  
+  unsigned int flags = SQLITE_DESERIALIZE_FREEONCLOSE;
+  if (read_only) flags |= SQLITE_DESERIALIZE_READONLY;
+  else flags |= SQLITE_DESERIALIZE_RESIZEABLE;
+  
+  if (sqlite3_deserialize(db_, "main", buffer, len, len, flags) != SQLITE_OK) {
+    throw SQLException(SQLException::DATABASE_ERROR, sqlite3_errmsg(db_));
+  }
+}
+
 void
 SQLiteStatement::step() {
   results_available_ = false;
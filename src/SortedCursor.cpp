@@ -0,0 +1,546 @@
+#include "SortedCursor.h"
+
+#include "SpillFile.h"
+
+#include <vector>
+#include <algorithm>
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+
+using namespace std;
+using namespace sqldb;
+
+// Maximum number of runs that are merged at a time
+#define SORT_MAX_MERGE_WIDTH 64
+
+struct SortedRow {
+  Key sort_key, row_key;
+  std::vector<std::string> values;
+  std::vector<bool> is_null;
+};
+
+// Nulls, which have empty sort keys, come first in both directions
+static inline bool is_before_key(const Key & a, const Key & b, bool desc) {
+  if (a.empty() || b.empty()) return a.empty() && !b.empty();
+  return desc ? b < a : a < b;
+}
+
+static inline bool is_before(const SortedRow & a, const SortedRow & b, bool desc) {
+  return is_before_key(a.sort_key, b.sort_key, desc);
+}
+
+// Approximate memory used by a row, including the strings that don't fit
+// in the small string buffer
+static size_t estimate_size(const SortedRow & row) {
+  size_t n = sizeof(SortedRow) + row.values.size() * sizeof(std::string) + row.is_null.size() / 8;
+  n += (row.sort_key.size() + row.row_key.size()) * 48;
+  for (auto & v : row.values) {
+    if (v.size() >= sizeof(std::string)) n += v.size() + 1;
+  }
+  return n;
+}
+
+// Returns the key that the rows are sorted by, which is empty for nulls.
+// Floating point values are mapped to integers in the same order.
+static Key make_sort_key(Cursor & input, int sort_col, int sort_subcol) {
+  if (input.isNull(sort_col)) return Key();
+  auto type = input.getColumnType(sort_col);
+  Key key;
+  if (type == ColumnType::DOUBLE || type == ColumnType::FLOAT) {
+    double d = input.getDouble(sort_col);
+    int64_t bits;
+    memcpy(&bits, &d, sizeof(bits));
+    if (bits < 0) bits ^= INT64_MAX;
+    key.addComponent(static_cast<long long>(bits));
+  } else if (is_numeric(type)) {
+    key.addComponent(input.getLongLong(sort_col));
+  } else {
+    key = input.getKey(sort_col);
+    if (sort_subcol >= 0) key = key.getSubKey(sort_subcol, 1);
+  }
+  return key;
+}
+
+static Key get_sort_key(Cursor & input, int sort_col, int sort_subcol) {
+  return sort_col >= 0 ? make_sort_key(input, sort_col, sort_subcol) : input.getRowKey();
+}
+
+// Copies the row key and the values of the current row
+static void read_row(Cursor & input, int num_fields, SortedRow & row) {
+  row.row_key = input.getRowKey();
+  row.values.resize(num_fields);
+  row.is_null.resize(num_fields);
+  for (int i = 0; i < num_fields; i++) {
+    row.is_null[i] = input.isNull(i);
+    if (!row.is_null[i]) row.values[i] = input.getText(i);
+  }
+}
+
+static void get_columns(Cursor & input, std::vector<std::string> & column_names, std::vector<ColumnType> & column_types) {
+  for (int i = 0, n = input.getNumFields(); i < n; i++) {
+    column_names.push_back(input.getColumnName(i));
+    column_types.push_back(input.getColumnType(i));
+  }
+}
+
+// Sorted rows spilled to a temporary file, which are read back one at a time
+class SortRun {
+public:
+  SortRun(const std::string & temp_dir) : file_(temp_dir) { }
+
+  void write(const SortedRow & row) {
+    file_.writeKey(row.sort_key);
+    file_.writeKey(row.row_key);
+    file_.writeValues(row.values, row.is_null);
+  }
+
+  // Moves to the start of the run after it has been written
+  void rewind() {
+    file_.rewind();
+  }
+
+  // Reads the next row and returns false at the end of the run
+  bool read() {
+    if (!file_.readKey(row_.sort_key)) return false;
+    if (!file_.readKey(row_.row_key)) {
+      throw std::runtime_error("Truncated sort run");
+    }
+    file_.readValues(row_.values, row_.is_null);
+    return true;
+  }
+
+  const SortedRow & getRow() const { return row_; }
+
+private:
+  SpillFile file_;
+  SortedRow row_;
+};
+
+// k-way merge of sorted runs. Equal rows are taken from the earlier run
+// first, so the merge is stable if the runs are in input order.
+class RunMerger {
+public:
+  RunMerger(std::vector<std::unique_ptr<SortRun>> runs, bool desc) : runs_(std::move(runs)), desc_(desc) { }
+
+  // Reads the first row of each run and returns false if all runs are empty
+  bool start() {
+    for (size_t i = 0; i < runs_.size(); i++) {
+      if (runs_[i]->read()) heap_.push_back(i);
+    }
+    std::make_heap(heap_.begin(), heap_.end(), Order{ this });
+    return !heap_.empty();
+  }
+
+  bool next() {
+    Order order{ this };
+    std::pop_heap(heap_.begin(), heap_.end(), order);
+    auto i = heap_.back();
+    heap_.pop_back();
+    if (runs_[i]->read()) {
+      heap_.push_back(i);
+      std::push_heap(heap_.begin(), heap_.end(), order);
+    }
+    return !heap_.empty();
+  }
+
+  const SortedRow & getRow() const { return runs_[heap_.front()]->getRow(); }
+
+private:
+  // heap order that puts the next row at the front
+  struct Order {
+    const RunMerger * merger;
+    bool operator()(size_t a, size_t b) const {
+      auto & row_a = merger->runs_[a]->getRow(), & row_b = merger->runs_[b]->getRow();
+      if (is_before(row_b, row_a, merger->desc_)) return true;
+      if (is_before(row_a, row_b, merger->desc_)) return false;
+      return a > b;
+    }
+  };
+
+  std::vector<std::unique_ptr<SortRun>> runs_;
+  bool desc_;
+  std::vector<size_t> heap_;
+};
+
+static std::unique_ptr<SortRun> write_run(std::vector<SortedRow> & rows, bool desc, const std::string & temp_dir) {
+  std::stable_sort(rows.begin(), rows.end(), [desc](const SortedRow & a, const SortedRow & b) { return is_before(a, b, desc); });
+  auto run = std::make_unique<SortRun>(temp_dir);
+  for (auto & row : rows) run->write(row);
+  run->rewind();
+  return run;
+}
+
+static std::unique_ptr<SortRun> merge_runs(std::vector<std::unique_ptr<SortRun>> runs, bool desc, const std::string & temp_dir) {
+  RunMerger merger(std::move(runs), desc);
+  auto run = std::make_unique<SortRun>(temp_dir);
+  if (merger.start()) {
+    do {
+      run->write(merger.getRow());
+    } while (merger.next());
+  }
+  run->rewind();
+  return run;
+}
+
+class SortedCursor : public Cursor {
+public:
+  SortedCursor(std::vector<std::string> column_names, std::vector<ColumnType> column_types, std::vector<SortedRow> rows)
+    : column_names_(std::move(column_names)), column_types_(std::move(column_types)), rows_(std::move(rows)) {
+    updateRowKey();
+  }
+  SortedCursor(std::vector<std::string> column_names, std::vector<ColumnType> column_types, std::unique_ptr<RunMerger> merger)
+    : column_names_(std::move(column_names)), column_types_(std::move(column_types)), merger_(std::move(merger)) {
+    updateRowKey();
+  }
+
+  bool next() override {
+    if (merger_) {
+      if (!merger_->next()) return false;
+    } else {
+      if (current_row_ + 1 >= rows_.size()) return false;
+      current_row_++;
+    }
+    updateRowKey();
+    return true;
+  }
+
+  std::string_view getText(int column_index) override {
+    auto & row = getRow();
+    auto idx = static_cast<size_t>(column_index);
+    return idx < row.values.size() ? std::string_view(row.values[idx]) : std::string_view();
+  }
+
+  double getDouble(int column_index, double default_value = 0.0) override {
+    auto s = getText(column_index);
+    if (!s.empty()) {
+      double d;
+      auto [ ptr, ec ] = std::from_chars(s.data(), s.data() + s.size(), d);
+      if (ec == std::errc()) return d;
+    }
+    return default_value;
+  }
+
+  float getFloat(int column_index, float default_value = 0.0f) override {
+    auto s = getText(column_index);
+    if (!s.empty()) {
+      float f;
+      auto [ ptr, ec ] = std::from_chars(s.data(), s.data() + s.size(), f);
+      if (ec == std::errc()) return f;
+    }
+    return default_value;
+  }
+
+  int getInt(int column_index, int default_value = 0) override {
+    auto s = getText(column_index);
+    if (!s.empty()) {
+      int i;
+      auto [ ptr, ec ] = std::from_chars(s.data(), s.data() + s.size(), i);
+      if (ec == std::errc()) return i;
+    }
+    return default_value;
+  }
+
+  long long getLongLong(int column_index, long long default_value = 0) override {
+    auto s = getText(column_index);
+    if (!s.empty()) {
+      long long ll;
+      auto [ ptr, ec ] = std::from_chars(s.data(), s.data() + s.size(), ll);
+      if (ec == std::errc()) return ll;
+    }
+    return default_value;
+  }
+
+  Key getKey(int column_index) override {
+    if (is_numeric(getColumnType(column_index))) {
+      Key key;
+      key.addComponent(getLongLong(column_index));
+      return key;
+    } else {
+      return Key(getText(column_index));
+    }
+  }
+
+  int getNumFields() const override { return static_cast<int>(column_names_.size()); }
+
+  std::vector<uint8_t> getBlob(int column_index) override {
+    auto v = getText(column_index);
+    return std::vector<uint8_t>(v.begin(), v.end());
+  }
+
+  bool isNull(int column_index) const override {
+    auto & row = getRow();
+    auto idx = static_cast<size_t>(column_index);
+    return idx < row.is_null.size() ? row.is_null[idx] : true;
+  }
+
+  const std::string & getColumnName(int column_index) override {
+    auto idx = static_cast<size_t>(column_index);
+    return idx < column_names_.size() ? column_names_[idx] : Table::empty_string;
+  }
+
+  ColumnType getColumnType(int column_index) const override {
+    auto idx = static_cast<size_t>(column_index);
+    return idx < column_types_.size() ? column_types_[idx] : ColumnType::ANY;
+  }
+
+  void set(int column_idx, std::string_view value, bool is_defined = true) override {
+    throw std::runtime_error("Sorted cursor is read-only");
+  }
+  void set(int column_idx, int value, bool is_defined = true) override {
+    throw std::runtime_error("Sorted cursor is read-only");
+  }
+  void set(int column_idx, long long value, bool is_defined = true) override {
+    throw std::runtime_error("Sorted cursor is read-only");
+  }
+  void set(int column_idx, double value, bool is_defined = true) override {
+    throw std::runtime_error("Sorted cursor is read-only");
+  }
+  void set(int column_idx, const void * data, size_t len, bool is_defined = true) override {
+    throw std::runtime_error("Sorted cursor is read-only");
+  }
+  size_t execute() override {
+    throw std::runtime_error("Sorted cursor is read-only");
+  }
+  size_t update(const Key & key) override {
+    throw std::runtime_error("Sorted cursor is read-only");
+  }
+
+  long long getLastInsertId() const override { return 0; }
+
+protected:
+  const SortedRow & getRow() const {
+    return merger_ ? merger_->getRow() : rows_[current_row_];
+  }
+
+  void updateRowKey() {
+    setRowKey(getRow().row_key);
+  }
+
+private:
+  std::vector<std::string> column_names_;
+  std::vector<ColumnType> column_types_;
+  // the rows are either held in memory or merged from runs
+  std::vector<SortedRow> rows_;
+  size_t current_row_ = 0;
+  std::unique_ptr<RunMerger> merger_;
+};
+
+std::unique_ptr<Cursor>
+sqldb::seekSorted(Table & table, size_t memory_budget, std::string temp_dir, int sheet) {
+  auto input = table.seekBegin(sheet);
+  if (!input) return std::unique_ptr<Cursor>(nullptr);
+
+  int sort_col = table.getSortCol(), sort_subcol = table.getSortSubcol();
+  bool desc = table.isDescSort();
+
+  int num_fields = input->getNumFields();
+  std::vector<std::string> column_names;
+  std::vector<ColumnType> column_types;
+  get_columns(*input, column_names, column_types);
+
+  // Runs are merged in levels so that at most SORT_MAX_MERGE_WIDTH runs are
+  // open on each level. Runs on higher levels come from earlier input.
+  std::vector<std::vector<std::unique_ptr<SortRun>>> levels;
+  auto add_run = [&](std::unique_ptr<SortRun> run) {
+    for (size_t level = 0; ; level++) {
+      if (level == levels.size()) levels.emplace_back();
+      levels[level].push_back(std::move(run));
+      if (levels[level].size() < SORT_MAX_MERGE_WIDTH) break;
+      run = merge_runs(std::move(levels[level]), desc, temp_dir);
+      levels[level].clear();
+    }
+  };
+
+  std::vector<SortedRow> rows;
+  size_t memory_used = 0;
+  do {
+    SortedRow row;
+    row.sort_key = get_sort_key(*input, sort_col, sort_subcol);
+    read_row(*input, num_fields, row);
+    memory_used += estimate_size(row);
+    rows.push_back(std::move(row));
+
+    if (memory_used >= memory_budget) {
+      add_run(write_run(rows, desc, temp_dir));
+      rows.clear();
+      memory_used = 0;
+    }
+  } while (input->next());
+  input.reset();
+
+  if (levels.empty()) {
+    std::stable_sort(rows.begin(), rows.end(), [desc](const SortedRow & a, const SortedRow & b) { return is_before(a, b, desc); });
+    return std::make_unique<SortedCursor>(std::move(column_names), std::move(column_types), std::move(rows));
+  }
+
+  if (!rows.empty()) {
+    add_run(write_run(rows, desc, temp_dir));
+    rows = std::vector<SortedRow>();
+  }
+
+  std::vector<std::unique_ptr<SortRun>> runs;
+  for (auto it = levels.rbegin(); it != levels.rend(); ++it) {
+    for (auto & run : *it) runs.push_back(std::move(run));
+  }
+  auto merger = std::make_unique<RunMerger>(std::move(runs), desc);
+  merger->start();
+  return std::make_unique<SortedCursor>(std::move(column_names), std::move(column_types), std::move(merger));
+}
+
+bool
+SortedView::isValid() const {
+  return has_entries_ &&
+    sort_col_ == table_.getSortCol() &&
+    sort_subcol_ == table_.getSortSubcol() &&
+    desc_ == table_.isDescSort() &&
+    filter_ == table_.getRowFilter();
+}
+
+bool
+SortedView::isBefore(const Entry & a, const Entry & b) const {
+  if (is_before_key(a.sort_key, b.sort_key, desc_)) return true;
+  if (is_before_key(b.sort_key, a.sort_key, desc_)) return false;
+  return a.row_key < b.row_key;
+}
+
+void
+SortedView::clear() {
+  entries_.clear();
+  sorted_count_ = 0;
+  has_entries_ = false;
+}
+
+void
+SortedView::build() {
+  clear();
+  sort_col_ = table_.getSortCol();
+  sort_subcol_ = table_.getSortSubcol();
+  desc_ = table_.isDescSort();
+  filter_ = table_.getRowFilter();
+  log_position_ = table_.getLog().size();
+  version_ = table_.getVersion();
+  
+  if (auto cursor = table_.seekBegin(sheet_)) {
+    do {
+      entries_.push_back(Entry{ get_sort_key(*cursor, sort_col_, sort_subcol_), cursor->getRowKey() });
+    } while (cursor->next());
+  }
+  has_entries_ = true;
+}
+
+void
+SortedView::update() {
+  // the rows that the table reports as changed, and the rows in the Log
+  std::vector<Key> keys;
+  auto version = table_.getVersion();
+  if (version != version_ && !table_.getChangedRows(version_, keys)) {
+    build();
+    return;
+  }
+  auto & log = table_.getLog();
+  auto events = log.getEvents(log_position_);
+  if (keys.size() + events.size() > entries_.size() / 4) {
+    // cheaper to scan the table again
+    build();
+    return;
+  }
+  version_ = version;
+  log_position_ += events.size();
+  if (keys.empty() && events.empty()) return;
+
+  // the changed rows are removed and read again
+  robin_hood::unordered_flat_set<Key> changed(keys.begin(), keys.end());
+  for (auto & [ event, key ] : events) changed.insert(key);
+  entries_.erase(std::remove_if(entries_.begin(), entries_.end(), [&](const Entry & e) { return changed.count(e.row_key) != 0; }), entries_.end());
+  for (auto & key : changed) {
+    auto cursor = table_.seek(key);
+    if (cursor && (!filter_ || filter_->matches(*cursor))) {
+      entries_.push_back(Entry{ get_sort_key(*cursor, sort_col_, sort_subcol_), key });
+    }
+  }
+  sorted_count_ = 0;
+}
+
+void
+SortedView::sortUntil(size_t end) {
+  end = std::min(end, entries_.size());
+  if (end <= sorted_count_) return;
+  auto order = [this](const Entry & a, const Entry & b) { return isBefore(a, b); };
+  // the rows before sorted_count_ are in place, and the rest are partitioned
+  // so that only the rows up to end have to be sorted
+  auto first = entries_.begin() + sorted_count_;
+  if (end < entries_.size()) std::nth_element(first, entries_.begin() + end, entries_.end(), order);
+  std::sort(first, entries_.begin() + end, order);
+  sorted_count_ = end;
+}
+
+std::unique_ptr<Cursor>
+SortedView::seek(size_t offset, size_t limit) {
+  if (isValid()) {
+    update();
+  } else if (offset == 0) {
+    return seekTop(limit);
+  } else {
+    build();
+  }
+
+  sortUntil(offset + limit);
+  
+  std::vector<std::string> column_names;
+  std::vector<ColumnType> column_types;
+  std::vector<SortedRow> rows;
+  for (size_t i = offset; i < offset + limit && i < entries_.size(); i++) {
+    auto cursor = table_.seek(entries_[i].row_key);
+    if (!cursor) continue;
+    if (column_names.empty()) get_columns(*cursor, column_names, column_types);
+    SortedRow row;
+    read_row(*cursor, cursor->getNumFields(), row);
+    rows.push_back(std::move(row));
+  }
+  if (rows.empty()) return std::unique_ptr<Cursor>(nullptr);
+  return std::make_unique<SortedCursor>(std::move(column_names), std::move(column_types), std::move(rows));
+}
+
+std::unique_ptr<Cursor>
+SortedView::seekTop(size_t limit) {
+  auto input = table_.seekBegin(sheet_);
+  if (!input || !limit) return std::unique_ptr<Cursor>(nullptr);
+
+  int sort_col = table_.getSortCol(), sort_subcol = table_.getSortSubcol();
+  bool desc = table_.isDescSort();
+  int num_fields = input->getNumFields();
+  std::vector<std::string> column_names;
+  std::vector<ColumnType> column_types;
+  get_columns(*input, column_names, column_types);
+
+  // The heap holds the first rows so far with the last one in front, and
+  // only the rows that replace it are copied
+  auto is_before_row = [desc](const Key & sort_key_a, const Key & row_key_a, const Key & sort_key_b, const Key & row_key_b) {
+    if (is_before_key(sort_key_a, sort_key_b, desc)) return true;
+    if (is_before_key(sort_key_b, sort_key_a, desc)) return false;
+    return row_key_a < row_key_b;
+  };
+  auto order = [&](const SortedRow & a, const SortedRow & b) {
+    return is_before_row(a.sort_key, a.row_key, b.sort_key, b.row_key);
+  };
+  std::vector<SortedRow> heap;
+  do {
+    auto sort_key = get_sort_key(*input, sort_col, sort_subcol);
+    if (heap.size() == limit) {
+      auto & last = heap.front();
+      if (!is_before_row(sort_key, input->getRowKey(), last.sort_key, last.row_key)) continue;
+      std::pop_heap(heap.begin(), heap.end(), order);
+      heap.pop_back();
+    }
+    SortedRow row;
+    row.sort_key = std::move(sort_key);
+    read_row(*input, num_fields, row);
+    heap.push_back(std::move(row));
+    std::push_heap(heap.begin(), heap.end(), order);
+  } while (input->next());
+
+  std::sort_heap(heap.begin(), heap.end(), order);
+  return std::make_unique<SortedCursor>(std::move(column_names), std::move(column_types), std::move(heap));
+}
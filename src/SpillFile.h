@@ -0,0 +1,127 @@
+#ifndef _SPILLFILE_H_
+#define _SPILLFILE_H_
+
+#include "BinaryFormat.h"
+
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+#include <stdexcept>
+
+#include <unistd.h>
+
+// Length that marks a null value in spill files
+#define SPILL_NULL_LENGTH 0xffffffffu
+
+namespace sqldb {
+  // Temporary binary file for keys and row values that don't fit in
+  // memory. The file is created in temp_dir, or the system default if it's
+  // empty, and removed when it's closed.
+  class SpillFile {
+  public:
+    SpillFile(const std::string & temp_dir) {
+      if (temp_dir.empty()) {
+	f_ = tmpfile();
+      } else {
+	std::string fn = temp_dir + "/sqldb-spill-XXXXXX";
+	int fd = mkstemp(fn.data());
+	if (fd != -1) {
+	  ::unlink(fn.c_str());
+	  f_ = fdopen(fd, "w+b");
+	  if (!f_) ::close(fd);
+	}
+      }
+      if (!f_) {
+	throw std::runtime_error("Failed to create temporary file");
+      }
+    }
+    SpillFile(const SpillFile & other) = delete;
+    ~SpillFile() {
+      fclose(f_);
+    }
+
+    SpillFile & operator=(const SpillFile & other) = delete;
+
+    // Moves to the start of the file for reading
+    void rewind() {
+      ::rewind(f_);
+    }
+
+    // Keys are encoded as in BinaryFormat.h and prefixed by their length,
+    // so that they can be read back into the buffer and decoded there
+    void writeKey(const Key & key) {
+      buffer_.clear();
+      append_key(buffer_, key);
+      writeU32(static_cast<uint32_t>(buffer_.size()));
+      writeBytes(buffer_.data(), buffer_.size());
+    }
+
+    void writeValues(const std::vector<std::string> & values, const std::vector<bool> & is_null) {
+      writeU32(static_cast<uint32_t>(values.size()));
+      for (size_t i = 0; i < values.size(); i++) {
+	if (is_null[i]) {
+	  writeU32(SPILL_NULL_LENGTH);
+	} else {
+	  writeU32(static_cast<uint32_t>(values[i].size()));
+	  writeBytes(values[i].data(), values[i].size());
+	}
+      }
+    }
+
+    // Returns false at the end of the file
+    bool readKey(Key & key) {
+      uint32_t len;
+      if (fread(&len, sizeof(len), 1, f_) != 1) return false;
+      readString(len, buffer_);
+      BinaryReader reader(buffer_.data(), buffer_.data() + buffer_.size(), "Truncated temporary file");
+      key = reader.readKey();
+      return true;
+    }
+
+    void readValues(std::vector<std::string> & values, std::vector<bool> & is_null) {
+      auto n = readU32();
+      values.resize(n);
+      is_null.resize(n);
+      for (size_t i = 0; i < n; i++) {
+	auto len = readU32();
+	is_null[i] = len == SPILL_NULL_LENGTH;
+	readString(is_null[i] ? 0 : len, values[i]);
+      }
+    }
+
+  private:
+    void writeBytes(const void * data, size_t len) {
+      if (len && fwrite(data, 1, len, f_) != len) {
+	throw std::runtime_error("Failed to write temporary file");
+      }
+    }
+
+    void writeU32(uint32_t v) {
+      writeBytes(&v, sizeof(v));
+    }
+
+    void readBytes(void * data, size_t len) {
+      if (len && fread(data, 1, len, f_) != len) {
+	throw std::runtime_error("Truncated temporary file");
+      }
+    }
+
+    uint32_t readU32() {
+      uint32_t v;
+      readBytes(&v, sizeof(v));
+      return v;
+    }
+
+    void readString(size_t len, std::string & s) {
+      s.resize(len);
+      readBytes(s.data(), len);
+    }
+
+    FILE * f_ = nullptr;
+    std::string buffer_;
+  };
+};
+
+#endif
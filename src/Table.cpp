@@ -0,0 +1,71 @@
+#include "Table.h"
+
+using namespace std;
+using namespace sqldb;
+
+// Skips the rows of a scan whose keys are not in [lo, hi)
+class KeyRangeCursor : public Cursor {
+public:
+  KeyRangeCursor(std::unique_ptr<Cursor> input, Key lo, Key hi)
+    : input_(std::move(input)), lo_(std::move(lo)), hi_(std::move(hi)) { }
+
+  // Moves to the first row in the range and returns false if there are none
+  bool start() {
+    if (isInRange(input_->getRowKey())) {
+      setRowKey(input_->getRowKey());
+      return true;
+    }
+    return next();
+  }
+
+  bool next() override {
+    while (input_->next()) {
+      if (isInRange(input_->getRowKey())) {
+	setRowKey(input_->getRowKey());
+	return true;
+      }
+    }
+    return false;
+  }
+
+  size_t execute() override { return input_->execute(); }
+  size_t update(const Key & key) override { return input_->update(key); }
+  std::vector<uint8_t> getBlob(int column_index) override { return input_->getBlob(column_index); }
+  std::string_view getText(int column_index) override { return input_->getText(column_index); }
+  bool isNull(int column_index) const override { return input_->isNull(column_index); }
+  int getNumFields() const override { return input_->getNumFields(); }
+  const std::string & getColumnName(int column_index) override { return input_->getColumnName(column_index); }
+  const std::vector<float> & getVector(int column_index) override { return input_->getVector(column_index); }
+  ColumnType getColumnType(int column_index) const override { return input_->getColumnType(column_index); }
+  bool getBool(int column_index, bool default_value = false) override { return input_->getBool(column_index, default_value); }
+  double getDouble(int column_index, double default_value = 0.0) override { return input_->getDouble(column_index, default_value); }
+  float getFloat(int column_index, float default_value = 0.0f) override { return input_->getFloat(column_index, default_value); }
+  int getInt(int column_index, int default_value = 0) override { return input_->getInt(column_index, default_value); }
+  long long getLongLong(int column_index, long long default_value = 0) override { return input_->getLongLong(column_index, default_value); }
+  Key getKey(int column_index) override { return input_->getKey(column_index); }
+  long long getLastInsertId() const override { return input_->getLastInsertId(); }
+
+  void set(int column_idx, std::string_view value, bool is_defined = true) override { input_->set(column_idx, value, is_defined); }
+  void set(int column_idx, int value, bool is_defined = true) override { input_->set(column_idx, value, is_defined); }
+  void set(int column_idx, long long value, bool is_defined = true) override { input_->set(column_idx, value, is_defined); }
+  void set(int column_idx, double value, bool is_defined = true) override { input_->set(column_idx, value, is_defined); }
+  void set(int column_idx, const void * data, size_t len, bool is_defined) override { input_->set(column_idx, data, len, is_defined); }
+
+private:
+  bool isInRange(const Key & key) const {
+    return !(key < lo_) && (hi_.empty() || key < hi_);
+  }
+
+  std::unique_ptr<Cursor> input_;
+  Key lo_, hi_;
+};
+
+std::unique_ptr<Cursor>
+Table::seekRange(const Key & lo, const Key & hi, int sheet) {
+  auto input = seekBegin(sheet);
+  if (!input) return std::unique_ptr<Cursor>(nullptr);
+  if (lo.empty() && hi.empty()) return input;
+  auto cursor = std::make_unique<KeyRangeCursor>(std::move(input), lo, hi);
+  if (!cursor->start()) return std::unique_ptr<Cursor>(nullptr);
+  return cursor;
+}
@@ -0,0 +1,286 @@
+#include "WriteAheadLog.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <charconv>
+#include <cstring>
+#include <cstdio>
+#include <cerrno>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "robin_hood.h"
+
+using namespace std;
+using namespace sqldb;
+
+// Records are framed by the payload length and a hash of the payload, which
+// detects a record that was only partially written
+#define WAL_RECORD_HEADER_SIZE (sizeof(uint32_t) + sizeof(uint64_t))
+
+// Returns the number of a file named prefix-number, or 0 if the name
+// doesn't match
+static uint64_t parse_file_number(std::string_view name, std::string_view prefix) {
+  if (name.size() <= prefix.size() + 1 || name.substr(0, prefix.size()) != prefix || name[prefix.size()] != '-') {
+    return 0;
+  }
+  name.remove_prefix(prefix.size() + 1);
+  uint64_t n = 0;
+  auto [ ptr, ec ] = std::from_chars(name.data(), name.data() + name.size(), n);
+  return ec == std::errc() && ptr == name.data() + name.size() ? n : 0;
+}
+
+// Calls f for each file in the directory
+template<typename F>
+static void list_directory(const std::string & dir, F f) {
+  auto d = opendir(dir.c_str());
+  if (!d) {
+    throw std::runtime_error("Failed to open log directory");
+  }
+  while (auto entry = readdir(d)) {
+    f(std::string_view(entry->d_name));
+  }
+  closedir(d);
+}
+
+WriteAheadLog::WriteAheadLog(std::string dir) : dir_(std::move(dir)) {
+  if (mkdir(dir_.c_str(), 0777) != 0 && errno != EEXIST) {
+    throw std::runtime_error("Failed to create log directory");
+  }
+
+  std::vector<std::string> temporary_files;
+  list_directory(dir_, [&](std::string_view name) {
+    if (auto n = parse_file_number(name, "snapshot")) {
+      snapshot_ = std::max(snapshot_, n);
+    } else if (auto n = parse_file_number(name, "wal")) {
+      segments_.push_back(n);
+    } else if (name.size() > 4 && name.substr(name.size() - 4) == ".tmp") {
+      // snapshot that wasn't completed
+      temporary_files.push_back(dir_ + "/" + std::string(name));
+    }
+  });
+  for (auto & fn : temporary_files) ::unlink(fn.c_str());
+  std::sort(segments_.begin(), segments_.end());
+}
+
+WriteAheadLog::~WriteAheadLog() {
+  if (fd_ < 0) return;
+  {
+    std::unique_lock<std::mutex> guard(mutex_);
+    cond_.wait(guard, [this]() { return !is_writing_; });
+    if ((!buffer_.empty() || !rotated_.empty()) && !failed_) {
+      writeRecords(rotated_, buffer_);
+    }
+  }
+  if (fd_ < 0) return;
+  ::close(fd_);
+}
+
+std::string
+WriteAheadLog::getFile(const char * prefix, uint64_t n) const {
+  char buffer[64];
+  snprintf(buffer, sizeof(buffer), "/%s-%020llu", prefix, static_cast<unsigned long long>(n));
+  return dir_ + buffer;
+}
+
+std::string
+WriteAheadLog::getSnapshotFile() const {
+  return snapshot_ ? getSnapshotFile(snapshot_) : std::string();
+}
+
+void
+WriteAheadLog::recover(const std::function<void(std::string_view)> & f) {
+  // the segments before the snapshot are already in it
+  std::vector<uint64_t> segments;
+  for (auto n : segments_) {
+    if (n >= snapshot_) segments.push_back(n);
+  }
+  for (size_t i = 0; i < segments.size(); i++) {
+    if ((i == 0 && snapshot_ && segments[i] != snapshot_) || (i > 0 && segments[i] != segments[i - 1] + 1)) {
+      throw std::runtime_error("Missing log segment");
+    }
+  }
+
+  std::string data;
+  for (size_t i = 0; i < segments.size(); i++) {
+    auto fn = getFile("wal", segments[i]);
+    auto in = fopen(fn.c_str(), "rb");
+    if (!in) {
+      throw std::runtime_error("Failed to open log segment");
+    }
+    data.clear();
+    char buffer[65536];
+    size_t n;
+    while ((n = fread(buffer, 1, sizeof(buffer), in)) > 0) {
+      data.append(buffer, n);
+    }
+    bool is_error = ferror(in);
+    fclose(in);
+    if (is_error) {
+      throw std::runtime_error("Failed to read log segment");
+    }
+
+    size_t pos = 0;
+    while (data.size() - pos >= WAL_RECORD_HEADER_SIZE) {
+      uint32_t len;
+      uint64_t hash;
+      memcpy(&len, data.data() + pos, sizeof(len));
+      memcpy(&hash, data.data() + pos + sizeof(len), sizeof(hash));
+      if (data.size() - pos - WAL_RECORD_HEADER_SIZE < len) break;
+      std::string_view record(data.data() + pos + WAL_RECORD_HEADER_SIZE, len);
+      if (robin_hood::hash_bytes(record.data(), record.size()) != hash) break;
+      f(record);
+      pos += WAL_RECORD_HEADER_SIZE + len;
+    }
+    if (pos != data.size()) {
+      // only the last write can be torn
+      if (i + 1 < segments.size()) {
+	throw std::runtime_error("Corrupt log segment");
+      }
+      if (truncate(fn.c_str(), static_cast<off_t>(pos)) != 0) {
+	throw std::runtime_error("Failed to truncate log segment");
+      }
+    }
+  }
+
+  if (!openSegment(segments.empty() ? std::max<uint64_t>(snapshot_, 1) : segments.back())) {
+    throw std::runtime_error("Failed to open log segment");
+  }
+  last_segment_ = segment_;
+  struct stat st;
+  segment_size_ = fstat(fd_, &st) == 0 ? static_cast<size_t>(st.st_size) : 0;
+}
+
+uint64_t
+WriteAheadLog::append(std::string_view record) {
+  uint32_t len = static_cast<uint32_t>(record.size());
+  uint64_t hash = robin_hood::hash_bytes(record.data(), record.size());
+
+  std::lock_guard<std::mutex> guard(mutex_);
+  buffer_.append(reinterpret_cast<const char *>(&len), sizeof(len));
+  buffer_.append(reinterpret_cast<const char *>(&hash), sizeof(hash));
+  buffer_ += record;
+  segment_size_ += WAL_RECORD_HEADER_SIZE + record.size();
+  return ++last_record_;
+}
+
+void
+WriteAheadLog::sync(uint64_t record) {
+  std::unique_lock<std::mutex> guard(mutex_);
+  while (durable_record_ < record || !rotated_.empty()) {
+    if (failed_) {
+      throw std::runtime_error("Failed to write log");
+    }
+    if (is_writing_) {
+      cond_.wait(guard);
+      continue;
+    }
+
+    // write the records of all the waiting threads
+    is_writing_ = true;
+    write_buffer_.swap(buffer_);
+    auto rotated = std::move(rotated_);
+    rotated_.clear();
+    auto last_record = last_record_;
+    guard.unlock();
+
+    bool ok = writeRecords(rotated, write_buffer_);
+    write_buffer_.clear();
+
+    guard.lock();
+    is_writing_ = false;
+    if (ok) durable_record_ = last_record;
+    else failed_ = true;
+    cond_.notify_all();
+  }
+}
+
+uint64_t
+WriteAheadLog::getLastRecord() const {
+  std::lock_guard<std::mutex> guard(mutex_);
+  return last_record_;
+}
+
+size_t
+WriteAheadLog::getSegmentSize() const {
+  std::lock_guard<std::mutex> guard(mutex_);
+  return segment_size_;
+}
+
+uint64_t
+WriteAheadLog::rotate() {
+  std::lock_guard<std::mutex> guard(mutex_);
+  if (failed_) {
+    throw std::runtime_error("Failed to write log");
+  }
+  // the pending records are the rest of the current segment
+  rotated_.push_back(std::move(buffer_));
+  buffer_.clear();
+  segment_size_ = 0;
+  return ++last_segment_;
+}
+
+void
+WriteAheadLog::removeBefore(uint64_t n) {
+  // the snapshot must be in the directory before the files it replaces are
+  // removed
+  syncDirectory();
+
+  std::vector<std::string> files;
+  list_directory(dir_, [&](std::string_view name) {
+    auto m = parse_file_number(name, "snapshot");
+    if (!m) m = parse_file_number(name, "wal");
+    if (m && m < n) files.push_back(dir_ + "/" + std::string(name));
+  });
+  for (auto & fn : files) ::unlink(fn.c_str());
+  snapshot_ = std::max(snapshot_, n);
+}
+
+bool
+WriteAheadLog::openSegment(uint64_t n) {
+  auto fn = getFile("wal", n);
+  fd_ = ::open(fn.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0666);
+  if (fd_ < 0) return false;
+  segment_ = n;
+  syncDirectory();
+  return true;
+}
+
+void
+WriteAheadLog::syncDirectory() {
+  int fd = ::open(dir_.c_str(), O_RDONLY | O_DIRECTORY);
+  if (fd >= 0) {
+    fsync(fd);
+    ::close(fd);
+  }
+}
+
+bool
+WriteAheadLog::writeRecords(const std::vector<std::string> & rotated, const std::string & buffer) {
+  for (auto & records : rotated) {
+    if (!writeBuffer(records) || fdatasync(fd_) != 0) return false;
+    ::close(fd_);
+    fd_ = -1;
+    if (!openSegment(segment_ + 1)) return false;
+  }
+  return writeBuffer(buffer) && fdatasync(fd_) == 0;
+}
+
+bool
+WriteAheadLog::writeBuffer(const std::string & buffer) {
+  const char * ptr = buffer.data();
+  size_t len = buffer.size();
+  while (len > 0) {
+    auto r = ::write(fd_, ptr, len);
+    if (r < 0) {
+      if (errno == EINTR) continue;
+      return false;
+    }
+    ptr += r;
+    len -= static_cast<size_t>(r);
+  }
+  return true;
+}
@@ -0,0 +1,87 @@
+#ifndef _WRITEAHEADLOG_H_
+#define _WRITEAHEADLOG_H_
+
+#include <string>
+#include <string_view>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+#include <cstdint>
+
+namespace sqldb {
+  // Write-ahead log in a directory of numbered log segments and snapshots.
+  // Snapshot n holds the state at the start of segment n, so recovery
+  // loads the latest snapshot and replays the segments from n on.
+  //
+  // Records are appended to a buffer and written by group commit: the first
+  // thread that waits for its record writes and syncs all the records
+  // appended so far, and the threads that arrive meanwhile wait for it and
+  // are then written together by the next one.
+  class WriteAheadLog {
+  public:
+    WriteAheadLog(std::string dir);
+    WriteAheadLog(const WriteAheadLog & other) = delete;
+    ~WriteAheadLog();
+
+    WriteAheadLog & operator=(const WriteAheadLog & other) = delete;
+
+    // true if the directory has no snapshots or segments
+    bool empty() const { return snapshot_ == 0 && segments_.empty(); }
+
+    // Returns the latest snapshot, or an empty string if there is none
+    std::string getSnapshotFile() const;
+
+    // Calls f for each record after the latest snapshot and opens the last
+    // segment for appending. A torn record at the end of the last segment,
+    // left by a crash during a write, is removed.
+    void recover(const std::function<void(std::string_view)> & f);
+
+    // Appends a record and returns its sequence number
+    uint64_t append(std::string_view record);
+
+    // Waits until the record and the records before it are on disk, and
+    // throws if they can't be written
+    void sync(uint64_t record);
+    void sync() { sync(getLastRecord()); }
+
+    uint64_t getLastRecord() const;
+    size_t getSegmentSize() const;
+
+    // Starts a new segment for the records appended from now on. Returns
+    // the number of the segment, which is also the number of the snapshot
+    // of the state at its start. rotate() doesn't write anything: the next
+    // sync writes the pending records to the previous segment and opens the
+    // new one.
+    uint64_t rotate();
+
+    std::string getSnapshotFile(uint64_t n) const { return getFile("snapshot", n); }
+
+    // Removes the snapshots and the segments before n once snapshot n has
+    // been written
+    void removeBefore(uint64_t n);
+
+  private:
+    std::string getFile(const char * prefix, uint64_t n) const;
+    bool openSegment(uint64_t n);
+    void syncDirectory();
+    bool writeRecords(const std::vector<std::string> & rotated, const std::string & buffer);
+    bool writeBuffer(const std::string & buffer);
+
+    std::string dir_;
+    uint64_t snapshot_ = 0, segment_ = 0; // segment_ is the open segment
+    uint64_t last_segment_ = 0; // the segment of the records appended next
+    std::vector<uint64_t> segments_; // existing segments when opened
+    int fd_ = -1;
+
+    mutable std::mutex mutex_;
+    std::condition_variable cond_;
+    std::string buffer_, write_buffer_;
+    std::vector<std::string> rotated_; // the unwritten ends of the rotated segments
+    size_t segment_size_ = 0;
+    uint64_t last_record_ = 0, durable_record_ = 0;
+    bool is_writing_ = false, failed_ = false;
+  };
+};
+
+#endif